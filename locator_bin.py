@@ -0,0 +1,345 @@
+#!/usr/bin/env python3
+"""Decoder for the ESP32 Locator binary MQTT payload (main/scan_bin.h).
+
+  locator_bin.py [--hex] [FILE]   decode messages to the JSON the firmware
+                                  publishes otherwise (one line per message)
+  locator_bin.py bench            compare JSON and binary size and speed on
+                                  synthetic scans
+
+With --hex, every input line is one message in hex, as printed by
+"mosquitto_sub -F %x" (used by mqtt_sub.sh); JSON messages pass through and
+gzip-compressed ones ("?format=gzip") are decompressed.
+Without it, FILE (or stdin) holds a single raw message.
+"""
+
+import gzip
+import json
+import random
+import sys
+import time
+
+MAGIC = b"LB"
+VERSION = 1
+F_PAGE, F_LAST, F_STATS = 0x01, 0x02, 0x04
+DICT_MAX = 128
+HEAD_MAX = 64
+PAGE_BYTES = 16384
+
+AUTH = ["OPEN", "WEP", "WPA_PSK", "WPA2_PSK", "WPA_WPA2_PSK",
+        "WPA2_ENTERPRISE", "WPA3_PSK", "WPA2_WPA3_PSK"]
+STATS = ["timestamp", "boot_ms", "scan_ms", "save_ms", "connect_ms",
+         "portal_ms", "sntp_ms", "mqtt_ms", "total_ms", "sleep_s"]
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise ValueError("truncated message")
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated message")
+        self.pos += n
+        return self.data[self.pos - n:self.pos]
+
+    def varint(self):
+        v = shift = 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return v
+
+    def svarint(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+def decode(data):
+    """One binary message -> the dict its JSON counterpart would hold."""
+    r = Reader(data)
+    if r.bytes(2) != MAGIC:
+        raise ValueError("not a locator binary message")
+    version = r.byte()
+    if version != VERSION:
+        raise ValueError("unsupported version %d" % version)
+    flags = r.byte()
+
+    batch = part = None
+    if flags & F_PAGE:
+        batch = r.svarint()
+        part = r.varint()
+    stats = None
+    if flags & F_STATS:
+        stats = {"timestamp": r.svarint()}
+        for name in STATS[1:]:
+            stats[name] = r.varint()
+
+    ssids = [r.bytes(r.byte()).decode("utf-8", "replace") for _ in range(r.varint())]
+
+    scans = []
+    prev_id, prev_ts = -1, 0
+    for _ in range(r.varint()):
+        scan_id = prev_id + 1 + r.varint()
+        ts = prev_ts + r.svarint()
+        n = r.byte()
+        aps = []
+        for _ in range(n & 0x7F):
+            bssid = ":".join("%02X" % b for b in r.bytes(6))
+            ssid = ssids[r.varint()]
+            rssi = r.byte()
+            channel = r.byte()
+            auth = r.byte()
+            aps.append({
+                "ssid": ssid,
+                "bssid": bssid,
+                "rssi": rssi - 256 if rssi > 127 else rssi,
+                "channel": channel,
+                "auth": AUTH[auth] if auth < len(AUTH) else "UNKNOWN",
+            })
+        scan = {"id": scan_id, "timestamp": ts, "aps": aps}
+        if n & 0x80:
+            scan["location"] = {"lat": r.svarint() / 1e6, "lng": r.svarint() / 1e6,
+                                "accuracy": r.varint()}
+        scans.append(scan)
+        prev_id, prev_ts = scan_id, ts
+
+    if flags & F_PAGE:
+        return {"batch": batch, "part": part, "scans": scans, "last": bool(flags & F_LAST)}
+    if len(scans) != 1:
+        raise ValueError("single-scan message with %d scans" % len(scans))
+    if stats:
+        scans[0]["stats"] = stats
+    return scans[0]
+
+
+def to_json(data):
+    """A payload of any format as one line of JSON."""
+    if data[:2] == b"\x1f\x8b":
+        data = gzip.decompress(data)
+    if data[:1] in (b"{", b"["):
+        return data.decode("utf-8").strip()
+    return json.dumps(decode(data), separators=(",", ":"), ensure_ascii=False)
+
+
+# --- Encoder, mirrors scan_bin.c; used by the benchmark ---
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return out
+
+
+def svarint(v):
+    return varint((v << 1) ^ (v >> 63))
+
+
+class Encoder:
+    def __init__(self, size=PAGE_BYTES):
+        self.size = size
+        self.body = bytearray()
+        self.ssids = {}
+        self.dict_len = 0
+        self.scans = 0
+        self.prev_id, self.prev_ts = -1, 0
+
+    def add(self, scan):
+        """Append a scan; False (nothing added) if the message is full."""
+        ssids = dict(self.ssids)
+        dict_len = self.dict_len
+        rec = bytearray(varint(scan["id"] - self.prev_id - 1))
+        rec += svarint(scan["timestamp"] - self.prev_ts)
+        loc = scan.get("location")
+        rec.append(len(scan["aps"]) | (0x80 if loc else 0))
+        for ap in scan["aps"]:
+            ssid = ap["ssid"].encode("utf-8")[:32]
+            if ssid not in ssids:
+                if len(ssids) >= DICT_MAX:
+                    return False
+                ssids[ssid] = len(ssids)
+                dict_len += 1 + len(ssid)
+            rec += bytes.fromhex(ap["bssid"].replace(":", ""))
+            rec += varint(ssids[ssid])
+            rec += bytes([ap["rssi"] & 0xFF, ap["channel"], AUTH.index(ap["auth"])])
+        if loc:
+            rec += svarint(round(loc["lat"] * 1e6)) + svarint(round(loc["lng"] * 1e6))
+            rec += varint(round(loc["accuracy"]))
+        if len(self.body) + len(rec) + HEAD_MAX + dict_len > self.size:
+            return False
+        self.body += rec
+        self.ssids, self.dict_len = ssids, dict_len
+        self.scans += 1
+        self.prev_id, self.prev_ts = scan["id"], scan["timestamp"]
+        return True
+
+    def finish(self, flags, batch=0, part=0, stats=None):
+        out = bytearray(MAGIC) + bytes([VERSION, flags | (F_STATS if stats else 0)])
+        if flags & F_PAGE:
+            out += svarint(batch) + varint(part)
+        if stats:
+            out += svarint(stats["timestamp"])
+            for name in STATS[1:]:
+                out += varint(stats[name])
+        out += varint(len(self.ssids))
+        for ssid in self.ssids:
+            out += bytes([len(ssid)]) + ssid
+        return bytes(out + varint(self.scans) + self.body)
+
+
+def scan_json(scan):
+    return json.dumps(scan, separators=(",", ":"), ensure_ascii=False).encode("utf-8")
+
+
+def json_pages(scans, batch, per_page=0):
+    """Pages as mqtt_publish.c builds them (16 KB, optional scan limit)."""
+    pages, cur = [], []
+    size = 0
+    for s in scans:
+        j = scan_json(s)
+        if cur and ((per_page and len(cur) >= per_page) or
+                    size + 1 + len(j) + 16 > PAGE_BYTES):
+            pages.append(cur)
+            cur, size = [], 0
+        cur.append(j)
+        size += len(j) + 1
+    if cur:
+        pages.append(cur)
+    return [b'{"batch":%d,"part":%d,"scans":[' % (batch, k + 1) + b",".join(p) +
+            b'],"last":%s}' % (b"true" if k == len(pages) - 1 else b"false")
+            for k, p in enumerate(pages)]
+
+
+def bin_pages(scans, batch, per_page=0):
+    pages, enc = [], Encoder()
+    for s in scans:
+        full = per_page and enc.scans >= per_page
+        if full or not enc.add(s):
+            pages.append(enc)
+            enc = Encoder()
+            enc.add(s)
+    pages.append(enc)
+    return [e.finish(F_PAGE | (F_LAST if k == len(pages) - 1 else 0), batch, k + 1)
+            for k, e in enumerate(pages)]
+
+
+def synthetic_scans(count, aps_per_scan, seed=1):
+    """A device walking through a city: overlapping neighbourhoods of APs,
+    common SSIDs repeated, every fifth scan geolocated."""
+    rnd = random.Random(seed)
+    common = ["eduroam", "Telekom_FON", "Vodafone Hotspot", "FRITZ!Box 7590",
+              "WLAN-Gast", "DIRECT-printer", "iPhone", "Free WiFi"]
+    pool = []
+    for i in range(count * 2 + aps_per_scan * 4):
+        ssid = rnd.choice(common) if rnd.random() < 0.4 else \
+            "FRITZ!Box 7530 %s" % "".join(rnd.choice("ABCDEFGHJK") for _ in range(2)) \
+            if rnd.random() < 0.5 else "Home-%04X" % rnd.getrandbits(16)
+        pool.append({
+            "ssid": ssid,
+            "bssid": ":".join("%02X" % rnd.getrandbits(8) for _ in range(6)),
+            "channel": rnd.choice([1, 6, 11, 36, 40, 44, 48, 100]),
+            "auth": rnd.choice(AUTH[2:5] + ["OPEN"]),
+        })
+    scans, ts, pos = [], 1760000000, 0
+    for i in range(count):
+        pos += rnd.choice([0, 0, 1, 2, 3])
+        window = pool[pos:pos + aps_per_scan * 2]
+        aps = [dict(ap, rssi=rnd.randint(-92, -40))
+               for ap in rnd.sample(window, aps_per_scan)]
+        aps.sort(key=lambda ap: -ap["rssi"])
+        aps = [{k: ap[k] for k in ("ssid", "bssid", "rssi", "channel", "auth")} for ap in aps]
+        scan = {"id": i, "timestamp": ts, "aps": aps}
+        if i % 5 == 0:
+            scan["location"] = {"lat": round(52.52 + pos * 1e-4, 6),
+                                "lng": round(13.405 + i * 1e-5, 6),
+                                "accuracy": rnd.randint(10, 80)}
+        scans.append(scan)
+        ts += rnd.randint(30, 90)
+    return scans
+
+
+def timed(fn, repeat=5):
+    best = float("inf")
+    for _ in range(repeat):
+        t = time.perf_counter()
+        fn()
+        best = min(best, time.perf_counter() - t)
+    return best
+
+
+def bench(count=1000, aps_per_scan=10):
+    scans = synthetic_scans(count, aps_per_scan)
+    batch = 1760000000
+
+    # Round trip first: the binary form must decode to the same scans
+    for pages in (bin_pages(scans, batch), bin_pages(scans, batch, 20)):
+        back = [s for p in pages for s in decode(p)["scans"]]
+        assert back == scans, "round trip mismatch"
+
+    print("%d synthetic scans, %d APs each\n" % (count, aps_per_scan))
+    print("%-28s %10s %10s %7s" % ("", "JSON", "binary", "ratio"))
+
+    single_json = sum(len(scan_json(s)) for s in scans) / count
+    single_bin = 0
+    for s in scans:
+        e = Encoder()
+        e.add(s)
+        single_bin += len(e.finish(F_LAST))
+    single_bin /= count
+    print("%-28s %10.0f %10.0f %6.1fx" % ("last scan message, bytes", single_json,
+                                          single_bin, single_json / single_bin))
+
+    for label, per_page in (("full history, 16 KB pages", 0), ("incremental, 20 per page", 20)):
+        jp = json_pages(scans, batch, per_page)
+        bp = bin_pages(scans, batch, per_page)
+        js, bs = sum(map(len, jp)), sum(map(len, bp))
+        print("%-28s %10d %10d %6.1fx" % (label + ", bytes", js, bs, js / bs))
+        print("%-28s %10d %10d" % ("  pages", len(jp), len(bp)))
+        print("%-28s %10.1f %10.1f" % ("  bytes per scan", js / count, bs / count))
+
+    jp, bp = json_pages(scans, batch), bin_pages(scans, batch)
+    t_json_enc = timed(lambda: json_pages(scans, batch))
+    t_bin_enc = timed(lambda: bin_pages(scans, batch))
+    t_json_dec = timed(lambda: [json.loads(p) for p in jp])
+    t_bin_dec = timed(lambda: [decode(p) for p in bp])
+    print("\nPython throughput, scans/s (the device encodes in C)")
+    print("%-28s %10.0f %10.0f" % ("  encode", count / t_json_enc, count / t_bin_enc))
+    print("%-28s %10.0f %10.0f" % ("  decode", count / t_json_dec, count / t_bin_dec))
+
+
+def main(argv):
+    if argv[:1] == ["bench"]:
+        args = [int(a) for a in argv[1:3]]
+        bench(*args)
+        return 0
+
+    hex_lines = "--hex" in argv
+    files = [a for a in argv if a != "--hex"]
+    if hex_lines:
+        src = open(files[0]) if files else sys.stdin
+        for line in src:
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                print(to_json(bytes.fromhex(line)), flush=True)
+            except ValueError as e:
+                print("WARNING: skipping message: %s" % e, file=sys.stderr)
+        return 0
+
+    data = open(files[0], "rb").read() if files else sys.stdin.buffer.read()
+    print(to_json(data))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -4,6 +4,7 @@
 #include "esp_crt_bundle.h"
 #include "esp_log.h"
 #include "cJSON.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -33,76 +34,113 @@ static char *build_request_json(const stored_ap_t *aps, uint8_t ap_count)
     return json;
 }
 
-esp_err_t geolocation_request(const char *api_key, const stored_ap_t *aps,
-                              uint8_t ap_count, geolocation_result_t *result)
+struct geolocation_session {
+    esp_http_client_handle_t client;
+    int requests;           // sent on the current connection
+};
+
+geolocation_session_t *geolocation_session_open(const char *api_key)
 {
     char url[256];
     snprintf(url, sizeof(url),
              "https://www.googleapis.com/geolocation/v1/geolocate?key=%s", api_key);
 
-    char *post_data = build_request_json(aps, ap_count);
-    if (!post_data) {
-        ESP_LOGE(TAG, "Failed to build JSON");
-        return ESP_ERR_NO_MEM;
-    }
-
-    ESP_LOGI(TAG, "Requesting geolocation with %u APs", ap_count);
+    geolocation_session_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
 
     esp_http_client_config_t config = {
         .url = url,
         .method = HTTP_METHOD_POST,
         .crt_bundle_attach = esp_crt_bundle_attach,
     };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) {
-        free(post_data);
-        return ESP_FAIL;
+    s->client = esp_http_client_init(&config);
+    if (!s->client) {
+        free(s);
+        return NULL;
     }
+    esp_http_client_set_header(s->client, "Content-Type", "application/json");
+    return s;
+}
 
-    esp_http_client_set_header(client, "Content-Type", "application/json");
+void geolocation_session_close(geolocation_session_t *s)
+{
+    if (!s) return;
+    esp_http_client_close(s->client);
+    esp_http_client_cleanup(s->client);
+    free(s);
+}
 
-    int post_len = strlen(post_data);
-    esp_err_t err = esp_http_client_open(client, post_len);
+// One POST on the session's connection (opened if needed). The response body
+// is read to the end so the connection can carry the next request.
+static esp_err_t session_post(geolocation_session_t *s, const char *post_data, int post_len,
+                              int *status, char *resp_buf, int resp_size)
+{
+    esp_err_t err = esp_http_client_open(s->client, post_len);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Connection failed: %s", esp_err_to_name(err));
-        free(post_data);
-        esp_http_client_cleanup(client);
         return err;
     }
 
-    int wlen = esp_http_client_write(client, post_data, post_len);
-    free(post_data);
-    if (wlen < 0) {
-        ESP_LOGE(TAG, "Write failed");
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
+    if (esp_http_client_write(s->client, post_data, post_len) < 0 ||
+        esp_http_client_fetch_headers(s->client) < 0) {
+        esp_http_client_close(s->client);
         return ESP_FAIL;
     }
+    *status = esp_http_client_get_status_code(s->client);
 
-    esp_http_client_fetch_headers(client);
-    int status = esp_http_client_get_status_code(client);
-    ESP_LOGI(TAG, "Response status=%d", status);
+    int total_read = 0;
+    while (total_read < resp_size - 1) {
+        int rlen = esp_http_client_read(s->client, resp_buf + total_read,
+                                        resp_size - 1 - total_read);
+        if (rlen <= 0) break;
+        total_read += rlen;
+    }
+    resp_buf[total_read] = 0;
+
+    // Response not read to the end: the connection can't be reused
+    if (!esp_http_client_is_complete_data_received(s->client)) {
+        esp_http_client_close(s->client);
+        s->requests = 0;
+    } else {
+        s->requests++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t geolocation_session_request(geolocation_session_t *s, const stored_ap_t *aps,
+                                      uint8_t ap_count, geolocation_result_t *result)
+{
+    char *post_data = build_request_json(aps, ap_count);
+    if (!post_data) {
+        ESP_LOGE(TAG, "Failed to build JSON");
+        return ESP_ERR_NO_MEM;
+    }
 
-    // Read response body
     char *resp_buf = malloc(MAX_RESPONSE_SIZE);
     if (!resp_buf) {
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
+        free(post_data);
         return ESP_ERR_NO_MEM;
     }
 
-    int total_read = 0;
-    while (total_read < MAX_RESPONSE_SIZE - 1) {
-        int rlen = esp_http_client_read(client, resp_buf + total_read,
-                                         MAX_RESPONSE_SIZE - 1 - total_read);
-        if (rlen <= 0) break;
-        total_read += rlen;
-    }
-    resp_buf[total_read] = 0;
+    ESP_LOGI(TAG, "Requesting geolocation with %u APs", ap_count);
 
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
+    int post_len = strlen(post_data);
+    int status = 0;
+    bool reused = s->requests > 0;
+    esp_err_t err = session_post(s, post_data, post_len, &status, resp_buf, MAX_RESPONSE_SIZE);
+    if (err != ESP_OK && reused) {
+        // The server may have dropped the idle connection; once more on a new one
+        ESP_LOGI(TAG, "Kept-alive connection lost, reconnecting");
+        esp_http_client_close(s->client);
+        s->requests = 0;
+        err = session_post(s, post_data, post_len, &status, resp_buf, MAX_RESPONSE_SIZE);
+    }
+    free(post_data);
+    if (err != ESP_OK) {
+        free(resp_buf);
+        return err;
+    }
+    ESP_LOGI(TAG, "Response status=%d", status);
 
     if (status != 200) {
         ESP_LOGE(TAG, "Google API error %d: %s", status, resp_buf);
@@ -143,3 +181,13 @@ esp_err_t geolocation_request(const char *api_key, const stored_ap_t *aps,
              result->lat, result->lng, result->accuracy);
     return ESP_OK;
 }
+
+esp_err_t geolocation_request(const char *api_key, const stored_ap_t *aps,
+                              uint8_t ap_count, geolocation_result_t *result)
+{
+    geolocation_session_t *s = geolocation_session_open(api_key);
+    if (!s) return ESP_FAIL;
+    esp_err_t err = geolocation_session_request(s, aps, ap_count, result);
+    geolocation_session_close(s);
+    return err;
+}
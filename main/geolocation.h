@@ -16,3 +16,12 @@ typedef struct {
 // result: output location
 esp_err_t geolocation_request(const char *api_key, const stored_ap_t *aps,
                               uint8_t ap_count, geolocation_result_t *result);
+
+// Keep-alive connection for many requests in a row: one TLS handshake for
+// the whole batch instead of one per scan
+typedef struct geolocation_session geolocation_session_t;
+
+geolocation_session_t *geolocation_session_open(const char *api_key);
+esp_err_t geolocation_session_request(geolocation_session_t *session, const stored_ap_t *aps,
+                                      uint8_t ap_count, geolocation_result_t *result);
+void geolocation_session_close(geolocation_session_t *session);
@@ -0,0 +1,270 @@
+#include "gz_stream.h"
+#include "esp_rom_crc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define GZ_MIN_MATCH 3
+#define GZ_MAX_MATCH 258
+#define GZ_HASH_BITS 10
+#define GZ_MAX_CHAIN 16
+#define GZ_OUT_BYTES 512
+
+struct gz_stream {
+    gz_out_fn out;
+    void     *arg;
+    uint8_t   win[2 * GZ_WINDOW];       // history, then input not yet compressed
+    uint16_t  head[1 << GZ_HASH_BITS];  // position + 1 of the latest 3-byte hash, 0 = none
+    uint16_t  prev[GZ_WINDOW];          // older positions with the same hash
+    size_t    pos;                      // next byte to compress
+    size_t    end;                      // end of input in win
+    uint32_t  bits;
+    int       bit_count;
+    uint8_t   obuf[GZ_OUT_BYTES];
+    size_t    olen;
+    size_t    out_total;
+    uint32_t  crc;
+    uint32_t  isize;
+    bool      failed;
+};
+
+static const uint16_t s_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t s_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t s_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t s_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static void flush_out(gz_stream_t *z)
+{
+    if (z->olen && !z->failed && !z->out(z->obuf, z->olen, z->arg)) z->failed = true;
+    z->out_total += z->olen;
+    z->olen = 0;
+}
+
+static void put_byte(gz_stream_t *z, uint8_t b)
+{
+    z->obuf[z->olen++] = b;
+    if (z->olen == GZ_OUT_BYTES) flush_out(z);
+}
+
+// Deflate packs bits LSB first
+static void put_bits(gz_stream_t *z, uint32_t value, int count)
+{
+    z->bits |= value << z->bit_count;
+    z->bit_count += count;
+    while (z->bit_count >= 8) {
+        put_byte(z, (uint8_t)z->bits);
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+// ...except Huffman codes, which go MSB first
+static void put_code(gz_stream_t *z, uint32_t code, int len)
+{
+    uint32_t rev = 0;
+    for (int i = 0; i < len; i++) {
+        rev = (rev << 1) | (code & 1);
+        code >>= 1;
+    }
+    put_bits(z, rev, len);
+}
+
+// Fixed literal/length code (RFC 1951 3.2.6)
+static void put_symbol(gz_stream_t *z, int sym)
+{
+    if (sym < 144) {
+        put_code(z, 0x30 + sym, 8);
+    } else if (sym < 256) {
+        put_code(z, 0x190 + sym - 144, 9);
+    } else if (sym < 280) {
+        put_code(z, sym - 256, 7);
+    } else {
+        put_code(z, 0xC0 + sym - 280, 8);
+    }
+}
+
+static void put_match(gz_stream_t *z, int len, int dist)
+{
+    int i = 28;
+    while (s_len_base[i] > len) i--;
+    put_symbol(z, 257 + i);
+    put_bits(z, len - s_len_base[i], s_len_extra[i]);
+
+    int d = 29;
+    while (s_dist_base[d] > dist) d--;
+    put_code(z, d, 5);
+    put_bits(z, dist - s_dist_base[d], s_dist_extra[d]);
+}
+
+static uint32_t hash3(const uint8_t *p)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - GZ_HASH_BITS);
+}
+
+static void insert(gz_stream_t *z, size_t pos)
+{
+    uint32_t h = hash3(z->win + pos);
+    z->prev[pos & (GZ_WINDOW - 1)] = z->head[h];
+    z->head[h] = (uint16_t)(pos + 1);
+}
+
+// Longest earlier match for the bytes at pos (call before inserting pos)
+static int find_match(gz_stream_t *z, int *dist)
+{
+    size_t max = z->end - z->pos;
+    if (max > GZ_MAX_MATCH) max = GZ_MAX_MATCH;
+
+    const uint8_t *cur = z->win + z->pos;
+    uint16_t cand = z->head[hash3(cur)];
+    int best = 0;
+    for (int chain = 0; cand && chain < GZ_MAX_CHAIN; chain++) {
+        size_t c = cand - 1;
+        if (c >= z->pos || z->pos - c > GZ_WINDOW) break;
+
+        const uint8_t *p = z->win + c;
+        if (p[best] == cur[best]) {
+            size_t len = 0;
+            while (len < max && p[len] == cur[len]) len++;
+            if ((int)len > best) {
+                best = (int)len;
+                *dist = (int)(z->pos - c);
+                if (len == max) break;
+            }
+        }
+        uint16_t next = z->prev[c & (GZ_WINDOW - 1)];
+        if (next >= cand) break;  // slot reused by a newer position
+        cand = next;
+    }
+    return best >= GZ_MIN_MATCH ? best : 0;
+}
+
+// Compress input, keeping GZ_MAX_MATCH bytes back unless finishing so that
+// matches can run on into the next write
+static void compress(gz_stream_t *z, bool finish)
+{
+    size_t keep = finish ? 0 : GZ_MAX_MATCH;
+    while (z->end - z->pos > keep) {
+        int len = 0, dist = 0;
+        if (z->end - z->pos >= GZ_MIN_MATCH) {
+            len = find_match(z, &dist);
+            insert(z, z->pos);
+        }
+        if (len) {
+            put_match(z, len, dist);
+            for (int i = 1; i < len; i++) {
+                if (z->pos + i + GZ_MIN_MATCH <= z->end) insert(z, z->pos + i);
+            }
+            z->pos += len;
+        } else {
+            put_symbol(z, z->win[z->pos]);
+            z->pos++;
+        }
+    }
+}
+
+// Drop the older half of the window
+static void slide(gz_stream_t *z)
+{
+    memmove(z->win, z->win + GZ_WINDOW, GZ_WINDOW);
+    z->pos -= GZ_WINDOW;
+    z->end -= GZ_WINDOW;
+    for (size_t i = 0; i < sizeof(z->head) / sizeof(z->head[0]); i++) {
+        z->head[i] = z->head[i] > GZ_WINDOW ? z->head[i] - GZ_WINDOW : 0;
+    }
+    for (size_t i = 0; i < GZ_WINDOW; i++) {
+        z->prev[i] = z->prev[i] > GZ_WINDOW ? z->prev[i] - GZ_WINDOW : 0;
+    }
+}
+
+gz_stream_t *gz_stream_create(gz_out_fn out, void *arg)
+{
+    gz_stream_t *z = malloc(sizeof(gz_stream_t));
+    if (!z) return NULL;
+    z->out = out;
+    z->arg = arg;
+    return z;
+}
+
+void gz_stream_free(gz_stream_t *z)
+{
+    free(z);
+}
+
+bool gz_stream_begin(gz_stream_t *z)
+{
+    memset(z->head, 0, sizeof(z->head));
+    z->pos = 0;
+    z->end = 0;
+    z->bits = 0;
+    z->bit_count = 0;
+    z->olen = 0;
+    z->out_total = 0;
+    z->crc = 0;
+    z->isize = 0;
+    z->failed = false;
+
+    // ID1 ID2 CM=deflate FLG MTIME(4) XFL OS=unknown
+    static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    for (int i = 0; i < 10; i++) put_byte(z, header[i]);
+    put_bits(z, 0, 1);  // BFINAL: closed by an empty final block
+    put_bits(z, 1, 2);  // BTYPE: fixed Huffman
+    return true;
+}
+
+bool gz_stream_write(gz_stream_t *z, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    z->crc = esp_rom_crc32_le(z->crc, p, len);
+    z->isize += len;
+    while (len && !z->failed) {
+        if (z->end == sizeof(z->win)) slide(z);
+        size_t n = sizeof(z->win) - z->end;
+        if (n > len) n = len;
+        memcpy(z->win + z->end, p, n);
+        z->end += n;
+        p += n;
+        len -= n;
+        compress(z, false);
+    }
+    return !z->failed;
+}
+
+bool gz_stream_finish(gz_stream_t *z)
+{
+    compress(z, true);
+    put_symbol(z, 256);  // end of block
+    put_bits(z, 1, 1);
+    put_bits(z, 1, 2);
+    put_symbol(z, 256);
+    if (z->bit_count) put_bits(z, 0, 8 - z->bit_count);
+
+    for (int i = 0; i < 4; i++) put_byte(z, (uint8_t)(z->crc >> (8 * i)));
+    for (int i = 0; i < 4; i++) put_byte(z, (uint8_t)(z->isize >> (8 * i)));
+    flush_out(z);
+    return !z->failed;
+}
+
+size_t gz_stream_bound(const gz_stream_t *z, size_t more)
+{
+    // At most 9 bits per input byte; two end-of-block codes and a block
+    // header (17 bits) and the 8-byte trailer to finish
+    size_t pending = z->end - z->pos + more;
+    return z->out_total + z->olen + (z->bit_count + pending * 9 + 17 + 7) / 8 + 8;
+}
+
+size_t gz_stream_out_total(const gz_stream_t *z)
+{
+    return z->out_total + z->olen;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming gzip (RFC 1952) encoder for repetitive text such as scan JSON.
+// Deflate with fixed Huffman codes and a GZ_WINDOW byte LZ77 window: no
+// block buffering, so output keeps pace with input and the whole document
+// never has to be in RAM. Needs ~19 KB of heap per stream.
+
+#define GZ_WINDOW 4096
+
+// Receives compressed output; return false to abort the stream
+typedef bool (*gz_out_fn)(const uint8_t *data, size_t len, void *arg);
+
+typedef struct gz_stream gz_stream_t;
+
+gz_stream_t *gz_stream_create(gz_out_fn out, void *arg);
+void         gz_stream_free(gz_stream_t *z);
+
+// Start a new gzip member (writes the header). A stream can be reused.
+bool gz_stream_begin(gz_stream_t *z);
+bool gz_stream_write(gz_stream_t *z, const void *data, size_t len);
+
+// Compress what is left and write the trailer; everything reaches out()
+bool gz_stream_finish(gz_stream_t *z);
+
+// Upper bound of the member's total size if `more` bytes are written and the
+// stream is then finished
+size_t gz_stream_bound(const gz_stream_t *z, size_t more);
+
+// Compressed bytes passed to out() so far in this member
+size_t gz_stream_out_total(const gz_stream_t *z);
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+"""Build step: gzip a web page for embedding and write its ETag header.
+
+    gzip_page.py <page> <out.gz> <out_etag.h> <macro>
+
+The gzip output has no file name or timestamp, so it only changes when the
+page does. The macro is the first 16 hex digits of the page's SHA-256, for
+use in the ETag.
+"""
+import gzip
+import hashlib
+import os
+import sys
+
+
+def main():
+    if len(sys.argv) != 5:
+        sys.exit(__doc__)
+    page, out_gz, out_h, macro = sys.argv[1:]
+    with open(page, 'rb') as f:
+        data = f.read()
+
+    with open(out_gz, 'wb') as f:
+        f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+    digest = hashlib.sha256(data).hexdigest()[:16]
+    header = ('// Generated by gzip_page.py from %s\n'
+              '#pragma once\n'
+              '#define %s "%s"\n') % (os.path.basename(page), macro, digest)
+    # Leave the header alone when unchanged so its users aren't rebuilt
+    try:
+        with open(out_h) as f:
+            if f.read() == header:
+                return
+    except OSError:
+        pass
+    with open(out_h, 'w') as f:
+        f.write(header)
+
+
+if __name__ == '__main__':
+    main()
@@ -10,14 +10,17 @@
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "driver/rtc_io.h"
 #include "driver/gpio.h"
 
 #include "wifi_scan.h"
+#include "wifi_session.h"
 #include "scan_store.h"
 #include "web_server.h"
 #include "wifi_connect.h"
+#include "motion.h"
 #include <mdns.h>
 #ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
 #include "open_wifi.h"
@@ -34,6 +37,60 @@
 
 static const char *TAG = "locator";
 
+// Per-phase wake cycle timing (esp_timer starts shortly after the bootloader)
+static int64_t s_phase_start;
+
+// Timing of the current scan-mode cycle, added to the stats ring at sleep
+static cycle_stats_t s_cycle;
+static bool s_cycle_active = false;
+
+// Logs and returns the ms spent since the previous phase
+static int64_t phase_done(const char *phase)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t ms = (now - s_phase_start) / 1000;
+    ESP_LOGI(TAG, "Timing: %-8s %5lld ms (t=%lld ms)", phase, (long long)ms, (long long)now / 1000);
+    s_phase_start = now;
+    return ms;
+}
+
+static uint16_t clamp_ms(int64_t ms)
+{
+    return ms > UINT16_MAX ? UINT16_MAX : (uint16_t)ms;
+}
+
+// The TCP/IP stack is only started when a connection is about to be made
+static void netif_init_once(void)
+{
+    static bool done = false;
+    if (!done) {
+        ESP_ERROR_CHECK(esp_netif_init());
+        done = true;
+    }
+}
+
+#ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
+// Flush buffered scans and bring up the network stack before connecting
+static void prepare_wifi_connect(void)
+{
+    scan_store_flush();
+    netif_init_once();
+}
+
+// Add the phase timing of the last open_wifi_try*() call to this cycle
+static void record_wifi_timing(bool connected, uint8_t flag)
+{
+    open_wifi_timing_t t;
+    open_wifi_get_timing(&t);
+    s_cycle.connect_ms = clamp_ms((int64_t)s_cycle.connect_ms + t.connect_ms);
+    s_cycle.portal_ms = clamp_ms((int64_t)s_cycle.portal_ms + t.portal_ms);
+    s_cycle.sntp_ms = clamp_ms((int64_t)s_cycle.sntp_ms + t.sntp_ms);
+    s_cycle.mqtt_ms = clamp_ms((int64_t)s_cycle.mqtt_ms + t.hook_ms);
+    if (t.portal) s_cycle.flags |= CYCLE_F_PORTAL;
+    if (connected) s_cycle.flags |= flag;
+}
+#endif
+
 #ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
 static esp_err_t mqtt_publish_hook(void)
 {
@@ -96,7 +153,7 @@ static void enter_deep_sleep(void)
 {
     // NVS must be initialized before calling this
     // (scan_store_init is called in both modes before we get here)
-    uint16_t interval = scan_store_get_scan_interval();
+    uint16_t interval = s_cycle_active ? motion_get_interval() : scan_store_get_scan_interval();
 
     ESP_LOGI(TAG, "Configuring deep sleep: timer=%us, button=GPIO%d",
              interval, CONFIG_LOCATOR_BOOT_BUTTON_GPIO);
@@ -110,7 +167,14 @@ static void enter_deep_sleep(void)
     /* On chips without EXT0 (C3/C6/…) we don't register a GPIO wakeup source;
        instead check_boot_button() polls the pin after every wakeup. */
 
-    ESP_LOGI(TAG, "Entering deep sleep...");
+    int64_t awake_ms = esp_timer_get_time() / 1000;
+    if (s_cycle_active) {
+        s_cycle.total_ms = clamp_ms(awake_ms);
+        s_cycle.sleep_s = interval;
+        scan_store_add_cycle_stats(&s_cycle);
+    }
+
+    ESP_LOGI(TAG, "Entering deep sleep after %lld ms awake", (long long)awake_ms);
     esp_deep_sleep_start();
 }
 
@@ -118,25 +182,59 @@ static void run_scan_mode(void)
 {
     ESP_LOGI(TAG, "=== SCAN MODE ===");
 
+    memset(&s_cycle, 0, sizeof(s_cycle));
+    s_cycle.scan_index = 0xFFFF;
+    s_cycle.boot_ms = clamp_ms(esp_timer_get_time() / 1000);
+    s_cycle_active = true;
+
+#ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
+    // Keep the WiFi driver up from the scan through any connection attempt
+    bool wifi_held = scan_store_get_open_wifi_mode() != OPEN_WIFI_OFF &&
+                     wifi_session_acquire() == ESP_OK;
+#endif
+
     stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
     uint16_t ap_count = wifi_scan_execute(aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN);
+    s_cycle.scan_ms = clamp_ms(phase_done("scan"));
+    s_cycle.ap_count = (uint8_t)ap_count;
 
     if (ap_count == 0) {
         ESP_LOGW(TAG, "No APs found, skipping storage");
+#ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
+        if (wifi_held) wifi_session_release();
+#endif
         enter_deep_sleep();
         return;  // Never reached
     }
 
     time_t now;
     time(&now);
-    ESP_LOGI(TAG, "Scanned %u APs, saving to NVS (epoch=%lld)", ap_count, (long long)now);
-    uint16_t index;
-    esp_err_t err = scan_store_save(aps, (uint8_t)ap_count, (int64_t)now, &index);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save scan: %s", esp_err_to_name(err));
+    s_cycle.timestamp = (int64_t)now;
+
+    // Compare with the previous scan to adapt the interval
+    int diff = motion_update(aps, (uint8_t)ap_count);
+    if (motion_is_moving(diff, (uint8_t)ap_count)) s_cycle.flags |= CYCLE_F_MOVED;
+
+    if (diff == 0 && scan_store_get_skip_duplicates()) {
+        ESP_LOGI(TAG, "Same %u APs as the previous scan, not storing", ap_count);
+        s_cycle.flags |= CYCLE_F_DUPLICATE;
     } else {
-        ESP_LOGI(TAG, "Saved scan #%u", index);
+        ESP_LOGI(TAG, "Scanned %u APs, saving to NVS (epoch=%lld)", ap_count, (long long)now);
+        uint16_t index;
+        esp_err_t err = scan_store_save(aps, (uint8_t)ap_count, (int64_t)now, &index);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to save scan: %s", esp_err_to_name(err));
+            s_cycle.flags |= CYCLE_F_SAVE_FAILED;
+        } else {
+            ESP_LOGI(TAG, "Saved scan #%u", index);
+            s_cycle.scan_index = index;
+#ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
+            // Queued for the last-scan topic until a broker acknowledges it
+            if (scan_store_get_open_wifi_mode() == OPEN_WIFI_REQ) scan_store_outbox_push(index);
+#endif
+        }
     }
+    s_cycle.save_ms = clamp_ms(phase_done("save"));
 
 #ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
     uint8_t ow_mode = scan_store_get_open_wifi_mode();
@@ -174,9 +272,11 @@ static void run_scan_mode(void)
                 scanned_ssid[len] = '\0';
                 if (strcmp(scanned_ssid, home_ssid) == 0) {
                     ESP_LOGI(TAG, "Home WiFi '%s' found in scan results, attempting connection", home_ssid);
+                    prepare_wifi_connect();
                     if (open_wifi_try_home(home_ssid, home_pass) == ESP_OK) {
                         wifi_done = true;
                     }
+                    record_wifi_timing(wifi_done, CYCLE_F_HOME);
                     break;
                 }
             }
@@ -185,7 +285,7 @@ static void run_scan_mode(void)
         // Fall through to open WiFi if home WiFi didn't work
         if (!wifi_done) {
             // Extract unique open SSIDs from scan results
-            const char *open_ssids[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+            open_wifi_candidate_t open_cands[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
             char ssid_bufs[CONFIG_LOCATOR_MAX_APS_PER_SCAN][33];
             uint8_t open_count = 0;
 
@@ -198,29 +298,39 @@ static void run_scan_mode(void)
                 memcpy(ssid_bufs[open_count], aps[j].ssid, len);
                 ssid_bufs[open_count][len] = '\0';
 
-                // Deduplicate
+                // Deduplicate, keeping the strongest RSSI
                 bool dup = false;
                 for (uint8_t k = 0; k < open_count; k++) {
-                    if (strcmp(open_ssids[k], ssid_bufs[open_count]) == 0) {
+                    if (strcmp(open_cands[k].ssid, ssid_bufs[open_count]) == 0) {
+                        if (aps[j].rssi > open_cands[k].rssi) {
+                            open_cands[k].bssid = aps[j].bssid;
+                            open_cands[k].rssi = aps[j].rssi;
+                        }
                         dup = true;
                         break;
                     }
                 }
                 if (dup) continue;
 
-                open_ssids[open_count] = ssid_bufs[open_count];
+                open_cands[open_count].ssid = ssid_bufs[open_count];
+                open_cands[open_count].bssid = aps[j].bssid;
+                open_cands[open_count].rssi = aps[j].rssi;
                 open_count++;
             }
 
             if (open_count > 0) {
                 ESP_LOGI(TAG, "Found %u open WiFi network(s), mode=%u, attempting connection",
                          open_count, ow_mode);
-                open_wifi_try(open_ssids, open_count);
+                prepare_wifi_connect();
+                esp_err_t ow_err = open_wifi_try(open_cands, open_count);
+                record_wifi_timing(ow_err == ESP_OK, CYCLE_F_OPEN);
             }
         }
 
         gpio_set_level(CONFIG_LOCATOR_LED_GPIO, LED_OFF);
+        phase_done("wifi");
     }
+    if (wifi_held) wifi_session_release();
 #endif
 
     enter_deep_sleep();
@@ -278,6 +388,12 @@ static void run_web_server_mode(void)
 {
     ESP_LOGI(TAG, "=== WEB SERVER MODE ===");
 
+    // Persist scans still buffered in RTC memory; the next scan session
+    // starts again at the minimum interval
+    scan_store_flush();
+    motion_reset();
+    netif_init_once();
+
     // Connect to WiFi (STA with stored creds, or SoftAP fallback)
     wifi_conn_mode_t mode = wifi_connect_init();
 
@@ -325,22 +441,26 @@ static void run_web_server_mode(void)
 void app_main(void)
 {
     esp_log_level_set("*", ESP_LOG_INFO);
+    phase_done("startup");
 
-    // Initialize NVS
+    // Initialize NVS (also holds the PHY calibration data that lets WiFi skip
+    // full RF calibration after deep sleep)
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    phase_done("nvs");
 
     // Determine operating mode from wakeup cause
     esp_sleep_wakeup_cause_t wakeup = esp_sleep_get_wakeup_cause();
 
-    // Need NVS namespace open before checking boot_mode
-    ESP_ERROR_CHECK(esp_netif_init());
+    // Need NVS namespace open before checking boot_mode. The netif layer is
+    // brought up later, only if this cycle connects to a network.
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(scan_store_init());
+    phase_done("store");
 
     switch (wakeup) {
         case ESP_SLEEP_WAKEUP_TIMER:
@@ -0,0 +1,97 @@
+#include "motion.h"
+#include "scan_store.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include <string.h>
+
+static const char *TAG = "motion";
+
+#define MOTION_MAGIC 0x4D4F5431
+
+typedef struct {
+    uint32_t magic;
+    uint16_t interval;      // seconds
+    uint8_t  ap_count;
+    uint8_t  bssid[CONFIG_LOCATOR_MAX_APS_PER_SCAN][6];
+} motion_state_t;
+
+static RTC_DATA_ATTR motion_state_t s_motion;
+
+static bool seen_before(const uint8_t *bssid)
+{
+    for (uint8_t i = 0; i < s_motion.ap_count; i++) {
+        if (memcmp(s_motion.bssid[i], bssid, 6) == 0) return true;
+    }
+    return false;
+}
+
+static bool in_scan(const stored_ap_t *aps, uint8_t ap_count, const uint8_t *bssid)
+{
+    for (uint8_t i = 0; i < ap_count; i++) {
+        if (memcmp(aps[i].bssid, bssid, 6) == 0) return true;
+    }
+    return false;
+}
+
+// Symmetric difference against the previous scan (exact BSSIDs, unlike the
+// 16-bit digests in the scan index)
+static int bssid_diff(const stored_ap_t *aps, uint8_t ap_count)
+{
+    int diffs = 0;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        if (!seen_before(aps[i].bssid)) diffs++;
+    }
+    for (uint8_t i = 0; i < s_motion.ap_count; i++) {
+        if (!in_scan(aps, ap_count, s_motion.bssid[i])) diffs++;
+    }
+    return diffs;
+}
+
+bool motion_is_moving(int diff, uint8_t ap_count)
+{
+    return diff < 0 || diff * 2 > ap_count;
+}
+
+uint16_t motion_get_interval(void)
+{
+    uint16_t min = scan_store_get_scan_interval();
+    uint16_t max = scan_store_get_scan_interval_max();
+    if (s_motion.magic != MOTION_MAGIC || max <= min || s_motion.interval < min) return min;
+    return s_motion.interval > max ? max : s_motion.interval;
+}
+
+int motion_update(const stored_ap_t *aps, uint8_t ap_count)
+{
+    if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+
+    int diff = -1;
+    uint16_t interval = motion_get_interval();
+    if (s_motion.magic == MOTION_MAGIC) {
+        diff = bssid_diff(aps, ap_count);
+    }
+
+    if (motion_is_moving(diff, ap_count)) {
+        interval = scan_store_get_scan_interval();
+    } else if (diff * 4 <= ap_count) {
+        // Stationary (at most a quarter of the APs changed): back off
+        uint16_t max = scan_store_get_scan_interval_max();
+        uint32_t next = (uint32_t)interval * 2;
+        if (max > interval) interval = next > max ? max : (uint16_t)next;
+    }
+    // Anything in between keeps the current interval
+
+    ESP_LOGI(TAG, "BSSID diff %d of %u APs, next interval %us", diff, ap_count, interval);
+
+    s_motion.magic = MOTION_MAGIC;
+    s_motion.interval = interval;
+    s_motion.ap_count = ap_count;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        memcpy(s_motion.bssid[i], aps[i].bssid, 6);
+    }
+    return diff;
+}
+
+void motion_reset(void)
+{
+    s_motion.magic = 0;
+}
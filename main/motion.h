@@ -0,0 +1,24 @@
+#pragma once
+
+#include "wifi_scan.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// On-device movement detection for scan mode. The BSSIDs of the last scan and
+// the current sleep interval are kept in RTC memory across deep sleep.
+
+// Compare a scan with the previous one, remember it, and adapt the sleep
+// interval: back to the minimum on movement, doubled while stationary.
+// Returns the symmetric difference of the BSSID sets, or -1 if there is no
+// previous scan.
+int motion_update(const stored_ap_t *aps, uint8_t ap_count);
+
+// True if a diff returned by motion_update() means the device has moved
+// (more than half of the APs differ, as highlighted in the web UI).
+bool motion_is_moving(int diff, uint8_t ap_count);
+
+// Sleep interval for the next cycle, within the configured minimum/maximum
+uint16_t motion_get_interval(void);
+
+// Forget the previous scan and return to the minimum interval
+void motion_reset(void);
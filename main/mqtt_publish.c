@@ -1,33 +1,78 @@
 #include "mqtt_publish.h"
 #include "scan_store.h"
+#include "scan_json.h"
+#include "scan_bin.h"
+#include "gz_stream.h"
 #include "mqtt_client.h"
 #include "esp_log.h"
 #include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static const char *TAG = "mqtt_pub";
 
-static SemaphoreHandle_t s_connected_sem = NULL;
-static SemaphoreHandle_t s_published_sem = NULL;
-static volatile bool s_is_connected = false;
+// "Publish all" goes out in pages of at most MQTT_PAGE_BYTES, so memory use
+// doesn't grow with the history:
+//   {"batch":T,"part":K,"scans":[...],"last":false}
+// In incremental mode pages also hold at most mqtt_batch scans, go out with
+// QoS 1 and each PUBACK moves the stored high-water mark past their scans.
+#define MQTT_PAGE_BYTES         16384
+#define MQTT_PAGE_TAIL          "],\"last\":false}"
+#define MQTT_ACK_TIMEOUT_MS     10000
+#define MQTT_CONNECT_TIMEOUT_MS 15000
+#define MQTT_DRAIN_TIMEOUT_MS   2000
+
+#ifdef CONFIG_LOCATOR_MQTT_OUTBOX_BUDGET_KB
+#define OUTBOX_BUDGET_BYTES ((size_t)CONFIG_LOCATOR_MQTT_OUTBOX_BUDGET_KB * 1024)
+#else
+#define OUTBOX_BUDGET_BYTES (32 * 1024)
+#endif
+
+#ifdef CONFIG_LOCATOR_MQTT_OUTBOX_BUDGET_SEC
+#define OUTBOX_BUDGET_MS (CONFIG_LOCATOR_MQTT_OUTBOX_BUDGET_SEC * 1000)
+#else
+#define OUTBOX_BUDGET_MS 10000
+#endif
+
+_Static_assert(SCAN_JSON_MAX + 64 <= MQTT_PAGE_BYTES, "MQTT page too small for one scan");
+
+typedef enum {
+    PAYLOAD_JSON,
+    PAYLOAD_BIN,    // scan_bin
+    PAYLOAD_GZIP,   // gzip-compressed JSON
+} payload_format_t;
+
+// One broker connection. Both URLs' brokers are connected in parallel, each
+// with its own client and events.
+typedef struct {
+    esp_mqtt_client_handle_t client;
+    SemaphoreHandle_t connected_sem;    // given on connect and disconnect
+    SemaphoreHandle_t published_sem;    // given on each PUBACK
+    volatile bool     connected;
+    volatile int      acked_msg_id;
+    const char       *broker_uri;
+} mqtt_conn_t;
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
                                 int32_t event_id, void *event_data)
 {
+    mqtt_conn_t *conn = handler_args;
     esp_mqtt_event_handle_t event = event_data;
     switch ((esp_mqtt_event_id_t)event_id) {
         case MQTT_EVENT_CONNECTED:
-            s_is_connected = true;
-            xSemaphoreGive(s_connected_sem);
+            conn->connected = true;
+            xSemaphoreGive(conn->connected_sem);
             break;
         case MQTT_EVENT_DISCONNECTED:
-            s_is_connected = false;
-            xSemaphoreGive(s_connected_sem);
+            conn->connected = false;
+            xSemaphoreGive(conn->connected_sem);
             break;
         case MQTT_EVENT_PUBLISHED:
-            xSemaphoreGive(s_published_sem);
+            conn->acked_msg_id = event->msg_id;
+            xSemaphoreGive(conn->published_sem);
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGW(TAG, "MQTT error type: %d", event->error_handle->error_type);
@@ -37,10 +82,10 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
     }
 }
 
-// Parse "mqtt://host:port/topic/path" into broker URI and topic.
-// broker_uri gets "mqtt://host:port", topic gets "topic/path".
+// Parse "mqtt://host:port/topic/path[?format=bin|gzip]" into broker URI and
+// topic. broker_uri gets "mqtt://host:port", topic gets "topic/path".
 static bool parse_mqtt_url(const char *url, char *broker_uri, size_t broker_size,
-                           char *topic, size_t topic_size)
+                           char *topic, size_t topic_size, payload_format_t *format)
 {
     const char *scheme_end = strstr(url, "://");
     if (!scheme_end) return false;
@@ -59,9 +104,22 @@ static bool parse_mqtt_url(const char *url, char *broker_uri, size_t broker_size
     broker_uri[broker_len] = '\0';
 
     const char *topic_str = path_start + 1;
-    if (strlen(topic_str) >= topic_size) return false;
-    strcpy(topic, topic_str);
-
+    const char *query = strchr(topic_str, '?');
+    size_t topic_len = query ? (size_t)(query - topic_str) : strlen(topic_str);
+    if (topic_len == 0 || topic_len >= topic_size) return false;
+    memcpy(topic, topic_str, topic_len);
+    topic[topic_len] = '\0';
+
+    *format = PAYLOAD_JSON;
+    if (query) {
+        if (strcmp(query, "?format=bin") == 0) {
+            *format = PAYLOAD_BIN;
+        } else if (strcmp(query, "?format=gzip") == 0) {
+            *format = PAYLOAD_GZIP;
+        } else if (strcmp(query, "?format=json") != 0) {
+            ESP_LOGW(TAG, "Ignoring unknown MQTT URL option: %s", query);
+        }
+    }
     return true;
 }
 
@@ -80,7 +138,7 @@ static const char *authmode_str(uint8_t mode)
     }
 }
 
-static char *build_scan_json(uint16_t id)
+static char *build_scan_json(uint16_t id, bool with_stats)
 {
     stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
     uint8_t ap_count = 0;
@@ -122,12 +180,99 @@ static char *build_scan_json(uint16_t id)
         cJSON_AddNumberToObject(location, "accuracy", loc.accuracy);
     }
 
+    // Timing of the previous (completed) wake cycle
+    cycle_stats_t c;
+    if (with_stats && scan_store_get_cycle_stats(&c, 1) == 1) {
+        cJSON *stats = cJSON_AddObjectToObject(root, "stats");
+        cJSON_AddNumberToObject(stats, "timestamp", (double)c.timestamp);
+        cJSON_AddNumberToObject(stats, "boot_ms", c.boot_ms);
+        cJSON_AddNumberToObject(stats, "scan_ms", c.scan_ms);
+        cJSON_AddNumberToObject(stats, "save_ms", c.save_ms);
+        cJSON_AddNumberToObject(stats, "connect_ms", c.connect_ms);
+        cJSON_AddNumberToObject(stats, "portal_ms", c.portal_ms);
+        cJSON_AddNumberToObject(stats, "sntp_ms", c.sntp_ms);
+        cJSON_AddNumberToObject(stats, "mqtt_ms", c.mqtt_ms);
+        cJSON_AddNumberToObject(stats, "total_ms", c.total_ms);
+        cJSON_AddNumberToObject(stats, "sleep_s", c.sleep_s);
+    }
+
     char *json = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
     return json;
 }
 
-static esp_mqtt_client_handle_t connect_mqtt(const char *broker_uri)
+// Binary counterpart of build_scan_json. Returns the length, 0 on failure.
+static size_t build_scan_bin(uint16_t id, uint8_t *buf, size_t size, bool with_stats)
+{
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t ap_count = 0;
+    if (scan_store_load(id, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK) {
+        return 0;
+    }
+
+    int64_t timestamp = 0;
+    scan_store_get_scan_info(id, NULL, &timestamp);
+    scan_location_t loc;
+    bool has_loc = scan_store_get_location(id, &loc) == ESP_OK;
+    cycle_stats_t c;
+    bool has_stats = with_stats && scan_store_get_cycle_stats(&c, 1) == 1;
+
+    scan_bin_t *w = malloc(sizeof(scan_bin_t));
+    if (!w) return 0;
+    size_t len = 0;
+    scan_bin_begin(w, buf, size);
+    if (scan_bin_add(w, id, timestamp, aps, ap_count, has_loc ? &loc : NULL)) {
+        len = scan_bin_finish(w, SCAN_BIN_F_LAST, 0, 0, has_stats ? &c : NULL);
+    }
+    free(w);
+    return len;
+}
+
+typedef struct {
+    char  *buf;
+    size_t len;
+    size_t size;
+} gz_buf_t;
+
+static bool gz_buf_out(const uint8_t *data, size_t len, void *arg)
+{
+    gz_buf_t *b = arg;
+    if (b->len + len > b->size) return false;
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return true;
+}
+
+// gzip a whole document. Returns a malloc'd buffer, NULL if out of memory.
+static char *gzip_alloc(const char *data, size_t len, size_t *out_len)
+{
+    gz_buf_t out = { .size = len + len / 8 + 32 };  // covers gz_stream_bound()
+    out.buf = malloc(out.size);
+    gz_stream_t *z = gz_stream_create(gz_buf_out, &out);
+    bool ok = out.buf && z && gz_stream_begin(z) && gz_stream_write(z, data, len) &&
+              gz_stream_finish(z);
+    gz_stream_free(z);
+    if (!ok) {
+        free(out.buf);
+        return NULL;
+    }
+    *out_len = out.len;
+    return out.buf;
+}
+
+static void conn_free(mqtt_conn_t *conn)
+{
+    if (conn->client) esp_mqtt_client_destroy(conn->client);
+    if (conn->connected_sem) vSemaphoreDelete(conn->connected_sem);
+    if (conn->published_sem) vSemaphoreDelete(conn->published_sem);
+    conn->client = NULL;
+    conn->connected_sem = NULL;
+    conn->published_sem = NULL;
+    conn->connected = false;
+}
+
+// Start connecting without waiting, so several brokers connect in parallel
+static bool conn_start(mqtt_conn_t *conn, const char *broker_uri)
 {
     char client_id[65] = {0};
     char username[65] = {0};
@@ -150,67 +295,390 @@ static esp_mqtt_client_handle_t connect_mqtt(const char *broker_uri)
     if (username[0])  mqtt_cfg.credentials.username = username;
     if (password[0])  mqtt_cfg.credentials.authentication.password = password;
 
-    s_connected_sem = xSemaphoreCreateBinary();
-    s_published_sem = xSemaphoreCreateBinary();
-    s_is_connected = false;
+    // The broker can only find a kept session by a fixed client ID
+    if (scan_store_get_mqtt_persist()) {
+        if (client_id[0]) {
+            mqtt_cfg.session.disable_clean_session = true;
+        } else {
+            ESP_LOGW(TAG, "Persistent session needs MQTT_CLIENT_ID, using a clean session");
+        }
+    }
 
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
-    if (!client) {
-        vSemaphoreDelete(s_connected_sem);
-        vSemaphoreDelete(s_published_sem);
-        s_connected_sem = NULL;
-        s_published_sem = NULL;
-        return NULL;
+    *conn = (mqtt_conn_t){ .broker_uri = broker_uri, .acked_msg_id = -1 };
+    conn->connected_sem = xSemaphoreCreateBinary();
+    conn->published_sem = xSemaphoreCreateBinary();
+    if (conn->connected_sem && conn->published_sem) {
+        conn->client = esp_mqtt_client_init(&mqtt_cfg);
+    }
+    if (!conn->client) {
+        conn_free(conn);
+        return false;
     }
 
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
+    esp_mqtt_client_register_event(conn->client, ESP_EVENT_ANY_ID, mqtt_event_handler, conn);
+    if (esp_mqtt_client_start(conn->client) != ESP_OK) {
+        conn_free(conn);
+        return false;
+    }
+    return true;
+}
 
-    bool sem_ok = xSemaphoreTake(s_connected_sem, pdMS_TO_TICKS(15000)) == pdTRUE;
-    if (!sem_ok || !s_is_connected) {
-        ESP_LOGW(TAG, "MQTT connection to %s failed (%s)", broker_uri,
+static bool conn_wait(mqtt_conn_t *conn, TickType_t deadline)
+{
+    if (!conn->client) {
+        ESP_LOGW(TAG, "MQTT client for %s could not start", conn->broker_uri);
+        return false;
+    }
+    TickType_t now = xTaskGetTickCount();
+    bool sem_ok = now < deadline &&
+                  xSemaphoreTake(conn->connected_sem, deadline - now) == pdTRUE;
+    if (!sem_ok || !conn->connected) {
+        ESP_LOGW(TAG, "MQTT connection to %s failed (%s)", conn->broker_uri,
                  sem_ok ? "rejected" : "timed out");
-        esp_mqtt_client_stop(client);
-        esp_mqtt_client_destroy(client);
-        vSemaphoreDelete(s_connected_sem);
-        vSemaphoreDelete(s_published_sem);
-        s_connected_sem = NULL;
-        s_published_sem = NULL;
-        return NULL;
+        esp_mqtt_client_stop(conn->client);
+        conn_free(conn);
+        return false;
     }
-
-    ESP_LOGI(TAG, "Connected to %s", broker_uri);
-    return client;
+    ESP_LOGI(TAG, "Connected to %s", conn->broker_uri);
+    return true;
 }
 
-static void disconnect_mqtt(esp_mqtt_client_handle_t client)
+// Close once nothing is left to send: QoS 1 messages stay in the outbox until
+// their PUBACK. The DISCONNECT packet is written by esp_mqtt_client_disconnect()
+// itself, so the client can stop as soon as the disconnect event arrives.
+static void conn_close(mqtt_conn_t *conn)
 {
-    esp_mqtt_client_disconnect(client);
-    vTaskDelay(pdMS_TO_TICKS(200));
-    esp_mqtt_client_stop(client);
-    esp_mqtt_client_destroy(client);
-
-    if (s_connected_sem) { vSemaphoreDelete(s_connected_sem); s_connected_sem = NULL; }
-    if (s_published_sem) { vSemaphoreDelete(s_published_sem); s_published_sem = NULL; }
-    s_is_connected = false;
+    if (!conn->client) return;
+
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(MQTT_DRAIN_TIMEOUT_MS);
+    while (conn->connected && esp_mqtt_client_get_outbox_size(conn->client) > 0) {
+        TickType_t now = xTaskGetTickCount();
+        if (now >= deadline) {
+            ESP_LOGW(TAG, "Closing with unacknowledged messages");
+            break;
+        }
+        xSemaphoreTake(conn->published_sem, deadline - now);
+    }
+
+    if (conn->connected) {
+        esp_mqtt_client_disconnect(conn->client);
+        if (conn->connected) {
+            xSemaphoreTake(conn->connected_sem, pdMS_TO_TICKS(MQTT_DRAIN_TIMEOUT_MS));
+        }
+    }
+    esp_mqtt_client_stop(conn->client);
+    conn_free(conn);
 }
 
-static bool publish_and_wait(esp_mqtt_client_handle_t client,
-                             const char *topic, const char *data, int len)
+// QoS 0 goes straight to the socket inside esp_mqtt_client_publish(), there
+// is no acknowledgement to wait for
+static bool publish_qos0(mqtt_conn_t *conn, const char *topic, const char *data, int len,
+                         bool retain)
 {
-    int msg_id = esp_mqtt_client_publish(client, topic, data, len, 0, 1);
+    int msg_id = esp_mqtt_client_publish(conn->client, topic, data, len, 0, retain);
     if (msg_id < 0) {
         ESP_LOGW(TAG, "Publish to '%s' failed", topic);
         return false;
     }
+    ESP_LOGI(TAG, "Published to '%s' (%d bytes)", topic, len);
+    return true;
+}
+
+// QoS 1: wait for the broker's PUBACK of msg_id
+static bool wait_for_ack(mqtt_conn_t *conn, int msg_id)
+{
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(MQTT_ACK_TIMEOUT_MS);
+    while (conn->connected) {
+        TickType_t now = xTaskGetTickCount();
+        if (now >= deadline) break;
+        if (xSemaphoreTake(conn->published_sem, deadline - now) != pdTRUE) break;
+        if (conn->acked_msg_id == msg_id) return true;
+    }
+    ESP_LOGW(TAG, "No acknowledgement for message %d", msg_id);
+    return false;
+}
 
-    // QoS 0: no broker acknowledgement, brief delay to let it send
-    vTaskDelay(pdMS_TO_TICKS(100));
+typedef struct {
+    mqtt_conn_t *conn;
+    const char *topic;
+    int     qos;
+    uint8_t max_scans;  // per page, 0 = only limited by size
+    char   *buf;
+    size_t  len;
+    char   *scan;       // JSON: one serialized scan
+    scan_bin_t *bin;    // binary format if set
+    gz_stream_t *gz;    // JSON compressed into buf if set
+    int64_t batch;
+    uint16_t part;
+    uint16_t scans;     // scans in the open page, 0 = no page open
+    uint16_t next;      // index after the scans handled so far
+    uint16_t acked;     // index after the scans the broker has (QoS 1)
+} page_writer_t;
+
+static bool page_gz_out(const uint8_t *data, size_t len, void *arg)
+{
+    page_writer_t *w = arg;
+    if (w->len + len > MQTT_PAGE_BYTES) return false;
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return true;
+}
 
-    ESP_LOGI(TAG, "Published to '%s' (%d bytes)", topic, len);
+// JSON text into the page, through the compressor if there is one
+static void page_put(page_writer_t *w, const char *data, size_t len)
+{
+    if (w->gz) {
+        gz_stream_write(w->gz, data, len);
+    } else {
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+    }
+}
+
+static void page_open(page_writer_t *w)
+{
+    w->part++;
+    if (w->bin) {
+        scan_bin_begin(w->bin, (uint8_t *)w->buf, MQTT_PAGE_BYTES);
+        return;
+    }
+    char head[64];
+    int n = snprintf(head, sizeof(head), "{\"batch\":%lld,\"part\":%u,\"scans\":[",
+                     (long long)w->batch, w->part);
+    w->len = 0;
+    if (w->gz) gz_stream_begin(w->gz);
+    page_put(w, head, n);
+}
+
+static bool page_flush(page_writer_t *w, bool last)
+{
+    if (w->scans == 0) {
+        w->acked = w->next;
+        return true;
+    }
+    if (w->bin) {
+        w->len = scan_bin_finish(w->bin, SCAN_BIN_F_PAGE | (last ? SCAN_BIN_F_LAST : 0),
+                                 w->batch, w->part, NULL);
+    } else {
+        const char *tail = last ? "],\"last\":true}" : MQTT_PAGE_TAIL;
+        page_put(w, tail, strlen(tail));
+        if (w->gz && !gz_stream_finish(w->gz)) w->len = 0;
+    }
+
+    bool ok;
+    if (w->len == 0) {
+        ok = false;
+    } else if (w->qos > 0) {
+        int msg_id = esp_mqtt_client_publish(w->conn->client, w->topic, w->buf, w->len, w->qos, 0);
+        ok = msg_id >= 0 && wait_for_ack(w->conn, msg_id);
+        if (ok) ESP_LOGI(TAG, "Page %u acknowledged (%u bytes)", w->part, (unsigned)w->len);
+    } else {
+        // A history that fits one page stays a retained message, as before
+        ok = publish_qos0(w->conn, w->topic, w->buf, w->len, last && w->part == 1);
+    }
+    if (ok) w->acked = w->next;
+    w->len = 0;
+    w->scans = 0;
+    return ok;
+}
+
+static bool page_add_json(page_writer_t *w, uint16_t id, int64_t timestamp,
+                          const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc)
+{
+    size_t n = scan_json_write(w->scan, SCAN_JSON_MAX, id, timestamp, aps, ap_count, loc);
+    if (n == 0) return true;
+
+    size_t more = 1 + n + sizeof(MQTT_PAGE_TAIL);
+    size_t bound = w->gz ? gz_stream_bound(w->gz, more) : w->len + more;
+    if (w->scans && bound > MQTT_PAGE_BYTES) {
+        if (!page_flush(w, false)) return false;
+    }
+    if (w->scans == 0) page_open(w);
+    if (w->scans++) page_put(w, ",", 1);
+    page_put(w, w->scan, n);
+    return true;
+}
+
+static bool page_add_bin(page_writer_t *w, uint16_t id, int64_t timestamp,
+                         const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc)
+{
+    if (w->scans == 0) page_open(w);
+    if (!scan_bin_add(w->bin, id, timestamp, aps, ap_count, loc)) {
+        // Page (or its SSID dictionary) is full: send it and start the next
+        if (!page_flush(w, false)) return false;
+        page_open(w);
+        if (!scan_bin_add(w->bin, id, timestamp, aps, ap_count, loc)) return true;
+    }
+    w->scans++;
     return true;
 }
 
+static bool page_add(page_writer_t *w, uint16_t id, int64_t timestamp,
+                     const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc)
+{
+    if (w->max_scans && w->scans >= w->max_scans) {
+        if (!page_flush(w, false)) return false;
+    }
+    return w->bin ? page_add_bin(w, id, timestamp, aps, ap_count, loc)
+                  : page_add_json(w, id, timestamp, aps, ap_count, loc);
+}
+
+// Stream scans [from, to) through one page buffer. Returns the index after
+// the last scan delivered (acknowledged, for QoS 1); `from` if none was.
+static uint16_t publish_paged(mqtt_conn_t *conn, const char *topic, payload_format_t fmt,
+                              uint16_t from, uint16_t to, int qos, uint8_t max_scans)
+{
+    page_writer_t w = {
+        .conn = conn,
+        .topic = topic,
+        .qos = qos,
+        .max_scans = max_scans,
+        .buf = malloc(MQTT_PAGE_BYTES),
+        .batch = (int64_t)time(NULL),
+        .next = from,
+        .acked = from,
+    };
+    bool ok = w.buf != NULL;
+    if (fmt == PAYLOAD_BIN) {
+        w.bin = malloc(sizeof(scan_bin_t));
+        ok = ok && w.bin;
+    } else {
+        w.scan = malloc(SCAN_JSON_MAX);
+        ok = ok && w.scan;
+    }
+    if (fmt == PAYLOAD_GZIP) {
+        w.gz = gz_stream_create(page_gz_out, &w);
+        ok = ok && w.gz;
+    }
+    if (!ok) {
+        ESP_LOGW(TAG, "No memory for page buffers");
+        free(w.buf);
+        free(w.scan);
+        free(w.bin);
+        gz_stream_free(w.gz);
+        return from;
+    }
+
+    for (uint16_t i = from; i < to && ok; i++) {
+        w.next = i;
+        stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+        uint8_t ap_count = 0;
+        if (scan_store_load(i, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK) continue;
+
+        int64_t timestamp = 0;
+        scan_store_get_scan_info(i, NULL, &timestamp);
+        scan_location_t loc;
+        bool has_loc = scan_store_get_location(i, &loc) == ESP_OK;
+
+        ok = page_add(&w, i, timestamp, aps, ap_count, has_loc ? &loc : NULL);
+    }
+    if (ok) {
+        w.next = to;
+        ok = page_flush(&w, true);
+    }
+
+    static const char *fmt_names[] = { "JSON", "binary", "gzip" };
+    ESP_LOGI(TAG, "Published scans %u-%u in %u %s page(s)%s", from, w.acked, w.part,
+             fmt_names[fmt], ok ? "" : ", aborted");
+    free(w.buf);
+    free(w.scan);
+    free(w.bin);
+    gz_stream_free(w.gz);
+    return w.acked;
+}
+
+static void publish_all(mqtt_conn_t *conn, const char *topic, payload_format_t fmt)
+{
+    uint16_t head, count;
+    if (scan_store_get_range(&head, &count) != ESP_OK || count <= head) return;
+    publish_paged(conn, topic, fmt, head, count, 0, 0);
+}
+
+// Only what the broker hasn't acknowledged yet, then move the mark
+static void publish_new(mqtt_conn_t *conn, const char *topic, payload_format_t fmt)
+{
+    uint16_t head, count;
+    if (scan_store_get_range(&head, &count) != ESP_OK) return;
+
+    uint16_t mark = scan_store_get_mqtt_mark();
+    if (mark < head || mark > count) mark = head;  // evicted unsent, or store reset
+    if (mark >= count) {
+        ESP_LOGI(TAG, "No new scans to publish");
+        return;
+    }
+
+    uint16_t acked = publish_paged(conn, topic, fmt, mark, count, 1,
+                                   scan_store_get_mqtt_batch());
+    if (acked != scan_store_get_mqtt_mark()) scan_store_set_mqtt_mark(acked);
+}
+
+// One last-scan message in the URL's format. Returns a malloc'd buffer, NULL
+// if the scan can't be loaded or memory runs out.
+static char *build_last_payload(uint16_t id, payload_format_t fmt, bool with_stats,
+                                size_t *out_len)
+{
+    if (fmt == PAYLOAD_BIN) {
+        uint8_t *bin = malloc(SCAN_BIN_MAX);
+        *out_len = bin ? build_scan_bin(id, bin, SCAN_BIN_MAX, with_stats) : 0;
+        if (*out_len == 0) {
+            free(bin);
+            return NULL;
+        }
+        return (char *)bin;
+    }
+
+    char *json = build_scan_json(id, with_stats);
+    if (!json) return NULL;
+    *out_len = strlen(json);
+    if (fmt == PAYLOAD_GZIP) {
+        char *gz = gzip_alloc(json, *out_len, out_len);
+        free(json);
+        json = gz;
+    }
+    return json;
+}
+
+// Send the scans queued in the outbox, oldest first, each as a QoS 1 message
+// that only leaves the outbox once acknowledged. The newest is retained and
+// carries the cycle stats. Stops at the first failure or when the byte or
+// time budget is spent; the rest waits for the next connection.
+static void drain_outbox(mqtt_conn_t *conn, const char *topic, payload_format_t fmt)
+{
+    mqtt_outbox_entry_t queue[MQTT_OUTBOX_MAX];
+    int n = scan_store_outbox_peek(queue, MQTT_OUTBOX_MAX);
+    uint16_t head, count;
+    if (n == 0 || scan_store_get_range(&head, &count) != ESP_OK) return;
+
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(OUTBOX_BUDGET_MS);
+    size_t budget = OUTBOX_BUDGET_BYTES;
+    size_t bytes = 0;
+    int sent = 0;
+    bool failed = false;
+
+    for (; sent < n; sent++) {
+        if (sent > 0 && (bytes >= budget || xTaskGetTickCount() >= deadline)) {
+            ESP_LOGI(TAG, "Outbox budget spent, %d scans left for later", n - sent);
+            break;
+        }
+        uint16_t id = queue[sent].scan_index;
+        if (id < head || id >= count) continue;  // evicted or deleted since
+
+        bool newest = sent == n - 1;
+        size_t len = 0;
+        char *data = build_last_payload(id, fmt, newest, &len);
+        int msg_id = data ? esp_mqtt_client_publish(conn->client, topic, data, len, 1, newest) : -1;
+        free(data);
+        if (msg_id < 0 || !wait_for_ack(conn, msg_id)) {
+            ESP_LOGW(TAG, "Scan %u not delivered (attempt %u)", id, queue[sent].retries + 1);
+            failed = true;
+            break;
+        }
+        bytes += len;
+    }
+    if (sent > 1) ESP_LOGI(TAG, "Published %d queued scans (%u bytes)", sent, (unsigned)bytes);
+    scan_store_outbox_done(sent, failed);
+}
+
 esp_err_t mqtt_publish_scans(void)
 {
     char url_last[257] = {0};
@@ -219,14 +687,18 @@ esp_err_t mqtt_publish_scans(void)
     bool has_last = (scan_store_get_mqtt_url_last(url_last, sizeof(url_last)) == ESP_OK && url_last[0]);
     bool has_all  = (scan_store_get_mqtt_url_all(url_all, sizeof(url_all)) == ESP_OK && url_all[0]);
 
+    // Nothing to deliver queued scans to
+    if (!has_last) scan_store_outbox_done(MQTT_OUTBOX_MAX, false);
+
     if (!has_last && !has_all) {
         ESP_LOGI(TAG, "No MQTT URLs configured, skipping");
         return ESP_OK;
     }
 
-    // Check if "all" publish is due this cycle
-    bool do_all = false;
-    if (has_all) {
+    // Check if "all" publish is due this cycle (incremental: every connection)
+    bool incremental = has_all && scan_store_get_mqtt_incremental();
+    bool do_all = incremental;
+    if (has_all && !incremental) {
         uint16_t wait = scan_store_get_mqtt_wait_cycles();
         uint16_t counter = scan_store_get_mqtt_cycle_counter();
         counter++;
@@ -241,106 +713,49 @@ esp_err_t mqtt_publish_scans(void)
     char broker_last[257] = {0}, topic_last[128] = {0};
     char broker_all[257] = {0}, topic_all[128] = {0};
 
+    payload_format_t fmt_last = PAYLOAD_JSON, fmt_all = PAYLOAD_JSON;
     if (has_last && !parse_mqtt_url(url_last, broker_last, sizeof(broker_last),
-                                     topic_last, sizeof(topic_last))) {
+                                     topic_last, sizeof(topic_last), &fmt_last)) {
         ESP_LOGW(TAG, "Invalid MQTT URL for last scan: %s", url_last);
         has_last = false;
     }
 
     if (do_all && !parse_mqtt_url(url_all, broker_all, sizeof(broker_all),
-                                   topic_all, sizeof(topic_all))) {
+                                   topic_all, sizeof(topic_all), &fmt_all)) {
         ESP_LOGW(TAG, "Invalid MQTT URL for all scans: %s", url_all);
         do_all = false;
     }
 
     if (!has_last && !do_all) return ESP_OK;
 
-    // Connect to broker (reuse connection if both URLs share same broker)
-    const char *broker_uri = has_last ? broker_last : broker_all;
-    esp_mqtt_client_handle_t client = connect_mqtt(broker_uri);
-    if (!client) return ESP_FAIL;
-
-    // Publish latest scan
-    if (has_last) {
-        uint16_t head, count;
-        if (scan_store_get_range(&head, &count) == ESP_OK && count > head) {
-            uint16_t latest_id = count - 1;
-            char *json = build_scan_json(latest_id);
-            if (json) {
-                publish_and_wait(client, topic_last, json, strlen(json));
-                free(json);
-            }
-        }
-    }
+    // One connection per broker, all connecting at the same time
+    mqtt_conn_t conn_last = {0}, conn_all = {0};
+    mqtt_conn_t *c_last = has_last ? &conn_last : NULL;
+    mqtt_conn_t *c_all = NULL;
+    if (do_all) c_all = (has_last && strcmp(broker_last, broker_all) == 0) ? &conn_last : &conn_all;
 
-    // Publish all scans (same connection if same broker, reconnect otherwise)
-    if (do_all) {
-        if (has_last && strcmp(broker_last, broker_all) != 0) {
-            disconnect_mqtt(client);
-            client = connect_mqtt(broker_all);
-            if (!client) return ESP_FAIL;
-        }
+    if (c_last) conn_start(c_last, broker_last);
+    if (c_all && c_all != c_last) conn_start(c_all, broker_all);
+
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS);
+    bool ok_last = c_last && conn_wait(c_last, deadline);
+    bool ok_all = c_all && (c_all == c_last ? ok_last : conn_wait(c_all, deadline));
+
+    // Publish latest scans
+    if (ok_last) drain_outbox(c_last, topic_last, fmt_last);
 
-        uint16_t head, count;
-        if (scan_store_get_range(&head, &count) == ESP_OK && count > head) {
-            cJSON *arr = cJSON_CreateArray();
-            for (uint16_t i = head; i < count; i++) {
-                stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
-                uint8_t ap_count = 0;
-                if (scan_store_load(i, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK)
-                    continue;
-
-                int64_t timestamp = 0;
-                scan_store_get_scan_info(i, NULL, &timestamp);
-
-                cJSON *scan = cJSON_CreateObject();
-                if (!scan) break;  // out of memory
-                cJSON_AddNumberToObject(scan, "id", i);
-                cJSON_AddNumberToObject(scan, "timestamp", (double)timestamp);
-                cJSON *ap_arr = cJSON_AddArrayToObject(scan, "aps");
-
-                for (uint8_t j = 0; j < ap_count; j++) {
-                    cJSON *ap = cJSON_CreateObject();
-                    if (!ap) break;
-                    char ssid[33];
-                    memcpy(ssid, aps[j].ssid, aps[j].ssid_len);
-                    ssid[aps[j].ssid_len] = '\0';
-                    cJSON_AddStringToObject(ap, "ssid", ssid);
-
-                    char mac[18];
-                    snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X",
-                             aps[j].bssid[0], aps[j].bssid[1], aps[j].bssid[2],
-                             aps[j].bssid[3], aps[j].bssid[4], aps[j].bssid[5]);
-                    cJSON_AddStringToObject(ap, "bssid", mac);
-                    cJSON_AddNumberToObject(ap, "rssi", aps[j].rssi);
-                    cJSON_AddNumberToObject(ap, "channel", aps[j].channel);
-                    cJSON_AddStringToObject(ap, "auth", authmode_str(aps[j].authmode));
-                    cJSON_AddItemToArray(ap_arr, ap);
-                }
-
-                scan_location_t loc;
-                if (scan_store_get_location(i, &loc) == ESP_OK) {
-                    cJSON *location = cJSON_AddObjectToObject(scan, "location");
-                    cJSON_AddNumberToObject(location, "lat", loc.lat);
-                    cJSON_AddNumberToObject(location, "lng", loc.lng);
-                    cJSON_AddNumberToObject(location, "accuracy", loc.accuracy);
-                }
-
-                cJSON_AddItemToArray(arr, scan);
-            }
-
-            char *json = cJSON_PrintUnformatted(arr);
-            cJSON_Delete(arr);
-            if (json) {
-                publish_and_wait(client, topic_all, json, strlen(json));
-                free(json);
-            } else {
-                ESP_LOGW(TAG, "Failed to serialize all scans (out of memory?)");
-            }
+    // Publish all scans
+    if (ok_all) {
+        if (incremental) {
+            publish_new(c_all, topic_all, fmt_all);
+        } else {
+            publish_all(c_all, topic_all, fmt_all);
         }
     }
 
-    disconnect_mqtt(client);
+    conn_close(&conn_last);
+    conn_close(&conn_all);
+    if ((c_last && !ok_last) || (c_all && !ok_all)) return ESP_FAIL;
     ESP_LOGI(TAG, "MQTT publish complete");
     return ESP_OK;
 }
@@ -1,5 +1,6 @@
 #include "open_wifi.h"
 #include "scan_store.h"
+#include "wifi_session.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -7,6 +8,7 @@
 #include "esp_sntp.h"
 #include "esp_http_client.h"
 #include "esp_crt_bundle.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include <string.h>
@@ -23,6 +25,7 @@ static volatile bool s_connected = false;
 static esp_netif_t *s_netif = NULL;
 static esp_event_handler_instance_t s_wifi_handler_inst = NULL;
 static esp_event_handler_instance_t s_ip_handler_inst = NULL;
+static open_wifi_timing_t s_timing;
 
 // --- Connectivity check result ---
 typedef enum {
@@ -46,11 +49,70 @@ typedef struct {
 #define FORM_POST_SIZE   2048
 #define URL_BUF_SIZE     512
 
+// --- Network cache fast path ---
+#define FAST_CONNECT_TIMEOUT_MS 5000
+#define CONNECT_TIMEOUT_MS      15000
+#define TIME_VALID_MIN          1600000000  // clock not set before SNTP on first boot
+
+#ifdef CONFIG_LOCATOR_WIFI_LEASE_REUSE_SEC
+#define LEASE_REUSE_SEC CONFIG_LOCATOR_WIFI_LEASE_REUSE_SEC
+#else
+#define LEASE_REUSE_SEC 0
+#endif
+
+static bool s_lease_reused = false;   // static IP from the cache, DHCP client stopped
+
+// --- Candidate scoring ---
+#define TTI_DEFAULT_MS  8000    // assumed time to internet without history
+#define TTI_PORTAL_MS   20000   // ... for a network known to have a portal
+#define NET_HISTORY     16      // attempts per network before old ones fade out
+#define WEAK_RSSI       -75
+
+#ifdef CONFIG_LOCATOR_BLOCKLIST_RETRY_HOURS
+#define BLOCKLIST_RETRY_SEC ((uint32_t)CONFIG_LOCATOR_BLOCKLIST_RETRY_HOURS * 3600)
+#else
+#define BLOCKLIST_RETRY_SEC (24 * 3600)
+#endif
+
+#ifdef CONFIG_LOCATOR_OPEN_WIFI_BUDGET_SEC
+#define OPEN_WIFI_BUDGET_MS (CONFIG_LOCATOR_OPEN_WIFI_BUDGET_SEC * 1000)
+#else
+#define OPEN_WIFI_BUDGET_MS 30000
+#endif
+
 void open_wifi_set_hook(open_wifi_hook_t hook)
 {
     s_hook = hook;
 }
 
+void open_wifi_get_timing(open_wifi_timing_t *out)
+{
+    *out = s_timing;
+}
+
+static uint32_t ms_since(int64_t start_us)
+{
+    return (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+}
+
+// End of open_wifi_try()'s time budget, 0 = none. Every wait on the way to
+// internet access is capped by it, not just the start of each candidate.
+static int64_t s_deadline_us = 0;
+
+// timeout_ms capped to what is left of the budget; 0 once it is used up
+static uint32_t budget_cap(uint32_t timeout_ms)
+{
+    if (s_deadline_us == 0) return timeout_ms;
+    int64_t left_ms = (s_deadline_us - esp_timer_get_time()) / 1000;
+    if (left_ms <= 0) return 0;
+    return left_ms < timeout_ms ? (uint32_t)left_ms : timeout_ms;
+}
+
+static bool budget_used_up(void)
+{
+    return budget_cap(1) == 0;
+}
+
 // ========== WiFi lifecycle ==========
 
 static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
@@ -72,23 +134,17 @@ static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
     }
 }
 
+static void drop_cached_lease(void);
+
+// Join the shared WiFi session (the scan may have left the driver running)
 static esp_err_t wifi_init(void)
 {
     s_connect_sem = xSemaphoreCreateBinary();
     if (!s_connect_sem) return ESP_ERR_NO_MEM;
 
-    s_netif = esp_netif_create_default_wifi_sta();
-    if (!s_netif) {
-        vSemaphoreDelete(s_connect_sem);
-        s_connect_sem = NULL;
-        return ESP_FAIL;
-    }
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_err_t err = esp_wifi_init(&cfg);
+    s_netif = wifi_session_sta_netif();
+    esp_err_t err = s_netif ? wifi_session_acquire() : ESP_FAIL;
     if (err != ESP_OK) {
-        esp_netif_destroy(s_netif);
-        s_netif = NULL;
         vSemaphoreDelete(s_connect_sem);
         s_connect_sem = NULL;
         return err;
@@ -99,9 +155,6 @@ static esp_err_t wifi_init(void)
     ESP_ERROR_CHECK(esp_event_handler_instance_register(
         IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, &s_ip_handler_inst));
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
     return ESP_OK;
 }
 
@@ -117,13 +170,10 @@ static void wifi_deinit_full(void)
     }
 
     esp_wifi_disconnect();
-    esp_wifi_stop();
-    esp_wifi_deinit();
+    drop_cached_lease();
+    wifi_session_release();
+    s_netif = NULL;
 
-    if (s_netif) {
-        esp_netif_destroy(s_netif);
-        s_netif = NULL;
-    }
     if (s_connect_sem) {
         vSemaphoreDelete(s_connect_sem);
         s_connect_sem = NULL;
@@ -271,7 +321,7 @@ static void resolve_url(const char *base_url, const char *relative, char *out, s
 
 // ========== WiFi connect to specific SSID ==========
 
-static bool confirm_and_connect(const char *ssid)
+static bool confirm_ssid(const char *ssid)
 {
     // Quick re-scan to confirm SSID is still present with decent signal
     wifi_scan_config_t scan_config = {
@@ -281,64 +331,252 @@ static bool confirm_and_connect(const char *ssid)
         .scan_time.active.max = 150,
     };
 
-    esp_err_t err = esp_wifi_scan_start(&scan_config, true);
+    wifi_ap_record_t records[4];
+    uint16_t ap_num = sizeof(records) / sizeof(records[0]);
+    esp_err_t err = wifi_session_scan(&scan_config, records, &ap_num, NULL);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "Re-scan failed: %s", esp_err_to_name(err));
         return false;
     }
-
-    uint16_t ap_num = 0;
-    esp_wifi_scan_get_ap_num(&ap_num);
     if (ap_num == 0) {
         ESP_LOGW(TAG, "'%s' not found in re-scan", ssid);
         return false;
     }
 
-    wifi_ap_record_t *records = calloc(ap_num, sizeof(wifi_ap_record_t));
-    if (!records) return false;
-    esp_wifi_scan_get_ap_records(&ap_num, records);
-
-    bool found = false;
     for (uint16_t i = 0; i < ap_num; i++) {
         if (strcmp((char *)records[i].ssid, ssid) == 0 && records[i].rssi > -80) {
-            found = true;
-            break;
+            return true;
         }
     }
-    free(records);
 
-    if (!found) {
-        ESP_LOGW(TAG, "'%s' too weak or gone", ssid);
+    ESP_LOGW(TAG, "'%s' too weak or gone", ssid);
+    return false;
+}
+
+// One association attempt; true once we have an IP
+static bool connect_once(const char *ssid, int attempt, uint32_t timeout_ms)
+{
+    timeout_ms = budget_cap(timeout_ms);
+    if (timeout_ms == 0) return false;
+    s_got_ip = false;
+    s_connected = false;
+    xSemaphoreTake(s_connect_sem, 0);  // drop a late event from the previous attempt
+
+    ESP_LOGI(TAG, "Connecting to '%s' (attempt %d)", ssid, attempt);
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_wifi_connect failed: %s", esp_err_to_name(err));
         return false;
     }
 
-    // Attempt connection (up to 2 tries)
-    wifi_config_t sta_config = {0};
-    strncpy((char *)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid) - 1);
+    if (xSemaphoreTake(s_connect_sem, pdMS_TO_TICKS(timeout_ms)) == pdTRUE && s_got_ip) {
+        ESP_LOGI(TAG, "Connected to '%s'", ssid);
+        return true;
+    }
 
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    ESP_LOGW(TAG, "Connection attempt %d timed out", attempt);
+    esp_wifi_disconnect();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    return false;
+}
 
-    for (int attempt = 0; attempt < 2; attempt++) {
-        s_got_ip = false;
-        s_connected = false;
+static bool lease_fresh(const net_cache_entry_t *net)
+{
+    if (LEASE_REUSE_SEC == 0 || net->ip == 0 || net->leased == 0) return false;
+    time_t now = time(NULL);
+    return now >= net->leased && now - net->leased < LEASE_REUSE_SEC;
+}
 
-        ESP_LOGI(TAG, "Connecting to '%s' (attempt %d)", ssid, attempt + 1);
-        err = esp_wifi_connect();
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "esp_wifi_connect failed: %s", esp_err_to_name(err));
-            continue;
+// Configure the cached lease as a static IP; the netif reports GOT_IP as soon
+// as the association completes, without a DHCP exchange
+static void use_cached_lease(const net_cache_entry_t *net)
+{
+    esp_netif_ip_info_t ip = {
+        .ip.addr = net->ip,
+        .netmask.addr = net->netmask,
+        .gw.addr = net->gw,
+    };
+    esp_netif_dhcpc_stop(s_netif);
+    if (esp_netif_set_ip_info(s_netif, &ip) != ESP_OK) {
+        esp_netif_dhcpc_start(s_netif);
+        return;
+    }
+    if (net->dns) {
+        esp_netif_dns_info_t dns = {0};
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        dns.ip.u_addr.ip4.addr = net->dns;
+        esp_netif_set_dns_info(s_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    s_lease_reused = true;
+}
+
+static void drop_cached_lease(void)
+{
+    if (!s_lease_reused) return;
+    esp_netif_ip_info_t none = {0};
+    esp_netif_set_ip_info(s_netif, &none);
+    esp_netif_dhcpc_start(s_netif);
+    s_lease_reused = false;
+}
+
+// ========== Network cache ==========
+
+// Load the entry for ssid, or a fresh one
+static void net_load(const char *ssid, net_cache_entry_t *net)
+{
+    if (scan_store_net_cache_find(ssid, net)) return;
+    memset(net, 0, sizeof(*net));
+    strncpy(net->ssid, ssid, sizeof(net->ssid) - 1);
+}
+
+// Drop the cached BSSID, channel and lease but keep the stats
+static void forget_connection(const char *ssid)
+{
+    net_cache_entry_t net;
+    if (!scan_store_net_cache_find(ssid, &net)) return;
+    memset(net.bssid, 0, sizeof(net.bssid));
+    net.channel = 0;
+    net.ip = net.netmask = net.gw = net.dns = 0;
+    net.leased = 0;
+    scan_store_net_cache_put(&net);
+}
+
+static void net_age(net_cache_entry_t *net)
+{
+    if (net->ok_count + net->fail_count >= NET_HISTORY) {
+        net->ok_count /= 2;
+        net->fail_count /= 2;
+    }
+}
+
+static void record_failure(const char *ssid, int8_t rssi)
+{
+    net_cache_entry_t net;
+    net_load(ssid, &net);
+    net_age(&net);
+    net.fail_count++;
+    if (rssi) net.last_rssi = rssi;
+    scan_store_net_cache_put(&net);
+}
+
+// A candidate cut off by the time budget isn't held against the network
+static void record_attempt_failure(const char *ssid, int8_t rssi)
+{
+    if (budget_used_up()) {
+        ESP_LOGW(TAG, "'%s' ran out of time budget, not counted as a failure", ssid);
+        return;
+    }
+    record_failure(ssid, rssi);
+}
+
+// Remember BSSID, channel and lease of the current connection, and how long
+// it took to get internet access
+static void record_success(const char *ssid, bool portal, uint32_t tti_ms)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) return;
+
+    net_cache_entry_t net;
+    net_load(ssid, &net);
+    memcpy(net.bssid, ap.bssid, sizeof(net.bssid));
+    net.channel = ap.primary;
+    if (portal) net.flags |= NET_F_PORTAL;
+
+    time_t now = time(NULL);
+    if (!s_lease_reused) {
+        esp_netif_ip_info_t ip;
+        esp_netif_dns_info_t dns;
+        if (LEASE_REUSE_SEC > 0 && now >= TIME_VALID_MIN &&
+            esp_netif_get_ip_info(s_netif, &ip) == ESP_OK) {
+            net.ip = ip.ip.addr;
+            net.netmask = ip.netmask.addr;
+            net.gw = ip.gw.addr;
+            net.dns = esp_netif_get_dns_info(s_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK ?
+                      dns.ip.u_addr.ip4.addr : 0;
+            net.leased = now;
+        } else {
+            net.ip = net.netmask = net.gw = net.dns = 0;
+            net.leased = 0;
         }
+    }
 
-        if (xSemaphoreTake(s_connect_sem, pdMS_TO_TICKS(15000)) == pdTRUE && s_got_ip) {
-            ESP_LOGI(TAG, "Connected to '%s'", ssid);
-            return true;
+    net_age(&net);
+    net.ok_count++;
+    net.last_rssi = ap.rssi;
+    net.tti_ms[net.tti_next] = tti_ms > UINT16_MAX ? UINT16_MAX : (tti_ms ? tti_ms : 1);
+    net.tti_next = (net.tti_next + 1) % NET_TTI_SAMPLES;
+    net.last_ok = now;
+    scan_store_net_cache_put(&net);
+}
+
+// Expected time to internet (ms): the median time (or a default) divided by
+// the success rate. The rate is smoothed as (ok + 1) / (attempts + 2), so an
+// unknown network ranks behind proven ones and ahead of failing ones.
+static uint32_t expected_tti(const char *ssid, int8_t rssi)
+{
+    uint32_t tti = TTI_DEFAULT_MS;
+    uint32_t ok = 0, fail = 0;
+    net_cache_entry_t net;
+    if (scan_store_net_cache_find(ssid, &net)) {
+        uint32_t median = scan_store_net_median_tti(&net);
+        if (median) {
+            tti = median;
+        } else if (net.flags & NET_F_PORTAL) {
+            tti = TTI_PORTAL_MS;
         }
+        ok = net.ok_count;
+        fail = net.fail_count;
+    }
+    uint32_t cost = tti * (ok + fail + 2) / (ok + 1);
+    if (rssi < WEAK_RSSI) cost *= 2;
+    return cost;
+}
 
-        ESP_LOGW(TAG, "Connection attempt %d timed out", attempt + 1);
-        esp_wifi_disconnect();
-        vTaskDelay(pdMS_TO_TICKS(500));
+// Repeat connection: no confirm re-scan, straight to the cached BSSID and
+// channel, reusing the DHCP lease while it is fresh. On failure the cached
+// connection is dropped so the caller's full connect starts clean.
+static bool fast_connect(const wifi_config_t *base, const net_cache_entry_t *net)
+{
+    wifi_config_t sta_config = *base;
+    sta_config.sta.bssid_set = true;
+    memcpy(sta_config.sta.bssid, net->bssid, sizeof(sta_config.sta.bssid));
+    sta_config.sta.channel = net->channel;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+
+    if (lease_fresh(net)) use_cached_lease(net);
+    ESP_LOGI(TAG, "Cached network: " MACSTR " ch %u%s", MAC2STR(net->bssid), net->channel,
+             s_lease_reused ? ", reusing lease" : "");
+
+    if (connect_once(net->ssid, 1, FAST_CONNECT_TIMEOUT_MS)) return true;
+
+    ESP_LOGW(TAG, "Cached connect to '%s' failed, falling back", net->ssid);
+    drop_cached_lease();
+    forget_connection(net->ssid);
+    return false;
+}
+
+// Connect to ssid (password NULL for open networks) and wait for an IP.
+// Networks without a cache entry are confirmed by a re-scan first if asked.
+static bool connect_network(const char *ssid, const char *password, bool confirm)
+{
+    wifi_config_t sta_config = {0};
+    strncpy((char *)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid) - 1);
+    if (password) {
+        strncpy((char *)sta_config.sta.password, password, sizeof(sta_config.sta.password) - 1);
+    }
+
+    net_cache_entry_t net;
+    if (scan_store_net_cache_find(ssid, &net) && net.channel != 0) {
+        if (fast_connect(&sta_config, &net)) return true;
+    } else if (confirm && !confirm_ssid(ssid)) {
+        return false;
     }
 
+    // Attempt connection (up to 2 tries)
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    for (int attempt = 0; attempt < 2 && !budget_used_up(); attempt++) {
+        if (connect_once(ssid, attempt + 1, CONNECT_TIMEOUT_MS)) return true;
+    }
     return false;
 }
 
@@ -369,14 +607,15 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
 
 static conn_status_t check_connectivity(char *redirect_url, size_t redirect_url_size)
 {
-    if (!s_connected) return CONN_FAIL;
+    uint32_t timeout_ms = budget_cap(10000);
+    if (!s_connected || timeout_ms == 0) return CONN_FAIL;
 
     http_response_t resp = {0};
 
     esp_http_client_config_t config = {
         .url = "http://connectivitycheck.gstatic.com/generate_204",
         .disable_auto_redirect = true,
-        .timeout_ms = 10000,
+        .timeout_ms = timeout_ms,
         .event_handler = http_event_handler,
         .user_data = &resp,
     };
@@ -430,6 +669,23 @@ static conn_status_t check_connectivity(char *redirect_url, size_t redirect_url_
     return CONN_FAIL;
 }
 
+// A reused lease can be stale (the address was handed out again after the
+// lease expired): without connectivity, drop it and rejoin once with DHCP
+static conn_status_t check_connectivity_or_renew(const char *ssid, const char *password,
+                                                 char *redirect_url, size_t redirect_url_size)
+{
+    conn_status_t conn = check_connectivity(redirect_url, redirect_url_size);
+    if (conn != CONN_FAIL || !s_lease_reused) return conn;
+
+    ESP_LOGW(TAG, "'%s' — no connectivity with cached lease, renewing", ssid);
+    forget_connection(ssid);
+    esp_wifi_disconnect();
+    drop_cached_lease();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    if (!connect_network(ssid, password, false)) return CONN_FAIL;
+    return check_connectivity(redirect_url, redirect_url_size);
+}
+
 // ========== Follow redirects and get portal page ==========
 
 static esp_err_t fetch_portal_page(const char *url, char *body, int body_size, char *final_url, size_t final_url_size)
@@ -439,7 +695,8 @@ static esp_err_t fetch_portal_page(const char *url, char *body, int body_size, c
     current_url[sizeof(current_url) - 1] = '\0';
 
     for (int hop = 0; hop < 5; hop++) {
-        if (!s_connected) return ESP_FAIL;
+        uint32_t timeout_ms = budget_cap(10000);
+        if (!s_connected || timeout_ms == 0) return ESP_FAIL;
 
         http_response_t resp = {
             .buf = body,
@@ -451,7 +708,7 @@ static esp_err_t fetch_portal_page(const char *url, char *body, int body_size, c
         esp_http_client_config_t config = {
             .url = current_url,
             .disable_auto_redirect = true,
-            .timeout_ms = 10000,
+            .timeout_ms = timeout_ms,
             .event_handler = http_event_handler,
             .user_data = &resp,
         };
@@ -568,7 +825,7 @@ static esp_err_t handle_captive_portal(const char *body, const char *base_url)
 
         if (strcmp(type, "password") == 0) {
             ESP_LOGW(TAG, "Portal requires password — blocklisting");
-            return ESP_FAIL;
+            return ESP_ERR_NOT_SUPPORTED;
         }
 
         if (name[0] == '\0') {
@@ -620,10 +877,15 @@ static esp_err_t handle_captive_portal(const char *body, const char *base_url)
     ESP_LOGI(TAG, "Submitting portal form to %s (%d fields)", action_url, field_count);
 
     // POST the form
+    uint32_t timeout_ms = budget_cap(10000);
+    if (timeout_ms == 0) {
+        free(post_body);
+        return ESP_ERR_TIMEOUT;
+    }
     esp_http_client_config_t config = {
         .url = action_url,
         .method = HTTP_METHOD_POST,
-        .timeout_ms = 10000,
+        .timeout_ms = timeout_ms,
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&config);
@@ -684,13 +946,110 @@ static void do_sntp_sync(void)
     esp_sntp_stop();
 }
 
+// Run the user hook and SNTP sync once internet access is confirmed
+static void run_hook_and_sync(void)
+{
+    int64_t t0 = esp_timer_get_time();
+    if (s_hook) {
+        esp_err_t hook_err = s_hook();
+        if (hook_err != ESP_OK) {
+            ESP_LOGW(TAG, "Hook returned error: %s (non-fatal)", esp_err_to_name(hook_err));
+        }
+    }
+    s_timing.hook_ms = ms_since(t0);
+
+    t0 = esp_timer_get_time();
+    do_sntp_sync();
+    s_timing.sntp_ms = ms_since(t0);
+}
+
+// Blocklist the access point we're on for a while, so a broken portal gets
+// another chance later and other hotspots with the same SSID aren't affected
+static void blocklist_current_ap(const char *ssid)
+{
+    wifi_ap_record_t ap;
+    bool have_ap = esp_wifi_sta_get_ap_info(&ap) == ESP_OK;
+    scan_store_blocklist_add(ssid, have_ap ? ap.bssid : NULL, BL_REASON_PORTAL,
+                             BLOCKLIST_RETRY_SEC);
+}
+
+// Steps 5-7: fetch the portal page, submit its form and re-check connectivity.
+// Blocklists the SSID if the portal can't be passed. Returns true on internet access.
+static bool pass_captive_portal(const char *ssid, const char *redirect_url)
+{
+    char *portal_body = malloc(PORTAL_BODY_SIZE);
+    if (!portal_body) {
+        ESP_LOGE(TAG, "No memory for portal body");
+        return false;
+    }
+
+    char final_url[URL_BUF_SIZE] = "";
+    esp_err_t fetch_err;
+
+    if (redirect_url[0]) {
+        fetch_err = fetch_portal_page(redirect_url, portal_body, PORTAL_BODY_SIZE,
+                                      final_url, sizeof(final_url));
+    } else {
+        // Some portals return 200 directly on connectivity check.
+        // Try fetching any page to get the portal.
+        fetch_err = fetch_portal_page("http://connectivitycheck.gstatic.com/generate_204",
+                                      portal_body, PORTAL_BODY_SIZE,
+                                      final_url, sizeof(final_url));
+    }
+
+    if (fetch_err != ESP_OK || !s_connected) {
+        ESP_LOGW(TAG, "Failed to fetch portal page");
+        free(portal_body);
+        if (!budget_used_up()) blocklist_current_ap(ssid);
+        return false;
+    }
+
+    // Handle captive portal form
+    const char *base = final_url[0] ? final_url : redirect_url;
+    esp_err_t portal_err = handle_captive_portal(portal_body, base);
+    free(portal_body);
+
+    if (portal_err == ESP_ERR_NOT_SUPPORTED) {
+        // Needs credentials we don't have: no point retrying anywhere
+        scan_store_blocklist_add(ssid, NULL, BL_REASON_PASSWORD, 0);
+        return false;
+    }
+    if (budget_used_up()) {
+        ESP_LOGW(TAG, "Time budget used up in the portal of '%s'", ssid);
+        return false;
+    }
+    if (portal_err != ESP_OK || !s_connected) {
+        ESP_LOGW(TAG, "Portal handling failed, blocklisting '%s'", ssid);
+        blocklist_current_ap(ssid);
+        return false;
+    }
+
+    // Re-check connectivity after portal submission
+    vTaskDelay(pdMS_TO_TICKS(budget_cap(2000)));  // Give portal time to activate
+    char dummy[URL_BUF_SIZE];
+    conn_status_t recheck = check_connectivity(dummy, sizeof(dummy));
+    if (recheck != CONN_DIRECT && budget_used_up()) {
+        ESP_LOGW(TAG, "Time budget used up rechecking '%s'", ssid);
+        return false;
+    }
+    if (recheck != CONN_DIRECT) {
+        ESP_LOGW(TAG, "Still captive after form submit, blocklisting '%s'", ssid);
+        blocklist_current_ap(ssid);
+        return false;
+    }
+    return true;
+}
+
 // ========== Main entry point ==========
 
-esp_err_t open_wifi_try(const char **ssids, uint8_t ssid_count)
+esp_err_t open_wifi_try(const open_wifi_candidate_t *cands, uint8_t count)
 {
-    if (ssid_count == 0) return ESP_ERR_NOT_FOUND;
+    if (count == 0) return ESP_ERR_NOT_FOUND;
+    if (count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
 
-    ESP_LOGI(TAG, "Trying %u open WiFi SSIDs", ssid_count);
+    ESP_LOGI(TAG, "Trying %u open WiFi SSIDs", count);
+    memset(&s_timing, 0, sizeof(s_timing));
+    int64_t t_start = esp_timer_get_time();
 
     esp_err_t init_err = wifi_init();
     if (init_err != ESP_OK) {
@@ -698,30 +1057,59 @@ esp_err_t open_wifi_try(const char **ssids, uint8_t ssid_count)
         return ESP_FAIL;
     }
 
+    // Lowest expected time to internet first (stable insertion sort)
+    uint8_t order[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint32_t cost[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t c = expected_tti(cands[i].ssid, cands[i].rssi);
+        uint8_t j = i;
+        while (j > 0 && cost[j - 1] > c) {
+            order[j] = order[j - 1];
+            cost[j] = cost[j - 1];
+            j--;
+        }
+        order[j] = i;
+        cost[j] = c;
+    }
+
     esp_err_t result = ESP_ERR_NOT_FOUND;
+    // One blocklist read for all candidates
+    blocklist_snapshot_t *blocked = scan_store_blocklist_snapshot();
+    s_deadline_us = t_start + (int64_t)OPEN_WIFI_BUDGET_MS * 1000;
+
+    for (uint8_t i = 0; i < count; i++) {
+        const char *ssid = cands[order[i]].ssid;
+        int8_t rssi = cands[order[i]].rssi;
 
-    for (uint8_t i = 0; i < ssid_count; i++) {
-        const char *ssid = ssids[i];
-        ESP_LOGI(TAG, "--- Trying SSID '%s' (%u/%u) ---", ssid, i + 1, ssid_count);
+        if (budget_used_up()) {
+            ESP_LOGW(TAG, "Time budget used up, skipping %u candidate(s)", count - i);
+            break;
+        }
+        ESP_LOGI(TAG, "--- Trying SSID '%s' (%u/%u, expect %lu ms) ---", ssid, i + 1, count,
+                 (unsigned long)cost[i]);
+        int64_t t_cand = esp_timer_get_time();
 
         // Step 1: Blocklist check
-        if (scan_store_blocklist_contains(ssid)) {
+        if (scan_store_blocklist_snapshot_contains(blocked, ssid, cands[order[i]].bssid)) {
             ESP_LOGI(TAG, "'%s' is blocklisted, skipping", ssid);
             continue;
         }
 
-        // Step 2: Confirm and connect
-        if (!confirm_and_connect(ssid)) {
+        // Step 2: Confirm and connect (cached networks skip the re-scan)
+        if (!connect_network(ssid, NULL, true)) {
             ESP_LOGW(TAG, "Failed to connect to '%s'", ssid);
+            record_attempt_failure(ssid, rssi);
             continue;
         }
 
         // Step 3: Check connectivity
         char redirect_url[URL_BUF_SIZE] = "";
-        conn_status_t conn = check_connectivity(redirect_url, sizeof(redirect_url));
+        conn_status_t conn = check_connectivity_or_renew(ssid, NULL, redirect_url,
+                                                         sizeof(redirect_url));
 
         if (conn == CONN_FAIL) {
             ESP_LOGW(TAG, "'%s' — no connectivity", ssid);
+            record_attempt_failure(ssid, rssi);
             esp_wifi_disconnect();
             vTaskDelay(pdMS_TO_TICKS(500));
             continue;
@@ -729,81 +1117,36 @@ esp_err_t open_wifi_try(const char **ssids, uint8_t ssid_count)
 
         if (conn == CONN_PORTAL) {
             ESP_LOGI(TAG, "'%s' — captive portal detected", ssid);
-
-            // Step 5: Fetch portal page
-            char *portal_body = malloc(PORTAL_BODY_SIZE);
-            if (!portal_body) {
-                ESP_LOGE(TAG, "No memory for portal body");
-                esp_wifi_disconnect();
-                vTaskDelay(pdMS_TO_TICKS(500));
-                continue;
-            }
-
-            char final_url[URL_BUF_SIZE] = "";
-            esp_err_t fetch_err;
-
-            if (redirect_url[0]) {
-                fetch_err = fetch_portal_page(redirect_url, portal_body, PORTAL_BODY_SIZE,
-                                              final_url, sizeof(final_url));
-            } else {
-                // Some portals return 200 directly on connectivity check.
-                // Try fetching any page to get the portal.
-                fetch_err = fetch_portal_page("http://connectivitycheck.gstatic.com/generate_204",
-                                              portal_body, PORTAL_BODY_SIZE,
-                                              final_url, sizeof(final_url));
-            }
-
-            if (fetch_err != ESP_OK || !s_connected) {
-                ESP_LOGW(TAG, "Failed to fetch portal page");
-                free(portal_body);
-                scan_store_blocklist_add(ssid);
-                esp_wifi_disconnect();
-                vTaskDelay(pdMS_TO_TICKS(500));
-                continue;
-            }
-
-            // Step 6: Handle captive portal form
-            const char *base = final_url[0] ? final_url : redirect_url;
-            esp_err_t portal_err = handle_captive_portal(portal_body, base);
-            free(portal_body);
-
-            if (portal_err != ESP_OK || !s_connected) {
-                ESP_LOGW(TAG, "Portal handling failed, blocklisting '%s'", ssid);
-                scan_store_blocklist_add(ssid);
-                esp_wifi_disconnect();
-                vTaskDelay(pdMS_TO_TICKS(500));
-                continue;
-            }
-
-            // Step 7: Re-check connectivity after portal submission
-            vTaskDelay(pdMS_TO_TICKS(2000));  // Give portal time to activate
-            char dummy[URL_BUF_SIZE];
-            conn_status_t recheck = check_connectivity(dummy, sizeof(dummy));
-            if (recheck != CONN_DIRECT) {
-                ESP_LOGW(TAG, "Still captive after form submit, blocklisting '%s'", ssid);
-                scan_store_blocklist_add(ssid);
+            int64_t t_portal = esp_timer_get_time();
+            bool passed = pass_captive_portal(ssid, redirect_url);
+            s_timing.portal_ms += ms_since(t_portal);
+            s_timing.portal = true;
+            if (!passed) {
+                record_attempt_failure(ssid, rssi);
                 esp_wifi_disconnect();
                 vTaskDelay(pdMS_TO_TICKS(500));
                 continue;
             }
         }
 
-        // Step 8: User hook (request before sync)
+        // Step 8: User hook (request before sync), then SNTP sync; the budget
+        // is for getting online, not for what the hook does there
+        s_deadline_us = 0;
         ESP_LOGI(TAG, "'%s' — internet access confirmed!", ssid);
-        if (s_hook) {
-            esp_err_t hook_err = s_hook();
-            if (hook_err != ESP_OK) {
-                ESP_LOGW(TAG, "Hook returned error: %s (non-fatal)", esp_err_to_name(hook_err));
-            }
-        }
-
-        // Step 9: SNTP sync
-        do_sntp_sync();
+        s_timing.connect_ms = ms_since(t_start) - s_timing.portal_ms;
+        uint32_t tti_ms = ms_since(t_cand);
+        run_hook_and_sync();
+        record_success(ssid, conn == CONN_PORTAL, tti_ms);
 
-        // Step 10: Success
+        // Step 9: Success
         result = ESP_OK;
         break;
     }
+    scan_store_blocklist_snapshot_free(blocked);
+    s_deadline_us = 0;
+    if (result != ESP_OK) {
+        s_timing.connect_ms = ms_since(t_start) - s_timing.portal_ms;
+    }
 
     // Always deinit WiFi before returning
     esp_wifi_disconnect();
@@ -824,6 +1167,8 @@ esp_err_t open_wifi_try(const char **ssids, uint8_t ssid_count)
 esp_err_t open_wifi_try_home(const char *ssid, const char *password)
 {
     ESP_LOGI(TAG, "Trying home WiFi '%s'", ssid);
+    memset(&s_timing, 0, sizeof(s_timing));
+    int64_t t_start = esp_timer_get_time();
 
     esp_err_t err = wifi_init();
     if (err != ESP_OK) {
@@ -833,66 +1178,36 @@ esp_err_t open_wifi_try_home(const char *ssid, const char *password)
 
     esp_err_t result = ESP_FAIL;
 
-    // Configure with SSID and password
-    wifi_config_t sta_config = {0};
-    strncpy((char *)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid) - 1);
-    strncpy((char *)sta_config.sta.password, password, sizeof(sta_config.sta.password) - 1);
-
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
-
-    // Attempt connection (up to 2 tries)
-    for (int attempt = 0; attempt < 2; attempt++) {
-        s_got_ip = false;
-        s_connected = false;
-
-        ESP_LOGI(TAG, "Connecting to '%s' (attempt %d)", ssid, attempt + 1);
-        err = esp_wifi_connect();
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "esp_wifi_connect failed: %s", esp_err_to_name(err));
-            continue;
-        }
-
-        if (xSemaphoreTake(s_connect_sem, pdMS_TO_TICKS(15000)) == pdTRUE && s_got_ip) {
-            ESP_LOGI(TAG, "Connected to home WiFi '%s'", ssid);
-            break;
-        }
-
-        ESP_LOGW(TAG, "Connection attempt %d timed out", attempt + 1);
-        esp_wifi_disconnect();
-        vTaskDelay(pdMS_TO_TICKS(500));
-    }
-
-    if (!s_got_ip) {
+    if (!connect_network(ssid, password, false)) {
         ESP_LOGW(TAG, "Failed to connect to home WiFi '%s'", ssid);
+        record_failure(ssid, 0);
         goto cleanup;
     }
 
     // Verify connectivity (skip captive portal handling)
     {
         char dummy[URL_BUF_SIZE];
-        conn_status_t conn = check_connectivity(dummy, sizeof(dummy));
+        conn_status_t conn = check_connectivity_or_renew(ssid, password, dummy, sizeof(dummy));
         if (conn != CONN_DIRECT) {
             ESP_LOGW(TAG, "Home WiFi '%s' — no internet connectivity", ssid);
+            record_failure(ssid, 0);
             goto cleanup;
         }
     }
 
     ESP_LOGI(TAG, "Home WiFi '%s' — internet access confirmed!", ssid);
+    s_timing.connect_ms = ms_since(t_start);
 
-    // User hook (e.g. MQTT publish)
-    if (s_hook) {
-        esp_err_t hook_err = s_hook();
-        if (hook_err != ESP_OK) {
-            ESP_LOGW(TAG, "Hook returned error: %s (non-fatal)", esp_err_to_name(hook_err));
-        }
-    }
-
-    // SNTP sync
-    do_sntp_sync();
+    // User hook (e.g. MQTT publish), then SNTP sync
+    run_hook_and_sync();
+    record_success(ssid, false, s_timing.connect_ms);
 
     result = ESP_OK;
 
 cleanup:
+    if (result != ESP_OK) {
+        s_timing.connect_ms = ms_since(t_start);
+    }
     esp_wifi_disconnect();
     vTaskDelay(pdMS_TO_TICKS(200));
     wifi_deinit_full();
@@ -2,6 +2,7 @@
 
 #include "esp_err.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 // Callback invoked after successful open WiFi connection + SNTP sync
 typedef esp_err_t (*open_wifi_hook_t)(void);
@@ -9,12 +10,34 @@ typedef esp_err_t (*open_wifi_hook_t)(void);
 // Set the callback to invoke when connected to an open WiFi network.
 void open_wifi_set_hook(open_wifi_hook_t hook);
 
-// Try connecting to open WiFi networks from the given SSID list (sorted by preference).
+// An open network from the scan results (unique SSID, strongest AP)
+typedef struct {
+    const char    *ssid;
+    const uint8_t *bssid;
+    int8_t         rssi;
+} open_wifi_candidate_t;
+
+// Try connecting to open WiFi networks from the given candidates, in order of
+// expected time to internet (from the success rate and timing of earlier
+// attempts) until one works or CONFIG_LOCATOR_OPEN_WIFI_BUDGET_SEC is used up.
 // Returns ESP_OK if connected+used+disconnected successfully.
 // Returns ESP_ERR_NOT_FOUND if no candidate worked.
-// WiFi is fully deinitialized on return regardless of outcome.
-esp_err_t open_wifi_try(const char **ssids, uint8_t ssid_count);
+// On return, regardless of outcome, the station is disconnected and this
+// call's wifi_session reference is released. The driver is only stopped and
+// deinitialized if no other user still holds the session.
+esp_err_t open_wifi_try(const open_wifi_candidate_t *cands, uint8_t count);
 
 // Try connecting to the home WiFi (with password) for SNTP/hook.
-// WiFi is fully deinitialized on return regardless of outcome.
+// Disconnects and releases the wifi_session the same way as open_wifi_try.
 esp_err_t open_wifi_try_home(const char *ssid, const char *password);
+
+// Time spent in each phase of the last open_wifi_try / open_wifi_try_home call, in ms
+typedef struct {
+    uint32_t connect_ms;    // WiFi start, association, DHCP and connectivity checks
+    uint32_t portal_ms;     // captive portal fetch/submit
+    uint32_t sntp_ms;
+    uint32_t hook_ms;
+    bool     portal;        // a captive portal was handled
+} open_wifi_timing_t;
+
+void open_wifi_get_timing(open_wifi_timing_t *out);
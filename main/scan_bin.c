@@ -0,0 +1,175 @@
+#include "scan_bin.h"
+#include <math.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t *p;
+    size_t   len;
+    size_t   limit;
+    bool     full;
+} bbuf_t;
+
+static void put_byte(bbuf_t *b, uint8_t v)
+{
+    if (b->len >= b->limit) {
+        b->full = true;
+        return;
+    }
+    b->p[b->len++] = v;
+}
+
+static void put_bytes(bbuf_t *b, const void *data, size_t n)
+{
+    if (b->len + n > b->limit) {
+        b->full = true;
+        return;
+    }
+    memcpy(b->p + b->len, data, n);
+    b->len += n;
+}
+
+static void put_varint(bbuf_t *b, uint64_t v)
+{
+    while (v >= 0x80) {
+        put_byte(b, (uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    put_byte(b, (uint8_t)v);
+}
+
+static void put_svarint(bbuf_t *b, int64_t v)
+{
+    put_varint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static size_t varint_len(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+// Room left for scan records: the header and dictionary go in front of them
+static size_t record_limit(const scan_bin_t *w)
+{
+    size_t reserve = SCAN_BIN_HEAD_MAX + w->dict_len;
+    return w->size > reserve ? w->size - reserve : 0;
+}
+
+// Dictionary index of an SSID, adding it if new; -1 if the dictionary is full
+static int dict_index(scan_bin_t *w, const char *ssid, uint8_t len)
+{
+    for (int i = 0; i < w->dict_count; i++) {
+        if (w->dict_ssid_len[i] == len && memcmp(w->dict_ssid[i], ssid, len) == 0) return i;
+    }
+    if (w->dict_count >= SCAN_BIN_DICT_MAX) return -1;
+    memcpy(w->dict_ssid[w->dict_count], ssid, len);
+    w->dict_ssid_len[w->dict_count] = len;
+    w->dict_len += 1 + len;
+    return w->dict_count++;
+}
+
+void scan_bin_begin(scan_bin_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->scans = 0;
+    w->prev_id = -1;
+    w->prev_ts = 0;
+    w->dict_count = 0;
+    w->dict_len = 0;
+}
+
+bool scan_bin_add(scan_bin_t *w, uint16_t id, int64_t timestamp,
+                  const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc)
+{
+    if (ap_count > 0x7F || (int32_t)id <= w->prev_id) return false;
+
+    uint16_t dict_count = w->dict_count;
+    size_t dict_len = w->dict_len;
+    bbuf_t b = { .p = w->buf, .len = w->len, .limit = record_limit(w) };
+
+    put_varint(&b, (uint32_t)(id - w->prev_id - 1));
+    put_svarint(&b, timestamp - w->prev_ts);
+    put_byte(&b, ap_count | (loc ? 0x80 : 0));
+    for (uint8_t i = 0; i < ap_count && !b.full; i++) {
+        const stored_ap_t *ap = &aps[i];
+        int idx = dict_index(w, ap->ssid, ap->ssid_len > 32 ? 32 : ap->ssid_len);
+        if (idx < 0) {
+            b.full = true;
+            break;
+        }
+        b.limit = record_limit(w);
+        put_bytes(&b, ap->bssid, 6);
+        put_varint(&b, idx);
+        put_byte(&b, (uint8_t)ap->rssi);
+        put_byte(&b, ap->channel);
+        put_byte(&b, ap->authmode);
+    }
+    if (loc) {
+        put_svarint(&b, lround(loc->lat * 1e6));
+        put_svarint(&b, lround(loc->lng * 1e6));
+        put_varint(&b, loc->accuracy > 0 ? (uint64_t)lround(loc->accuracy) : 0);
+    }
+
+    if (b.full || b.len > record_limit(w)) {
+        w->dict_count = dict_count;
+        w->dict_len = dict_len;
+        return false;
+    }
+    w->len = b.len;
+    w->scans++;
+    w->prev_id = id;
+    w->prev_ts = timestamp;
+    return true;
+}
+
+size_t scan_bin_finish(scan_bin_t *w, uint8_t flags, int64_t batch, uint16_t part,
+                       const cycle_stats_t *stats)
+{
+    uint8_t head[SCAN_BIN_HEAD_MAX];
+    bbuf_t h = { .p = head, .limit = sizeof(head) };
+
+    if (stats) flags |= SCAN_BIN_F_STATS;
+    put_bytes(&h, "LB", 2);
+    put_byte(&h, SCAN_BIN_VERSION);
+    put_byte(&h, flags);
+    if (flags & SCAN_BIN_F_PAGE) {
+        put_svarint(&h, batch);
+        put_varint(&h, part);
+    }
+    if (stats) {
+        put_svarint(&h, stats->timestamp);
+        put_varint(&h, stats->boot_ms);
+        put_varint(&h, stats->scan_ms);
+        put_varint(&h, stats->save_ms);
+        put_varint(&h, stats->connect_ms);
+        put_varint(&h, stats->portal_ms);
+        put_varint(&h, stats->sntp_ms);
+        put_varint(&h, stats->mqtt_ms);
+        put_varint(&h, stats->total_ms);
+        put_varint(&h, stats->sleep_s);
+    }
+    put_varint(&h, w->dict_count);
+
+    size_t count_len = varint_len(w->scans);
+    size_t front = h.len + w->dict_len + count_len;
+    if (h.full || w->len + front > w->size) return 0;
+
+    // Slide the scan records up and fill in what goes in front of them
+    memmove(w->buf + front, w->buf, w->len);
+    bbuf_t b = { .p = w->buf, .limit = front };
+    put_bytes(&b, head, h.len);
+    for (uint16_t i = 0; i < w->dict_count; i++) {
+        put_byte(&b, w->dict_ssid_len[i]);
+        put_bytes(&b, w->dict_ssid[i], w->dict_ssid_len[i]);
+    }
+    put_varint(&b, w->scans);
+
+    w->len += front;
+    return w->len;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "wifi_scan.h"
+#include "scan_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary encoding of scans, the MQTT alternative to scan_json
+// (selected with "?format=bin" on the URL, decoded by locator_bin.py).
+// Integers are LEB128 varints, signed ones zigzag-encoded ("s" below).
+//
+//   "LB" version flags
+//   [batch part]               SCAN_BIN_F_PAGE
+//   [stats: timestamp boot_ms scan_ms save_ms connect_ms portal_ms
+//           sntp_ms mqtt_ms total_ms sleep_s]          SCAN_BIN_F_STATS
+//   ssid_count {len bytes}...  SSID dictionary, first use order
+//   scan_count
+//   per scan: id gap (from previous id + 1), s timestamp delta (from
+//             previous scan, first from 0), ap_count | 0x80 with location
+//     per AP: bssid[6] ssid_index rssi(int8) channel(u8) auth(u8)
+//     location: s lat_e6, s lng_e6, accuracy (m)
+//
+// A 10-AP scan takes ~110 bytes before SSIDs, against ~1 KB of JSON.
+
+#define SCAN_BIN_VERSION  1
+
+#define SCAN_BIN_F_PAGE   0x01
+#define SCAN_BIN_F_LAST   0x02
+#define SCAN_BIN_F_STATS  0x04
+
+#define SCAN_BIN_DICT_MAX 128
+#define SCAN_BIN_HEAD_MAX 64    // everything before the dictionary
+
+// Buffer size that holds any single scan message
+#define SCAN_BIN_MAX (SCAN_BIN_HEAD_MAX + 32 + CONFIG_LOCATOR_MAX_APS_PER_SCAN * (33 + 12))
+
+typedef struct {
+    uint8_t *buf;
+    size_t   size;
+    size_t   len;           // scan records, at the start of buf until finished
+    uint16_t scans;
+    int32_t  prev_id;
+    int64_t  prev_ts;
+    uint16_t dict_count;
+    size_t   dict_len;      // encoded dictionary bytes
+    uint8_t  dict_ssid_len[SCAN_BIN_DICT_MAX];
+    char     dict_ssid[SCAN_BIN_DICT_MAX][32];
+} scan_bin_t;
+
+void scan_bin_begin(scan_bin_t *w, uint8_t *buf, size_t size);
+
+// Append one scan. loc may be NULL. Returns false, leaving the message as it
+// was, if the scan doesn't fit in the buffer or the SSID dictionary.
+bool scan_bin_add(scan_bin_t *w, uint16_t id, int64_t timestamp,
+                  const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc);
+
+// Complete the message in place. batch/part are used with SCAN_BIN_F_PAGE,
+// stats (may be NULL) sets SCAN_BIN_F_STATS. Returns the message length.
+size_t scan_bin_finish(scan_bin_t *w, uint8_t flags, int64_t batch, uint16_t part,
+                       const cycle_stats_t *stats);
@@ -0,0 +1,83 @@
+#include "scan_json.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    char  *buf;
+    size_t size;
+    size_t len;
+    bool   full;
+} jbuf_t;
+
+static void put(jbuf_t *b, const char *fmt, ...)
+{
+    if (b->full) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(b->buf + b->len, b->size - b->len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= b->size - b->len) {
+        b->full = true;
+        return;
+    }
+    b->len += n;
+}
+
+// Quoted, escaped JSON string from a length-delimited SSID
+static void put_str(jbuf_t *b, const char *s, size_t len)
+{
+    put(b, "\"");
+    for (size_t i = 0; i < len && !b->full; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            put(b, "\\%c", c);
+        } else if (c < 0x20) {
+            put(b, "\\u%04x", c);
+        } else {
+            put(b, "%c", c);
+        }
+    }
+    put(b, "\"");
+}
+
+const char *scan_json_auth_name(uint8_t authmode)
+{
+    switch (authmode) {
+        case 0: return "OPEN";
+        case 1: return "WEP";
+        case 2: return "WPA_PSK";
+        case 3: return "WPA2_PSK";
+        case 4: return "WPA_WPA2_PSK";
+        case 5: return "WPA2_ENTERPRISE";
+        case 6: return "WPA3_PSK";
+        case 7: return "WPA2_WPA3_PSK";
+        default: return "UNKNOWN";
+    }
+}
+
+size_t scan_json_write(char *buf, size_t size, uint16_t id, int64_t timestamp,
+                       const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc)
+{
+    jbuf_t b = { .buf = buf, .size = size };
+
+    put(&b, "{\"id\":%u,\"timestamp\":%lld", id, (long long)timestamp);
+    if (aps) put(&b, ",\"aps\":[");
+    for (uint8_t i = 0; aps && i < ap_count; i++) {
+        const stored_ap_t *ap = &aps[i];
+        put(&b, "%s{\"ssid\":", i ? "," : "");
+        put_str(&b, ap->ssid, ap->ssid_len > 32 ? 32 : ap->ssid_len);
+        put(&b, ",\"bssid\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"rssi\":%d,\"channel\":%u,\"auth\":\"%s\"}",
+            ap->bssid[0], ap->bssid[1], ap->bssid[2], ap->bssid[3], ap->bssid[4], ap->bssid[5],
+            ap->rssi, ap->channel, scan_json_auth_name(ap->authmode));
+    }
+    if (aps) put(&b, "]");
+    if (loc) {
+        put(&b, ",\"location\":{\"lat\":%.15g,\"lng\":%.15g,\"accuracy\":%.15g}",
+            loc->lat, loc->lng, loc->accuracy);
+    }
+    put(&b, "}");
+
+    return b.full ? 0 : b.len;
+}
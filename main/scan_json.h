@@ -0,0 +1,21 @@
+#pragma once
+
+#include "wifi_scan.h"
+#include "scan_store.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// cJSON-free serializer for stored scans, for callers that stream many scans
+// through a fixed buffer. Output matches the cJSON objects used elsewhere:
+// {"id":N,"timestamp":T,"aps":[{"ssid","bssid","rssi","channel","auth"}],"location":{...}}
+
+// Largest object scan_json_write() can produce (every SSID fully escaped)
+#define SCAN_JSON_MAX (192 + CONFIG_LOCATOR_MAX_APS_PER_SCAN * 290)
+
+// Write one scan as a JSON object into buf. loc may be NULL; with aps NULL
+// the "aps" array is left out.
+// Returns the length written (not NUL-terminated), or 0 if it doesn't fit.
+size_t scan_json_write(char *buf, size_t size, uint16_t id, int64_t timestamp,
+                       const stored_ap_t *aps, uint8_t ap_count, const scan_location_t *loc);
+
+const char *scan_json_auth_name(uint8_t authmode);
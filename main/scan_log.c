@@ -0,0 +1,445 @@
+#include "scan_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+static const char *TAG = "scan_log";
+
+// Layout: the partition is a ring of 4 KB sectors. Each sector starts with a
+// sector header carrying a sequence number; records are appended behind it and
+// never cross a sector boundary. The sector after the active one is always kept
+// erased (erase-ahead), so opening a new sector never waits for an erase and a
+// power cut never leaves the log without a writable sector.
+#define LOG_SECTOR_SIZE   4096
+#define LOG_SECTOR_MAGIC  0x474F4C53    // "SLOG"
+#define LOG_REC_MAGIC     0x5352        // "RS"
+#define LOG_NONE          0xFFFFFFFF
+
+#define LOG_REC_SCAN      1
+#define LOG_REC_LOCATION  2
+#define LOG_REC_DELETE    3
+
+// Largest scan record: header + timestamp + count + APs with full SSIDs
+#define LOG_AP_MAX        (10 + 32)
+#define LOG_REC_MAX       (sizeof(log_rec_hdr_t) + 9 + CONFIG_LOCATOR_MAX_APS_PER_SCAN * LOG_AP_MAX + 3)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;
+} log_sector_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t  type;          // LOG_REC_*
+    uint8_t  reserved;
+    uint16_t len;           // payload bytes (record is padded to 4)
+    uint16_t index;         // scan index the record belongs to
+    uint32_t seq;           // record sequence number
+    uint32_t crc;           // CRC32 of the header fields above + payload
+} log_rec_hdr_t;
+
+// Per-scan slot in RAM, rebuilt from the log at boot
+typedef struct {
+    uint32_t off;           // scan record offset, LOG_NONE if deleted
+    uint32_t loc_off;       // latest location record, LOG_NONE if none
+} log_slot_t;
+
+static const esp_partition_t *s_part;
+static uint16_t s_sectors;
+static uint16_t s_cur;          // active sector
+static uint32_t s_write_off;    // next record offset in the partition
+static uint32_t s_sector_seq;
+static uint32_t s_rec_seq;
+static uint16_t s_head, s_count;
+static log_slot_t *s_tab;
+static uint8_t s_rec[LOG_REC_MAX] __attribute__((aligned(4)));
+
+#define ALIGN4(x) (((x) + 3) & ~3u)
+
+static log_slot_t *slot(uint16_t index)
+{
+    return &s_tab[index % CONFIG_LOCATOR_MAX_STORED_SCANS];
+}
+
+static bool is_live(uint16_t index)
+{
+    return (uint16_t)(index - s_head) < (uint16_t)(s_count - s_head) && slot(index)->off != LOG_NONE;
+}
+
+static uint32_t rec_crc(const log_rec_hdr_t *hdr, const uint8_t *payload)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)hdr, offsetof(log_rec_hdr_t, crc));
+    return esp_rom_crc32_le(crc, payload, hdr->len);
+}
+
+// Read and verify the record at off into s_rec. Returns the header.
+static esp_err_t read_record(uint32_t off, log_rec_hdr_t *out)
+{
+    esp_err_t err = esp_partition_read(s_part, off, out, sizeof(*out));
+    if (err != ESP_OK) return err;
+    if (out->magic != LOG_REC_MAGIC || out->len > LOG_REC_MAX - sizeof(*out)) return ESP_ERR_INVALID_CRC;
+    if (off % LOG_SECTOR_SIZE + sizeof(*out) + out->len > LOG_SECTOR_SIZE) return ESP_ERR_INVALID_CRC;
+    err = esp_partition_read(s_part, off + sizeof(*out), s_rec, out->len);
+    if (err != ESP_OK) return err;
+    return rec_crc(out, s_rec) == out->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// Drop scans whose records live in a sector that is about to be erased. The
+// sector being erased is always the oldest one, so they are at the head.
+static void drop_sector(uint16_t sector)
+{
+    while (s_head != s_count) {
+        uint32_t off = slot(s_head)->off;
+        if (off != LOG_NONE && off / LOG_SECTOR_SIZE != sector) break;
+        s_head++;
+    }
+}
+
+static esp_err_t erase_sector(uint16_t sector)
+{
+    drop_sector(sector);
+    return esp_partition_erase_range(s_part, (size_t)sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE);
+}
+
+// Start writing into the next (already erased) sector and erase the one after it
+static esp_err_t open_next_sector(void)
+{
+    s_cur = (s_cur + 1) % s_sectors;
+    log_sector_hdr_t hdr = { .magic = LOG_SECTOR_MAGIC, .seq = ++s_sector_seq };
+    uint32_t base = (uint32_t)s_cur * LOG_SECTOR_SIZE;
+    esp_err_t err = esp_partition_write(s_part, base, &hdr, sizeof(hdr));
+    if (err != ESP_OK) return err;
+    s_write_off = base + sizeof(hdr);
+    return erase_sector((s_cur + 1) % s_sectors);
+}
+
+static esp_err_t append(uint8_t type, uint16_t index, const uint8_t *payload, uint16_t len, uint32_t *out_off)
+{
+    uint32_t size = ALIGN4(sizeof(log_rec_hdr_t) + len);
+    if (s_write_off % LOG_SECTOR_SIZE + size > LOG_SECTOR_SIZE || s_write_off % LOG_SECTOR_SIZE == 0) {
+        esp_err_t err = open_next_sector();
+        if (err != ESP_OK) return err;
+    }
+
+    log_rec_hdr_t hdr = {
+        .magic = LOG_REC_MAGIC,
+        .type = type,
+        .len = len,
+        .index = index,
+        .seq = ++s_rec_seq,
+    };
+    if (len && payload != s_rec + sizeof(hdr)) memmove(s_rec + sizeof(hdr), payload, len);
+    hdr.crc = rec_crc(&hdr, s_rec + sizeof(hdr));
+    memcpy(s_rec, &hdr, sizeof(hdr));
+    memset(s_rec + sizeof(hdr) + len, 0xFF, size - sizeof(hdr) - len);
+
+    // Header and payload in one write: a torn write fails the CRC at boot
+    esp_err_t err = esp_partition_write(s_part, s_write_off, s_rec, size);
+    if (err != ESP_OK) {
+        // Part of the record may be on flash; don't write behind it
+        s_write_off = (s_write_off / LOG_SECTOR_SIZE + 1) * LOG_SECTOR_SIZE;
+        return err;
+    }
+    if (out_off) *out_off = s_write_off;
+    s_write_off += size;
+    return ESP_OK;
+}
+
+// Apply one record while rebuilding the table
+static void replay(const log_rec_hdr_t *hdr, uint32_t off)
+{
+    switch (hdr->type) {
+    case LOG_REC_SCAN:
+        if (s_head == s_count) s_head = s_count = hdr->index;
+        if ((uint16_t)(hdr->index - s_head) >= (uint16_t)(s_count - s_head)) {
+            while (s_count != hdr->index) {
+                slot(s_count)->off = LOG_NONE;  // gap (never written)
+                slot(s_count)->loc_off = LOG_NONE;
+                s_count++;
+            }
+            s_count++;
+        }
+        slot(hdr->index)->off = off;
+        slot(hdr->index)->loc_off = LOG_NONE;
+        if (s_count - s_head > CONFIG_LOCATOR_MAX_STORED_SCANS) {
+            s_head = s_count - CONFIG_LOCATOR_MAX_STORED_SCANS;
+        }
+        break;
+    case LOG_REC_LOCATION:
+        if (is_live(hdr->index)) slot(hdr->index)->loc_off = off;
+        break;
+    case LOG_REC_DELETE:
+        if (is_live(hdr->index)) slot(hdr->index)->off = LOG_NONE;
+        break;
+    }
+}
+
+// Replay the records of one sector. Returns false if the sector ends in a
+// torn or corrupt record and must not be written to any more.
+static bool replay_sector(uint16_t sector, uint32_t *out_end)
+{
+    uint32_t base = (uint32_t)sector * LOG_SECTOR_SIZE;
+    uint32_t off = base + sizeof(log_sector_hdr_t);
+
+    while (off + sizeof(log_rec_hdr_t) <= base + LOG_SECTOR_SIZE) {
+        log_rec_hdr_t hdr;
+        if (esp_partition_read(s_part, off, &hdr, sizeof(hdr)) != ESP_OK) break;
+        if (hdr.magic == 0xFFFF && hdr.type == 0xFF && hdr.len == 0xFFFF) break;  // erased: end of log
+
+        if (read_record(off, &hdr) != ESP_OK) {
+            ESP_LOGW(TAG, "Corrupt record at 0x%lx, skipping rest of sector %u", (unsigned long)off, sector);
+            *out_end = off;
+            return false;
+        }
+        if (hdr.seq > s_rec_seq) s_rec_seq = hdr.seq;
+        replay(&hdr, off);
+        off += ALIGN4(sizeof(hdr) + hdr.len);
+    }
+    *out_end = off;
+    return true;
+}
+
+static bool sector_is_erased(uint16_t sector)
+{
+    uint32_t *buf = (uint32_t *)s_rec;
+    size_t chunk = sizeof(s_rec) & ~3u;
+    for (size_t pos = 0; pos < LOG_SECTOR_SIZE; pos += chunk) {
+        size_t n = LOG_SECTOR_SIZE - pos < chunk ? LOG_SECTOR_SIZE - pos : chunk;
+        if (esp_partition_read(s_part, (size_t)sector * LOG_SECTOR_SIZE + pos, buf, n) != ESP_OK) return false;
+        for (size_t i = 0; i < n / 4; i++) {
+            if (buf[i] != 0xFFFFFFFF) return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t format(void)
+{
+    esp_err_t err = esp_partition_erase_range(s_part, 0, (size_t)s_sectors * LOG_SECTOR_SIZE);
+    if (err != ESP_OK) return err;
+    s_head = s_count = 0;
+    s_rec_seq = 0;
+    s_sector_seq = 0;
+    s_cur = s_sectors - 1;          // open_next_sector() moves to sector 0
+    return open_next_sector();
+}
+
+esp_err_t scan_log_init(void)
+{
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "scanlog");
+    if (!s_part) return ESP_ERR_NOT_FOUND;
+    s_sectors = s_part->size / LOG_SECTOR_SIZE;
+    if (s_sectors < 3) return ESP_ERR_INVALID_SIZE;
+
+    if (!s_tab) {
+        s_tab = malloc(CONFIG_LOCATOR_MAX_STORED_SCANS * sizeof(log_slot_t));
+        if (!s_tab) return ESP_ERR_NO_MEM;
+    }
+    s_head = s_count = 0;
+    s_rec_seq = 0;
+
+    // Oldest sector first: the ring is written in order, so start right after
+    // the sector with the highest sequence number.
+    uint16_t newest = 0;
+    uint32_t newest_seq = 0;
+    for (uint16_t i = 0; i < s_sectors; i++) {
+        log_sector_hdr_t hdr;
+        esp_err_t err = esp_partition_read(s_part, (size_t)i * LOG_SECTOR_SIZE, &hdr, sizeof(hdr));
+        if (err != ESP_OK) return err;
+        if (hdr.magic == LOG_SECTOR_MAGIC && hdr.seq >= newest_seq && hdr.seq != 0xFFFFFFFF) {
+            newest = i;
+            newest_seq = hdr.seq;
+        }
+    }
+    if (newest_seq == 0) {
+        ESP_LOGI(TAG, "Formatting scan log (%u sectors)", s_sectors);
+        return format();
+    }
+
+    bool writable = true;
+    uint32_t end = 0;
+    for (uint16_t k = 1; k <= s_sectors; k++) {
+        uint16_t i = (newest + k) % s_sectors;
+        log_sector_hdr_t hdr;
+        esp_partition_read(s_part, (size_t)i * LOG_SECTOR_SIZE, &hdr, sizeof(hdr));
+        if (hdr.magic != LOG_SECTOR_MAGIC || hdr.seq > newest_seq) continue;
+        writable = replay_sector(i, &end);
+    }
+    s_cur = newest;
+    s_sector_seq = newest_seq;
+    s_write_off = end;
+
+    // Re-establish erase-ahead: a power cut may have interrupted the erase
+    // or the header write of the next sector.
+    uint16_t next = (s_cur + 1) % s_sectors;
+    if (!sector_is_erased(next)) {
+        ESP_LOGW(TAG, "Sector %u not erased, erasing", next);
+        esp_err_t err = erase_sector(next);
+        if (err != ESP_OK) return err;
+    }
+    if (!writable) {
+        esp_err_t err = open_next_sector();
+        if (err != ESP_OK) return err;
+    }
+
+    ESP_LOGI(TAG, "Scan log: scans %u..%u, sector %u, seq %lu",
+             s_head, s_count, s_cur, (unsigned long)s_rec_seq);
+    return ESP_OK;
+}
+
+esp_err_t scan_log_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index)
+{
+    if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+
+    // Payload: timestamp, count, then per AP bssid, rssi, channel, authmode, SSID (length-prefixed)
+    uint8_t *p = s_rec + sizeof(log_rec_hdr_t);
+    memcpy(p, &timestamp, sizeof(timestamp));
+    p += sizeof(timestamp);
+    *p++ = ap_count;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        uint8_t len = aps[i].ssid_len > 32 ? 32 : aps[i].ssid_len;
+        memcpy(p, aps[i].bssid, 6);
+        p += 6;
+        *p++ = (uint8_t)aps[i].rssi;
+        *p++ = aps[i].channel;
+        *p++ = aps[i].authmode;
+        *p++ = len;
+        memcpy(p, aps[i].ssid, len);
+        p += len;
+    }
+
+    uint16_t index = s_count;
+    uint32_t off;
+    esp_err_t err = append(LOG_REC_SCAN, index, s_rec + sizeof(log_rec_hdr_t),
+                           p - (s_rec + sizeof(log_rec_hdr_t)), &off);
+    if (err != ESP_OK) return err;
+
+    slot(index)->off = off;
+    slot(index)->loc_off = LOG_NONE;
+    s_count++;
+    if (s_count - s_head > CONFIG_LOCATOR_MAX_STORED_SCANS) {
+        s_head = s_count - CONFIG_LOCATOR_MAX_STORED_SCANS;
+    }
+
+    if (out_index) *out_index = index;
+    ESP_LOGI(TAG, "Saved scan %u with %u APs at 0x%lx", index, ap_count, (unsigned long)off);
+    return ESP_OK;
+}
+
+// Decode the scan record in s_rec
+static uint8_t decode_scan(const log_rec_hdr_t *hdr, stored_ap_t *aps, uint8_t max_aps, int64_t *out_timestamp)
+{
+    const uint8_t *p = s_rec, *end = s_rec + hdr->len;
+    if (hdr->len < 9) return 0;
+    if (out_timestamp) memcpy(out_timestamp, p, sizeof(int64_t));
+    p += sizeof(int64_t);
+    uint8_t ap_count = *p++;
+    if (!aps) return ap_count;
+
+    uint8_t n = 0;
+    while (n < ap_count && n < max_aps && p + 10 <= end) {
+        stored_ap_t *ap = &aps[n];
+        memset(ap, 0, sizeof(*ap));
+        memcpy(ap->bssid, p, 6);
+        p += 6;
+        ap->rssi = (int8_t)*p++;
+        ap->channel = *p++;
+        ap->authmode = *p++;
+        ap->ssid_len = *p++;
+        if (ap->ssid_len > 32 || p + ap->ssid_len > end) break;
+        memcpy(ap->ssid, p, ap->ssid_len);
+        p += ap->ssid_len;
+        n++;
+    }
+    return n;
+}
+
+esp_err_t scan_log_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count,
+                        int64_t *out_timestamp)
+{
+    if (!is_live(index)) return ESP_ERR_NOT_FOUND;
+    log_rec_hdr_t hdr;
+    esp_err_t err = read_record(slot(index)->off, &hdr);
+    if (err != ESP_OK) return err;
+    uint8_t n = decode_scan(&hdr, aps, max_aps, out_timestamp);
+    if (out_ap_count) *out_ap_count = n;
+    return ESP_OK;
+}
+
+esp_err_t scan_log_get_range(uint16_t *out_head, uint16_t *out_count)
+{
+    *out_head = s_head;
+    *out_count = s_count;
+    return ESP_OK;
+}
+
+esp_err_t scan_log_delete(uint16_t index)
+{
+    if (!is_live(index)) return ESP_ERR_NOT_FOUND;
+    esp_err_t err = append(LOG_REC_DELETE, index, NULL, 0, NULL);
+    if (err != ESP_OK) return err;
+    slot(index)->off = LOG_NONE;
+    return ESP_OK;
+}
+
+esp_err_t scan_log_delete_all(void)
+{
+    return format();
+}
+
+esp_err_t scan_log_save_location(uint16_t index, const scan_location_t *loc)
+{
+    if (!is_live(index)) return ESP_ERR_NOT_FOUND;
+    uint32_t off;
+    esp_err_t err = append(LOG_REC_LOCATION, index, (const uint8_t *)loc, sizeof(*loc), &off);
+    if (err != ESP_OK) return err;
+    slot(index)->loc_off = off;
+    return ESP_OK;
+}
+
+esp_err_t scan_log_get_location(uint16_t index, scan_location_t *out)
+{
+    if (!is_live(index) || slot(index)->loc_off == LOG_NONE) return ESP_ERR_NOT_FOUND;
+    log_rec_hdr_t hdr;
+    esp_err_t err = read_record(slot(index)->loc_off, &hdr);
+    if (err != ESP_OK) return err;
+    if (hdr.len != sizeof(*out)) return ESP_ERR_INVALID_SIZE;
+    memcpy(out, s_rec, sizeof(*out));
+    return ESP_OK;
+}
+
+bool scan_log_has_location(uint16_t index)
+{
+    return is_live(index) && slot(index)->loc_off != LOG_NONE;
+}
+
+esp_err_t scan_log_iterate(uint16_t from, scan_log_cb_t cb, void *ctx)
+{
+    // The slot table gives every record's offset, so start right at `from`
+    uint16_t start = s_head;
+    if ((uint16_t)(from - s_head) < (uint16_t)(s_count - s_head)) start = from;
+    else if ((uint16_t)(from - s_count) < 0x8000) return ESP_OK;  // at or past the end
+
+    stored_ap_t *aps = malloc(CONFIG_LOCATOR_MAX_APS_PER_SCAN * sizeof(stored_ap_t));
+    if (!aps) return ESP_ERR_NO_MEM;
+
+    for (uint16_t i = start; i != s_count; i++) {
+        if (!is_live(i)) continue;
+
+        scan_location_t loc;
+        bool located = scan_log_get_location(i, &loc) == ESP_OK;
+
+        log_rec_hdr_t hdr;
+        int64_t timestamp = 0;
+        if (read_record(slot(i)->off, &hdr) != ESP_OK) continue;
+        uint8_t n = decode_scan(&hdr, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &timestamp);
+
+        if (!cb(i, aps, n, timestamp, located ? &loc : NULL, ctx)) break;
+    }
+
+    free(aps);
+    return ESP_OK;
+}
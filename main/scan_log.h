@@ -0,0 +1,33 @@
+#pragma once
+
+#include "scan_store.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Append-only scan history in the raw "scanlog" data partition.
+// Used by scan_store when CONFIG_LOCATOR_SCANLOG is enabled; the functions
+// mirror the scan_store scan API.
+
+// Find the partition and rebuild the in-RAM scan table from the log.
+// Fails with ESP_ERR_NOT_FOUND if the partition table has no "scanlog" entry.
+esp_err_t scan_log_init(void);
+
+esp_err_t scan_log_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index);
+esp_err_t scan_log_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count,
+                        int64_t *out_timestamp);
+esp_err_t scan_log_get_range(uint16_t *out_head, uint16_t *out_count);
+esp_err_t scan_log_delete(uint16_t index);
+esp_err_t scan_log_delete_all(void);
+
+esp_err_t scan_log_save_location(uint16_t index, const scan_location_t *loc);
+esp_err_t scan_log_get_location(uint16_t index, scan_location_t *out);
+bool      scan_log_has_location(uint16_t index);
+
+// Called for each stored scan from index `from` on (earlier ones are skipped
+// without reading flash), oldest first. loc is NULL if not located.
+// Return false to stop iterating.
+typedef bool (*scan_log_cb_t)(uint16_t index, const stored_ap_t *aps, uint8_t ap_count,
+                              int64_t timestamp, const scan_location_t *loc, void *ctx);
+
+esp_err_t scan_log_iterate(uint16_t from, scan_log_cb_t cb, void *ctx);
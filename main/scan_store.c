@@ -1,214 +1,2045 @@
 #include "scan_store.h"
+#include "scan_log.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <sys/param.h>
 
 static const char *TAG = "scan_store";
 static const char *NVS_NAMESPACE = "locator";
 static nvs_handle_t nvs_h;
+static SemaphoreHandle_t s_lock;
+static uint32_t s_generation;   // bumped on every change to the scan list
+
+#ifdef CONFIG_LOCATOR_SCANLOG
+// Scan history lives in the "scanlog" partition instead of NVS
+static bool s_use_log = false;
+#endif
+
+// Bump when scan_index_entry_t changes; the index is rebuilt from the segments.
+#define SCAN_INDEX_VERSION 3
+#define SCAN_INDEX_LAYOUT  ((SCAN_INDEX_VERSION << 8) | sizeof(scan_index_entry_t))
+
+static esp_err_t migrate_legacy_scans(void);
+static esp_err_t index_rebuild(uint16_t old_layout);
+static esp_err_t pend_init(void);
+static esp_err_t pend_replay(void);
+static esp_err_t pend_checkpoint(void);
+static void evict_sweep(void);
+static esp_err_t store_get_range(uint16_t *out_head, uint16_t *out_count);
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+static void rtc_check(void);
+#endif
+static void cycle_stats_save(void);
+static esp_err_t outbox_save(void);
+
+static esp_err_t get_u16_or_default(const char *key, uint16_t *val, uint16_t def)
+{
+    esp_err_t err = nvs_get_u16(nvs_h, key, val);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        *val = def;
+        return ESP_OK;
+    }
+    return err;
+}
 
 esp_err_t scan_store_init(void)
 {
-    return nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_h);
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_h);
+    if (err != ESP_OK) return err;
+    s_lock = xSemaphoreCreateRecursiveMutex();
+    if (!s_lock) return ESP_ERR_NO_MEM;
+    // Random start, so a value from before a reboot is never current
+    s_generation = esp_random();
+
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    rtc_check();
+#endif
+
+#ifdef CONFIG_LOCATOR_SCANLOG
+    err = scan_log_init();
+    if (err == ESP_OK) {
+        s_use_log = true;
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "Scan log unavailable (%s), using NVS", esp_err_to_name(err));
+#endif
+
+    uint16_t seg_tail;
+    if (nvs_get_u16(nvs_h, "seg_tail", &seg_tail) == ESP_ERR_NVS_NOT_FOUND) {
+        // First boot with segment storage: convert per-scan sNNNNN/lNNNNN blobs
+        err = migrate_legacy_scans();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Scan migration failed: %s", esp_err_to_name(err));
+        }
+        pend_init();
+        return ESP_OK;
+    }
+
+    err = pend_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Pending scans unreadable: %s", esp_err_to_name(err));
+    }
+    evict_sweep();
+
+    uint16_t layout = 0;
+    nvs_get_u16(nvs_h, "ix_layout", &layout);
+    if (layout != SCAN_INDEX_LAYOUT) {
+        err = index_rebuild(layout);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Scan index rebuild failed: %s", esp_err_to_name(err));
+        }
+    }
+    return ESP_OK;
 }
 
-static void make_scan_key(uint16_t index, char *key)
+// --- Scan index (header-only view of every stored scan) ---
+
+// One index block cached in RAM; save/delete/locate of nearby scans hit the same block.
+static scan_index_entry_t s_blk[SCAN_INDEX_BLOCK];
+static int32_t s_blk_no = -1;
+
+// Pending scans [seg_ckpt, scan_count): saved as just their segment record
+// ("pNNNNN"), all in the open segment. Their index entries live here until
+// the next checkpoint writes the segment and the index blocks.
+#define SCAN_PENDING_MAX 8
+static scan_index_entry_t s_pend[SCAN_PENDING_MAX];
+static uint16_t s_pend_first;       // seg_ckpt
+static uint8_t  s_pend_n;
+static int32_t  s_pend_seg = -1;    // open segment, -1 until pend_init()
+
+static void make_index_key(uint16_t block, char *key)
 {
-    snprintf(key, 7, "s%05u", index);
+    snprintf(key, 7, "x%04u", block);
 }
 
-static void make_loc_key(uint16_t index, char *key)
+static uint16_t bssid_hash16(const uint8_t *bssid)
 {
-    snprintf(key, 7, "l%05u", index);
+    // FNV-1a, folded to 16 bits
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        h ^= bssid[i];
+        h *= 16777619u;
+    }
+    return (uint16_t)(h ^ (h >> 16));
 }
 
-static esp_err_t get_u16_or_default(const char *key, uint16_t *val, uint16_t def)
+static esp_err_t index_read_block(uint16_t block, scan_index_entry_t *entries)
 {
-    esp_err_t err = nvs_get_u16(nvs_h, key, val);
+    char key[7];
+    make_index_key(block, key);
+    size_t size = SCAN_INDEX_BLOCK * sizeof(scan_index_entry_t);
+    esp_err_t err = nvs_get_blob(nvs_h, key, entries, &size);
     if (err == ESP_ERR_NVS_NOT_FOUND) {
-        *val = def;
-        return ESP_OK;
+        memset(entries, 0, SCAN_INDEX_BLOCK * sizeof(scan_index_entry_t));
+    } else if (err != ESP_OK) {
+        return err;
+    }
+    // Pending scans are newer than the stored block
+    for (uint8_t k = 0; k < s_pend_n; k++) {
+        uint16_t i = s_pend_first + k;
+        if (i / SCAN_INDEX_BLOCK == block) entries[i % SCAN_INDEX_BLOCK] = s_pend[k];
     }
+    return ESP_OK;
+}
+
+static esp_err_t index_load_block(uint16_t block)
+{
+    if (s_blk_no == block) return ESP_OK;
+    esp_err_t err = index_read_block(block, s_blk);
+    s_blk_no = (err == ESP_OK) ? block : -1;
     return err;
 }
 
-esp_err_t scan_store_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index)
+static esp_err_t index_store_block(void)
 {
-    uint16_t scan_count, scan_head;
-    esp_err_t err;
+    char key[7];
+    make_index_key((uint16_t)s_blk_no, key);
+    return nvs_set_blob(nvs_h, key, s_blk, sizeof(s_blk));
+}
 
-    err = get_u16_or_default("scan_count", &scan_count, 0);
+static void index_erase_block(uint16_t block)
+{
+    char key[7];
+    make_index_key(block, key);
+    nvs_erase_key(nvs_h, key);
+    if (s_blk_no == block) s_blk_no = -1;
+}
+
+// Erase index blocks that lie entirely below new_head
+static void index_erase_below(uint16_t old_head, uint16_t new_head)
+{
+    for (uint16_t b = old_head / SCAN_INDEX_BLOCK; b < new_head / SCAN_INDEX_BLOCK; b++) {
+        index_erase_block(b);
+    }
+}
+
+static void index_fill_entry(scan_index_entry_t *e, const stored_ap_t *aps, uint8_t ap_count,
+                             int64_t timestamp, uint16_t segment)
+{
+    memset(e, 0, sizeof(*e));
+    if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+    e->timestamp = timestamp;
+    e->ap_count = ap_count;
+    e->flags = SCAN_INDEX_F_VALID;
+    e->segment = segment;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        e->bssid_hash[i] = bssid_hash16(aps[i].bssid);
+    }
+}
+
+static void index_set_location(scan_index_entry_t *e, double lat, double lng, double accuracy)
+{
+    e->lat_e6 = (int32_t)lround(lat * 1e6);
+    e->lng_e6 = (int32_t)lround(lng * 1e6);
+    e->accuracy = (accuracy > 65535.0) ? 65535 : (uint16_t)lround(accuracy);
+    e->flags |= SCAN_INDEX_F_LOCATED;
+}
+
+// Fetch an entry, including deleted ones (their segment number stays valid)
+static esp_err_t index_get_raw(uint16_t index, scan_index_entry_t *out)
+{
+    esp_err_t err = index_load_block(index / SCAN_INDEX_BLOCK);
     if (err != ESP_OK) return err;
-    err = get_u16_or_default("scan_head", &scan_head, 0);
+    *out = s_blk[index % SCAN_INDEX_BLOCK];
+    return ESP_OK;
+}
+
+static esp_err_t index_get(uint16_t index, scan_index_entry_t *out)
+{
+    scan_index_entry_t e;
+    esp_err_t err = index_get_raw(index, &e);
     if (err != ESP_OK) return err;
+    if (!(e.flags & SCAN_INDEX_F_VALID)) return ESP_ERR_NVS_NOT_FOUND;
+    if (out) *out = e;
+    return ESP_OK;
+}
 
-    // Evict oldest if at max capacity
-    uint16_t stored = scan_count - scan_head;
-    if (stored >= CONFIG_LOCATOR_MAX_STORED_SCANS) {
-        char key[7];
-        make_scan_key(scan_head, key);
-        nvs_erase_key(nvs_h, key);
-        make_loc_key(scan_head, key);
-        nvs_erase_key(nvs_h, key);  // also evict cached location
-        scan_head++;
-        err = nvs_set_u16(nvs_h, "scan_head", scan_head);
-        if (err != ESP_OK) return err;
-        ESP_LOGI(TAG, "Evicted oldest scan, head now %u", scan_head);
+// Write one entry (no commit — the caller commits with its own changes)
+static esp_err_t index_put(uint16_t index, const scan_index_entry_t *entry)
+{
+    // A pending scan's entry is only in RAM: checkpoint to store it
+    if ((uint16_t)(index - s_pend_first) < s_pend_n) {
+        s_pend[index - s_pend_first] = *entry;
+        if (s_blk_no == index / SCAN_INDEX_BLOCK) s_blk[index % SCAN_INDEX_BLOCK] = *entry;
+        return pend_checkpoint();
     }
+    esp_err_t err = index_load_block(index / SCAN_INDEX_BLOCK);
+    if (err != ESP_OK) return err;
+    s_blk[index % SCAN_INDEX_BLOCK] = *entry;
+    return index_store_block();
+}
 
-    // Build blob: header + AP records
-    size_t blob_size = sizeof(scan_header_t) + ap_count * sizeof(stored_ap_t);
-    uint8_t *blob = malloc(blob_size);
-    if (!blob) return ESP_ERR_NO_MEM;
+// --- Scan segments (packed multi-scan blobs) ---
+//
+// A segment is a header followed by variable-length scan records. Each BSSID
+// and SSID is written once per segment into a dictionary that later records
+// reference by 1-byte id, and each record is coded against the previous one,
+// so a scan from a stationary device shrinks to a few bytes.
+//
+// Record:
+//   varint   timestamp delta to the previous record (zigzag; first record: to 0)
+//   u8       number of new APs
+//   bitmap   (prev_count + 7) / 8 bytes: APs of the previous record that are kept
+//   nibbles  RSSI delta of each kept AP, two per byte; -8 escapes to an absolute
+//            RSSI byte following the nibbles
+//   new APs  BSSID id, or 0xFF + bssid[6], channel, authmode, SSID id
+//            (or 0xFF + len + bytes); then the absolute RSSI
+
+#define SCAN_SEGMENT_VERSION 2
+#define SEG_REF_NEW          0xFF
+#define SEG_DICT_MAX         255
+#define SEG_NIB_ESC          0x8
+
+typedef struct __attribute__((packed)) {
+    uint8_t  version;
+    uint16_t count;
+    uint16_t first_index;
+    uint16_t used;          // bytes in use, including this header
+} scan_segment_hdr_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t authmode;
+    uint8_t ssid;           // SSID dictionary id
+} seg_bss_t;
+
+// Cached segment plus decoder state (dictionaries and the last decoded record).
+// Sequential loads continue from the cursor instead of decoding from the start.
+typedef struct {
+    scan_segment_hdr_t hdr;
+    uint16_t  rec;          // records decoded so far
+    uint16_t  pos;          // offset of the next record
+    int64_t   timestamp;    // of the last decoded record
+    uint8_t   n_prev;       // APs of the last decoded record
+    uint8_t   prev_ref[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    int8_t    prev_rssi[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t   n_bss;
+    uint8_t   n_ssid;
+    seg_bss_t bss[SEG_DICT_MAX];
+    uint16_t  ssid_off[SEG_DICT_MAX];  // offset of the SSID length byte
+    uint8_t   buf[SCAN_SEGMENT_SIZE];
+} seg_cache_t;
+
+static seg_cache_t *s_seg = NULL;
+static int32_t s_seg_no = -1;
+
+typedef struct {
+    uint8_t *buf;
+    uint16_t pos;
+    uint16_t end;
+    bool     overflow;
+} seg_cursor_t;
+
+static uint8_t get_u8(seg_cursor_t *r)
+{
+    if (r->pos >= r->end) {
+        r->overflow = true;
+        return 0;
+    }
+    return r->buf[r->pos++];
+}
+
+static uint64_t get_varint(seg_cursor_t *r)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = get_u8(r);
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    r->overflow = true;
+    return 0;
+}
+
+static void put_u8(seg_cursor_t *w, uint8_t v)
+{
+    if (w->pos >= w->end) {
+        w->overflow = true;
+        return;
+    }
+    w->buf[w->pos++] = v;
+}
+
+static void put_bytes(seg_cursor_t *w, const void *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) put_u8(w, ((const uint8_t *)data)[i]);
+}
+
+static void put_varint(seg_cursor_t *w, uint64_t v)
+{
+    while (v >= 0x80) {
+        put_u8(w, (v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    put_u8(w, (uint8_t)v);
+}
+
+static void make_seg_key(uint16_t segment, char *key)
+{
+    snprintf(key, 7, "g%05u", segment);
+}
 
-    scan_header_t *hdr = (scan_header_t *)blob;
-    hdr->scan_index = scan_count;
-    hdr->ap_count = ap_count;
-    hdr->timestamp = timestamp;
-    memcpy(blob + sizeof(scan_header_t), aps, ap_count * sizeof(stored_ap_t));
+static void seg_rewind(void)
+{
+    s_seg->rec = 0;
+    s_seg->pos = sizeof(scan_segment_hdr_t);
+    s_seg->timestamp = 0;
+    s_seg->n_prev = 0;
+    s_seg->n_bss = 0;
+    s_seg->n_ssid = 0;
+}
+
+// Make the cache an empty segment starting at first_index
+static void seg_new(uint16_t segment, uint16_t first_index)
+{
+    s_seg->hdr = (scan_segment_hdr_t) {
+        .version = SCAN_SEGMENT_VERSION,
+        .count = 0,
+        .first_index = first_index,
+        .used = sizeof(scan_segment_hdr_t),
+    };
+    memcpy(s_seg->buf, &s_seg->hdr, sizeof(s_seg->hdr));
+    seg_rewind();
+    s_seg_no = segment;
+}
+
+// Load a segment into s_seg. A missing segment is returned empty, starting at first_index.
+static esp_err_t seg_load(uint16_t segment, uint16_t first_index)
+{
+    if (s_seg_no == segment) return ESP_OK;
+    if (!s_seg) {
+        s_seg = malloc(sizeof(seg_cache_t));
+        if (!s_seg) return ESP_ERR_NO_MEM;
+    }
+    s_seg_no = -1;
 
     char key[7];
-    make_scan_key(scan_count, key);
-    err = nvs_set_blob(nvs_h, key, blob, blob_size);
-    free(blob);
+    make_seg_key(segment, key);
+    size_t size = SCAN_SEGMENT_SIZE;
+    esp_err_t err = nvs_get_blob(nvs_h, key, s_seg->buf, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        seg_new(segment, first_index);
+    } else if (err != ESP_OK) {
+        return err;
+    } else {
+        if (size < sizeof(scan_segment_hdr_t)) return ESP_ERR_INVALID_SIZE;
+        memcpy(&s_seg->hdr, s_seg->buf, sizeof(s_seg->hdr));
+        if (s_seg->hdr.used > size) return ESP_ERR_INVALID_SIZE;
+        seg_rewind();
+        s_seg_no = segment;
+    }
+
+    if (segment == s_pend_seg) return pend_replay();
+    return ESP_OK;
+}
+
+static esp_err_t seg_store(void)
+{
+    memcpy(s_seg->buf, &s_seg->hdr, sizeof(s_seg->hdr));
+    char key[7];
+    make_seg_key((uint16_t)s_seg_no, key);
+    return nvs_set_blob(nvs_h, key, s_seg->buf, s_seg->hdr.used);
+}
+
+static void seg_erase(uint16_t segment)
+{
+    char key[7];
+    make_seg_key(segment, key);
+    nvs_erase_key(nvs_h, key);
+    if (s_seg_no == segment) s_seg_no = -1;
+}
+
+// Decode the record at the cursor into prev_ref/prev_rssi. On a corrupt record
+// the cache is dropped, so the next access reloads the segment.
+static esp_err_t seg_decode_next(void)
+{
+    seg_cache_t *c = s_seg;
+    if (c->rec >= c->hdr.count) return ESP_ERR_NVS_NOT_FOUND;
+
+    seg_cursor_t r = { .buf = c->buf, .pos = c->pos, .end = c->hdr.used };
+    uint64_t zz = get_varint(&r);
+    int64_t delta = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+    uint8_t n_new = get_u8(&r);
+
+    uint8_t ref[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    int8_t rssi[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t from[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n = 0;
+
+    // Kept APs, in the order of the previous record
+    uint16_t bitmap = r.pos;
+    r.pos += (c->n_prev + 7) / 8;
+    if (r.pos > r.end) goto corrupt;
+    for (uint8_t j = 0; j < c->n_prev; j++) {
+        if (c->buf[bitmap + j / 8] & (1 << (j % 8))) {
+            from[n] = j;
+            ref[n++] = c->prev_ref[j];
+        }
+    }
+
+    uint16_t nibbles = r.pos;
+    r.pos += (n + 1) / 2;
+    if (r.pos > r.end) goto corrupt;
+    for (uint8_t k = 0; k < n; k++) {
+        uint8_t nib = (c->buf[nibbles + k / 2] >> (4 * (k % 2))) & 0x0F;
+        if (nib == SEG_NIB_ESC) {
+            rssi[k] = (int8_t)get_u8(&r);
+        } else {
+            rssi[k] = c->prev_rssi[from[k]] + (int8_t)((nib ^ 0x08) - 0x08);
+        }
+    }
+
+    // New APs, adding dictionary entries on first use
+    if (n + n_new > CONFIG_LOCATOR_MAX_APS_PER_SCAN) goto corrupt;
+    for (uint8_t i = 0; i < n_new; i++) {
+        uint8_t b = get_u8(&r);
+        if (b == SEG_REF_NEW) {
+            if (c->n_bss >= SEG_DICT_MAX) goto corrupt;
+            seg_bss_t *e = &c->bss[c->n_bss];
+            for (int k = 0; k < 6; k++) e->bssid[k] = get_u8(&r);
+            e->channel = get_u8(&r);
+            e->authmode = get_u8(&r);
+            uint8_t s = get_u8(&r);
+            if (s == SEG_REF_NEW) {
+                if (c->n_ssid >= SEG_DICT_MAX) goto corrupt;
+                c->ssid_off[c->n_ssid] = r.pos;
+                uint8_t len = get_u8(&r);
+                if (len > 32) goto corrupt;
+                r.pos += len;
+                s = c->n_ssid++;
+            } else if (s >= c->n_ssid) {
+                goto corrupt;
+            }
+            e->ssid = s;
+            b = c->n_bss++;
+        } else if (b >= c->n_bss) {
+            goto corrupt;
+        }
+        ref[n] = b;
+        rssi[n++] = (int8_t)get_u8(&r);
+    }
+    if (r.overflow || r.pos > r.end) goto corrupt;
+
+    c->pos = r.pos;
+    c->rec++;
+    c->timestamp += delta;
+    c->n_prev = n;
+    memcpy(c->prev_ref, ref, n);
+    memcpy(c->prev_rssi, rssi, n);
+    return ESP_OK;
+
+corrupt:
+    ESP_LOGE(TAG, "Corrupt record %u in segment %ld", c->rec, (long)s_seg_no);
+    s_seg_no = -1;
+    return ESP_ERR_INVALID_SIZE;
+}
+
+// Position the decoder on record `index` of the cached segment
+static esp_err_t seg_seek(uint16_t index)
+{
+    seg_cache_t *c = s_seg;
+    if (c->hdr.version != SCAN_SEGMENT_VERSION) return ESP_ERR_INVALID_VERSION;
+    if (index < c->hdr.first_index || index >= c->hdr.first_index + c->hdr.count) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    uint16_t rec = index - c->hdr.first_index;
+    if (rec < c->rec) {
+        if (rec + 1 == c->rec) return ESP_OK;  // already decoded
+        seg_rewind();
+    }
+    while (c->rec <= rec) {
+        esp_err_t err = seg_decode_next();
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
+}
+
+// Expand the record at the cursor into stored_ap_t, strongest first
+static uint8_t seg_get_aps(stored_ap_t *aps, uint8_t max_aps)
+{
+    seg_cache_t *c = s_seg;
+    uint8_t order[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    for (uint8_t k = 0; k < c->n_prev; k++) {
+        uint8_t j = k;
+        while (j > 0 && c->prev_rssi[order[j - 1]] < c->prev_rssi[k]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = k;
+    }
+
+    uint8_t n = c->n_prev < max_aps ? c->n_prev : max_aps;
+    for (uint8_t i = 0; i < n; i++) {
+        uint8_t k = order[i];
+        const seg_bss_t *e = &c->bss[c->prev_ref[k]];
+        const uint8_t *ssid = &c->buf[c->ssid_off[e->ssid]];
+        stored_ap_t *ap = &aps[i];
+        memset(ap, 0, sizeof(*ap));
+        memcpy(ap->bssid, e->bssid, 6);
+        ap->rssi = c->prev_rssi[k];
+        ap->channel = e->channel;
+        ap->authmode = e->authmode;
+        ap->ssid_len = ssid[0];
+        memcpy(ap->ssid, ssid + 1, ssid[0]);
+    }
+    return n;
+}
+
+static int seg_find_bss(const uint8_t *bssid)
+{
+    for (int i = 0; i < s_seg->n_bss; i++) {
+        if (memcmp(s_seg->bss[i].bssid, bssid, 6) == 0) return i;
+    }
+    return -1;
+}
+
+static int seg_find_ssid(const char *ssid, uint8_t len)
+{
+    for (int i = 0; i < s_seg->n_ssid; i++) {
+        const uint8_t *s = &s_seg->buf[s_seg->ssid_off[i]];
+        if (s[0] == len && memcmp(s + 1, ssid, len) == 0) return i;
+    }
+    return -1;
+}
+
+// Append a record to the cached segment. Returns false if the segment or one
+// of its dictionaries is full (or the segment is unreadable) — start a new one.
+static bool seg_append(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp)
+{
+    seg_cache_t *c = s_seg;
+    if (c->hdr.version != SCAN_SEGMENT_VERSION || c->hdr.count == UINT16_MAX) return false;
+
+    // Bring the decoder to the end: the new record is coded against the last one
+    while (c->rec < c->hdr.count) {
+        if (seg_decode_next() != ESP_OK) return false;
+    }
+
+    // Split into APs kept from the previous record and new ones (duplicates dropped)
+    bool kept[CONFIG_LOCATOR_MAX_APS_PER_SCAN] = {0};
+    int8_t kept_rssi[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t new_ap[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    int new_ref[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n_kept = 0, n_new = 0;
+
+    for (uint8_t i = 0; i < ap_count; i++) {
+        bool dup = false;
+        for (uint8_t k = 0; k < i && !dup; k++) {
+            dup = memcmp(aps[k].bssid, aps[i].bssid, 6) == 0;
+        }
+        if (dup) continue;
+
+        int ref = seg_find_bss(aps[i].bssid);
+        uint8_t j = 0;
+        while (ref >= 0 && j < c->n_prev && c->prev_ref[j] != ref) j++;
+        if (ref >= 0 && j < c->n_prev) {
+            kept[j] = true;
+            kept_rssi[j] = aps[i].rssi;
+            n_kept++;
+        } else {
+            new_ref[n_new] = ref;
+            new_ap[n_new++] = i;
+        }
+    }
+
+    uint8_t n_bss = c->n_bss, n_ssid = c->n_ssid;
+    seg_cursor_t w = { .buf = c->buf, .pos = c->hdr.used, .end = SCAN_SEGMENT_SIZE };
+    int64_t delta = timestamp - c->timestamp;
+    put_varint(&w, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    put_u8(&w, n_new);
+
+    for (uint8_t b = 0; b < (c->n_prev + 7) / 8; b++) {
+        uint8_t bits = 0;
+        for (uint8_t j = b * 8; j < c->n_prev && j < b * 8 + 8; j++) {
+            if (kept[j]) bits |= 1 << (j % 8);
+        }
+        put_u8(&w, bits);
+    }
+
+    uint8_t nib_byte = 0, k = 0;
+    int8_t esc[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n_esc = 0;
+    for (uint8_t j = 0; j < c->n_prev; j++) {
+        if (!kept[j]) continue;
+        int d = kept_rssi[j] - c->prev_rssi[j];
+        uint8_t nib = SEG_NIB_ESC;
+        if (d >= -7 && d <= 7) {
+            nib = d & 0x0F;
+        } else {
+            esc[n_esc++] = kept_rssi[j];
+        }
+        nib_byte |= nib << (4 * (k % 2));
+        if (++k % 2 == 0) {
+            put_u8(&w, nib_byte);
+            nib_byte = 0;
+        }
+    }
+    if (k % 2) put_u8(&w, nib_byte);
+    put_bytes(&w, esc, n_esc);
+
+    bool full = false;
+    for (uint8_t i = 0; i < n_new; i++) {
+        const stored_ap_t *ap = &aps[new_ap[i]];
+        if (new_ref[i] >= 0) {
+            put_u8(&w, (uint8_t)new_ref[i]);
+        } else {
+            if (c->n_bss >= SEG_DICT_MAX) {
+                full = true;
+                break;
+            }
+            put_u8(&w, SEG_REF_NEW);
+            put_bytes(&w, ap->bssid, 6);
+            put_u8(&w, ap->channel);
+            put_u8(&w, ap->authmode);
+            uint8_t len = ap->ssid_len > 32 ? 32 : ap->ssid_len;
+            int s = seg_find_ssid(ap->ssid, len);
+            if (s >= 0) {
+                put_u8(&w, (uint8_t)s);
+            } else if (c->n_ssid >= SEG_DICT_MAX) {
+                full = true;
+                break;
+            } else {
+                put_u8(&w, SEG_REF_NEW);
+                uint16_t off = w.pos;
+                put_u8(&w, len);
+                put_bytes(&w, ap->ssid, len);
+                if (w.overflow) break;
+                // Registered now so later APs in this record can reference it
+                c->ssid_off[c->n_ssid++] = off;
+            }
+            c->n_bss++;
+        }
+        put_u8(&w, (uint8_t)ap->rssi);
+    }
+
+    // Dictionary entries are re-added by decoding the record just written
+    c->n_bss = n_bss;
+    c->n_ssid = n_ssid;
+    if (full || w.overflow) return false;
+
+    uint16_t used = c->hdr.used;
+    c->hdr.used = w.pos;
+    c->hdr.count++;
+    if (seg_decode_next() != ESP_OK) {
+        c->hdr.used = used;
+        c->hdr.count--;
+        return false;
+    }
+    return true;
+}
+
+// --- Pending scans ---
+//
+// Rewriting the open segment and its index block on every save would cost
+// ~3 KB of NVS writes per scan. A save writes only the new record and
+// scan_count; the segment and the index blocks of the pending scans follow
+// in a checkpoint every SCAN_PENDING_MAX scans, when the segment is sealed,
+// and before a pending scan's index entry changes (delete, location).
+//
+// A checkpoint stores the segment first, then the index blocks, erases the
+// records and moves seg_ckpt. After a power cut at any point, loading the
+// open segment appends only the records it doesn't already hold.
+
+static void make_pend_key(uint16_t index, char *key)
+{
+    snprintf(key, 7, "p%05u", index);
+}
+
+// Bring the cached open segment up to scan_count: append the records of
+// pending scans it lacks, or cut records that a save interrupted before
+// updating scan_count left behind.
+static esp_err_t pend_replay(void)
+{
+    seg_cache_t *c = s_seg;
+    uint16_t end = s_pend_first + s_pend_n;
+    uint16_t have = c->hdr.first_index + c->hdr.count;
+
+    if (have > end && end >= c->hdr.first_index) {
+        while (c->rec < end - c->hdr.first_index) {
+            esp_err_t err = seg_decode_next();
+            if (err != ESP_OK) return err;
+        }
+        ESP_LOGW(TAG, "Dropping %u unsaved records from segment %ld", have - end, (long)s_seg_no);
+        c->hdr.count = end - c->hdr.first_index;
+        c->hdr.used = c->pos;
+        seg_rewind();
+        return ESP_OK;
+    }
+    if (have < s_pend_first || have > end) {
+        ESP_LOGE(TAG, "Segment %ld ends at scan %u, expected %u..%u",
+                 (long)s_seg_no, have, s_pend_first, end);
+        s_seg_no = -1;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (uint16_t i = have; i < end; i++) {
+        char key[7];
+        make_pend_key(i, key);
+        size_t len = SCAN_SEGMENT_SIZE - c->hdr.used;
+        esp_err_t err = nvs_get_blob(nvs_h, key, c->buf + c->hdr.used, &len);
+        if (err != ESP_OK) {
+            s_seg_no = -1;
+            return err;
+        }
+        c->hdr.used += len;
+        c->hdr.count++;
+    }
+    return ESP_OK;
+}
+
+// Write the open segment and the pending scans' index blocks (no commit)
+static esp_err_t pend_checkpoint(void)
+{
+    if (s_pend_n == 0) return ESP_OK;
+    uint16_t end = s_pend_first + s_pend_n;
+
+    esp_err_t err = seg_load((uint16_t)s_pend_seg, s_pend_first);
+    if (err == ESP_OK) err = seg_store();
+    for (uint16_t b = s_pend_first / SCAN_INDEX_BLOCK;
+         err == ESP_OK && b <= (end - 1) / SCAN_INDEX_BLOCK; b++) {
+        err = index_load_block(b);
+        if (err == ESP_OK) err = index_store_block();
+    }
     if (err != ESP_OK) return err;
 
-    // Update scan_count
-    scan_count++;
-    err = nvs_set_u16(nvs_h, "scan_count", scan_count);
+    for (uint16_t i = s_pend_first; i < end; i++) {
+        char key[7];
+        make_pend_key(i, key);
+        nvs_erase_key(nvs_h, key);
+    }
+    err = nvs_set_u16(nvs_h, "seg_ckpt", end);
     if (err != ESP_OK) return err;
+    s_pend_first = end;
+    s_pend_n = 0;
+    return ESP_OK;
+}
 
-    err = nvs_commit(nvs_h);
+// Pick up pending scans at boot; their index entries are rebuilt from the
+// records, which a pending scan's entry is always derived from alone
+static esp_err_t pend_init(void)
+{
+    uint16_t count, ckpt, seg_tail;
+    esp_err_t err = get_u16_or_default("scan_count", &count, 0);
+    if (err != ESP_OK) return err;
+    // Stores from before pending scans have everything checkpointed; the key
+    // is written so scans saved from now on count as pending
+    err = nvs_get_u16(nvs_h, "seg_ckpt", &ckpt);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ckpt = count;
+        err = nvs_set_u16(nvs_h, "seg_ckpt", ckpt);
+        if (err == ESP_OK) err = nvs_commit(nvs_h);
+    }
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_tail", &seg_tail, 0);
     if (err != ESP_OK) return err;
 
-    if (out_index) *out_index = scan_count - 1;
-    ESP_LOGI(TAG, "Saved scan %u with %u APs (%u bytes)", scan_count - 1, ap_count, (unsigned)blob_size);
+    s_pend_seg = seg_tail;
+    s_pend_first = ckpt;
+    s_pend_n = 0;
+    if ((uint16_t)(count - ckpt) > SCAN_PENDING_MAX) {
+        ESP_LOGE(TAG, "Bad checkpoint %u for %u scans", ckpt, count);
+        s_pend_first = count;
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pend_n = count - ckpt;
+    if (s_pend_n == 0) return ESP_OK;
+
+    stored_ap_t *aps = malloc(CONFIG_LOCATOR_MAX_APS_PER_SCAN * sizeof(stored_ap_t));
+    if (!aps) return ESP_ERR_NO_MEM;
+    err = seg_load(seg_tail, ckpt);
+    for (uint8_t k = 0; k < s_pend_n && err == ESP_OK; k++) {
+        err = seg_seek(ckpt + k);
+        if (err != ESP_OK) break;
+        uint8_t ap_count = seg_get_aps(aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN);
+        index_fill_entry(&s_pend[k], aps, ap_count, s_seg->timestamp, seg_tail);
+    }
+    free(aps);
+    if (err != ESP_OK) memset(s_pend, 0, sizeof(s_pend));  // listed as missing, not wrong
+    return err;
+}
+
+// Drop segments [seg_head, new_seg_head) and move scan_head past their scans
+static esp_err_t evict_segments(uint16_t *seg_head, uint16_t new_seg_head,
+                                uint16_t *scan_head, uint16_t new_scan_head)
+{
+    uint16_t old_seg_head = *seg_head, old_scan_head = *scan_head;
+    if (new_scan_head > *scan_head) *scan_head = new_scan_head;
+    *seg_head = new_seg_head;
+
+    // Heads first, so a power cut before the erases only leaves unused keys;
+    // scan_head before seg_head, which may lag behind but never lead
+    esp_err_t err = nvs_set_u16(nvs_h, "scan_head", *scan_head);
+    if (err != ESP_OK) return err;
+    err = nvs_set_u16(nvs_h, "seg_head", *seg_head);
+    if (err != ESP_OK) return err;
+
+    for (uint16_t g = old_seg_head; g < new_seg_head; g++) {
+        seg_erase(g);
+    }
+    index_erase_below(old_scan_head, *scan_head);
+    ESP_LOGI(TAG, "Evicted segments, head now seg %u / scan %u", *seg_head, *scan_head);
     return ESP_OK;
 }
 
-esp_err_t scan_store_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count)
+// A power cut between moving the heads and the erases leaves keys below the
+// heads. One eviction spans at most the segment ring, so look that far back;
+// erasing a missing key costs no flash writes.
+static void evict_sweep(void)
 {
-    char key[7];
-    make_scan_key(index, key);
+    uint16_t seg_head, scan_head;
+    if (get_u16_or_default("seg_head", &seg_head, 0) != ESP_OK) return;
+    if (get_u16_or_default("scan_head", &scan_head, 0) != ESP_OK) return;
+
+    for (uint16_t k = 1; k <= CONFIG_LOCATOR_SCAN_SEGMENTS; k++) {
+        seg_erase(seg_head - k);
+    }
+    uint16_t from = scan_head > CONFIG_LOCATOR_MAX_STORED_SCANS + SCAN_INDEX_BLOCK
+                  ? scan_head - CONFIG_LOCATOR_MAX_STORED_SCANS - SCAN_INDEX_BLOCK : 0;
+    index_erase_below(from, scan_head);
+}
+
+static esp_err_t store_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_save(aps, ap_count, timestamp, out_index);
+#endif
+    uint16_t scan_count, scan_head, seg_head, seg_tail;
+    esp_err_t err;
 
-    // First get the blob size
-    size_t blob_size = 0;
-    esp_err_t err = nvs_get_blob(nvs_h, key, NULL, &blob_size);
+    err = get_u16_or_default("scan_count", &scan_count, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("scan_head", &scan_head, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_head", &seg_head, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_tail", &seg_tail, 0);
     if (err != ESP_OK) return err;
 
-    uint8_t *blob = malloc(blob_size);
-    if (!blob) return ESP_ERR_NO_MEM;
+    if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+
+    if (s_pend_n == SCAN_PENDING_MAX) {
+        err = pend_checkpoint();
+        if (err != ESP_OK) return err;
+    }
+
+    // Append to the open segment; seal it and open the next one when full
+    err = seg_load(seg_tail, scan_count);
+    if (err != ESP_OK) return err;
+    uint16_t rec_off = s_seg->hdr.used;
+    if (!seg_append(aps, ap_count, timestamp)) {
+        err = pend_checkpoint();
+        if (err != ESP_OK) return err;
+        seg_tail++;
+        err = nvs_set_u16(nvs_h, "seg_tail", seg_tail);
+        if (err != ESP_OK) return err;
+        s_pend_seg = seg_tail;
+
+        // Segment ring full: drop the oldest segment with all of its scans
+        if (seg_tail - seg_head >= CONFIG_LOCATOR_SCAN_SEGMENTS) {
+            err = seg_load(seg_head + 1, scan_count);
+            if (err != ESP_OK) return err;
+            err = evict_segments(&seg_head, seg_head + 1, &scan_head, s_seg->hdr.first_index);
+            if (err != ESP_OK) return err;
+        }
+
+        // Stored empty, so loads before the first checkpoint know its first
+        // index; replaces any blob an interrupted eviction left under this key
+        seg_new(seg_tail, scan_count);
+        err = seg_store();
+        if (err != ESP_OK) return err;
+        rec_off = s_seg->hdr.used;
+        if (!seg_append(aps, ap_count, timestamp)) {
+            ESP_LOGE(TAG, "Scan doesn't fit an empty segment");
+            return ESP_FAIL;
+        }
+    }
+
+    // Evict the oldest scan if the new one goes over the count limit; free
+    // its segment once empty. Done first so a cut never leaves too many.
+    if (scan_count + 1 - scan_head > CONFIG_LOCATOR_MAX_STORED_SCANS) {
+        uint16_t new_head = scan_count + 1 - CONFIG_LOCATOR_MAX_STORED_SCANS;
+        scan_index_entry_t head_entry;
+        err = index_get_raw(new_head, &head_entry);
+        if (err == ESP_OK) err = evict_segments(&seg_head, head_entry.segment, &scan_head, new_head);
+        if (err != ESP_OK) {
+            s_seg_no = -1;
+            return err;
+        }
+    }
 
-    err = nvs_get_blob(nvs_h, key, blob, &blob_size);
+    // Only the new record is written now; the cached segment drops it again
+    // if the save doesn't complete
+    char key[7];
+    make_pend_key(scan_count, key);
+    err = nvs_set_blob(nvs_h, key, s_seg->buf + rec_off, s_seg->hdr.used - rec_off);
+    if (err == ESP_OK) err = nvs_set_u16(nvs_h, "scan_count", scan_count + 1);
     if (err != ESP_OK) {
-        free(blob);
+        s_seg_no = -1;
         return err;
     }
 
-    scan_header_t *hdr = (scan_header_t *)blob;
-    uint8_t ap_count = hdr->ap_count;
-    if (ap_count > max_aps) ap_count = max_aps;
+    scan_index_entry_t entry;
+    index_fill_entry(&entry, aps, ap_count, timestamp, seg_tail);
+    s_pend[s_pend_n++] = entry;
+    if (s_blk_no == scan_count / SCAN_INDEX_BLOCK) s_blk[scan_count % SCAN_INDEX_BLOCK] = entry;
+    scan_count++;
+
+    err = nvs_commit(nvs_h);
+    if (err != ESP_OK) return err;
+
+    if (out_index) *out_index = scan_count - 1;
+    ESP_LOGI(TAG, "Saved scan %u with %u APs to segment %u", scan_count - 1, ap_count, seg_tail);
+    return ESP_OK;
+}
+
+static esp_err_t store_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_load(index, aps, max_aps, out_ap_count, NULL);
+#endif
+    scan_index_entry_t entry;
+    esp_err_t err = index_get(index, &entry);
+    if (err != ESP_OK) return err;
+
+    err = seg_load(entry.segment, index);
+    if (err != ESP_OK) return err;
+
+    err = seg_seek(index);
+    if (err != ESP_OK) return err;
+
+    *out_ap_count = seg_get_aps(aps, max_aps);
+    return ESP_OK;
+}
+
+static esp_err_t store_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_load(index, NULL, 0, out_ap_count, out_timestamp);
+#endif
+    scan_index_entry_t entry;
+    esp_err_t err = index_get(index, &entry);
+    if (err != ESP_OK) return err;
+    if (out_ap_count) *out_ap_count = entry.ap_count;
+    if (out_timestamp) *out_timestamp = entry.timestamp;
+    return ESP_OK;
+}
+
+#ifdef CONFIG_LOCATOR_SCANLOG
+typedef struct {
+    scan_header_cb_t cb;
+    void *ctx;
+} log_iter_ctx_t;
+
+// Build index entries on the fly for scans from the log
+static bool log_iter_cb(uint16_t index, const stored_ap_t *aps, uint8_t ap_count,
+                        int64_t timestamp, const scan_location_t *loc, void *arg)
+{
+    log_iter_ctx_t *lc = arg;
+    scan_index_entry_t entry;
+    index_fill_entry(&entry, aps, ap_count, timestamp, 0);
+    if (loc) index_set_location(&entry, loc->lat, loc->lng, loc->accuracy);
+    return lc->cb(index, &entry, lc->ctx);
+}
+#endif
+
+static esp_err_t store_iterate_headers(uint16_t from, scan_header_cb_t cb, void *ctx)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) {
+        log_iter_ctx_t lc = { .cb = cb, .ctx = ctx };
+        return scan_log_iterate(from, log_iter_cb, &lc);
+    }
+#endif
+    uint16_t head, count;
+    esp_err_t err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+    if (from > head) head = from;
+    if (count <= head) return ESP_OK;
+
+    // Private block buffer: the callback may call back into scan_store
+    scan_index_entry_t *blk = malloc(SCAN_INDEX_BLOCK * sizeof(scan_index_entry_t));
+    if (!blk) return ESP_ERR_NO_MEM;
+
+    for (uint16_t i = head; i < count; i++) {
+        if (i == head || i % SCAN_INDEX_BLOCK == 0) {
+            err = index_read_block(i / SCAN_INDEX_BLOCK, blk);
+            if (err != ESP_OK) break;
+        }
+        const scan_index_entry_t *e = &blk[i % SCAN_INDEX_BLOCK];
+        if (!(e->flags & SCAN_INDEX_F_VALID)) continue;
+        if (!cb(i, e, ctx)) break;
+    }
+
+    free(blk);
+    return err;
+}
+
+static bool digest_in(const scan_index_entry_t *e, uint16_t hash)
+{
+    for (uint8_t i = 0; i < e->ap_count; i++) {
+        if (e->bssid_hash[i] == hash) return true;
+    }
+    return false;
+}
+
+int scan_store_digest_diff(const scan_index_entry_t *a, const scan_index_entry_t *b)
+{
+    int diffs = 0;
+    // Hashes in b not in a
+    for (uint8_t i = 0; i < b->ap_count; i++) {
+        if (!digest_in(a, b->bssid_hash[i])) diffs++;
+    }
+    // Hashes in a not in b
+    for (uint8_t i = 0; i < a->ap_count; i++) {
+        if (!digest_in(b, a->bssid_hash[i])) diffs++;
+    }
+    return diffs;
+}
+
+// Where an index entry of an older layout keeps the fields index_rebuild()
+// carries over. From version 2 on, flags sit at byte 9 and lat_e6, lng_e6 and
+// accuracy come right before the 2-byte segment number at the end.
+static bool index_old_layout(uint16_t layout, size_t *entry_size, size_t *loc_off)
+{
+    *entry_size = layout & 0xFF;
+    if ((layout >> 8) < 2 || *entry_size < 22) return false;
+    *loc_off = *entry_size - 12;
+    return true;
+}
+
+// Recreate the index by walking the segments — only used when the index layout
+// changes. Cached locations and deletions live only in the index, so they are
+// read from the old blocks (laid out as old_layout) before those are replaced.
+static esp_err_t index_rebuild(uint16_t old_layout)
+{
+    uint16_t head, count, seg_head, seg_tail;
+    esp_err_t err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_head", &seg_head, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_tail", &seg_tail, 0);
+    if (err != ESP_OK) return err;
+
+    size_t old_size = 0, loc_off = 0;
+    bool carry = index_old_layout(old_layout, &old_size, &loc_off);
+    ESP_LOGW(TAG, "Rebuilding scan index for scans %u..%u (layout %04x -> %04x%s)", head, count,
+             old_layout, (unsigned)SCAN_INDEX_LAYOUT, carry ? "" : ", cached locations dropped");
+    s_blk_no = -1;
+
+    stored_ap_t *aps = malloc(CONFIG_LOCATOR_MAX_APS_PER_SCAN * sizeof(stored_ap_t));
+    uint8_t *old = carry ? malloc(SCAN_INDEX_BLOCK * old_size) : NULL;
+    if (!aps || (carry && !old)) {
+        free(aps);
+        free(old);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Old blocks are read, then erased, in index order just before the first
+    // entry of their range is written in the new layout
+    uint16_t first_block = head / SCAN_INDEX_BLOCK;
+    uint16_t end_block = count ? (count - 1) / SCAN_INDEX_BLOCK + 1 : first_block;
+    uint16_t next_block = first_block;
+    bool have_old = false;
+
+    for (uint16_t g = seg_head; g <= seg_tail && err == ESP_OK; g++) {
+        if (seg_load(g, count) != ESP_OK) continue;
+        uint16_t first = s_seg->hdr.first_index, n = s_seg->hdr.count;
+
+        for (uint16_t i = first; i < first + n; i++) {
+            if (i < head || i >= count) continue;
+            // Pending entries come from their records alone and are in s_pend
+            if ((uint16_t)(i - s_pend_first) < s_pend_n) continue;
+            uint16_t b = i / SCAN_INDEX_BLOCK;
+            if (b >= next_block) {
+                for (; next_block < b; next_block++) index_erase_block(next_block);
+                have_old = false;
+                if (carry) {
+                    char key[7];
+                    make_index_key(b, key);
+                    size_t size = SCAN_INDEX_BLOCK * old_size;
+                    have_old = nvs_get_blob(nvs_h, key, old, &size) == ESP_OK &&
+                               size == SCAN_INDEX_BLOCK * old_size;
+                }
+                index_erase_block(b);
+                next_block = b + 1;
+            }
+            if (seg_seek(i) != ESP_OK) break;
+            uint8_t ap_count = seg_get_aps(aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN);
+
+            scan_index_entry_t entry;
+            index_fill_entry(&entry, aps, ap_count, s_seg->timestamp, g);
+            if (have_old) {
+                const uint8_t *o = old + (i % SCAN_INDEX_BLOCK) * old_size;
+                int64_t timestamp;
+                memcpy(&timestamp, o, sizeof(timestamp));
+                uint8_t flags = o[9];
+                if (timestamp != 0 && !(flags & SCAN_INDEX_F_VALID)) {
+                    entry.flags = 0;  // Deleted
+                } else if (flags & SCAN_INDEX_F_LOCATED) {
+                    memcpy(&entry.lat_e6, o + loc_off, sizeof(entry.lat_e6));
+                    memcpy(&entry.lng_e6, o + loc_off + 4, sizeof(entry.lng_e6));
+                    memcpy(&entry.accuracy, o + loc_off + 8, sizeof(entry.accuracy));
+                    entry.flags |= SCAN_INDEX_F_LOCATED;
+                }
+            }
+            err = index_put(i, &entry);
+            if (err != ESP_OK) break;
+        }
+    }
+    free(aps);
+    free(old);
+    if (err != ESP_OK) return err;
+    // Blocks left in the old layout hold no scan with data any more
+    for (; next_block < end_block; next_block++) index_erase_block(next_block);
+
+    err = nvs_set_u16(nvs_h, "ix_layout", SCAN_INDEX_LAYOUT);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+// Convert the old one-blob-per-scan layout (sNNNNN + lNNNNN) into segments.
+// Each sNNNNN blob is an 11-byte header followed by ap_count raw stored_ap_t.
+typedef struct __attribute__((packed)) {
+    uint16_t scan_index;
+    uint8_t  ap_count;
+    int64_t  timestamp;
+} legacy_header_t;
+
+static size_t legacy_size(uint8_t ap_count)
+{
+    return sizeof(legacy_header_t) + ap_count * sizeof(stored_ap_t);
+}
+
+static esp_err_t migrate_legacy_scans(void)
+{
+    uint16_t head, count;
+    esp_err_t err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+
+    if (count > head) {
+        ESP_LOGI(TAG, "Migrating scans %u..%u to segment storage", head, count);
+    }
+
+    uint16_t seg = 0;
+    s_blk_no = -1;
+    s_seg_no = -1;
+    uint8_t *blob = malloc(legacy_size(UINT8_MAX));
+    if (!blob) return ESP_ERR_NO_MEM;
+
+    for (uint16_t i = head; i < count; i++) {
+        char key[7];
+        snprintf(key, sizeof(key), "s%05u", i);
+        size_t size = legacy_size(UINT8_MAX);
+        if (nvs_get_blob(nvs_h, key, blob, &size) != ESP_OK || size < sizeof(legacy_header_t)) {
+            continue;
+        }
+
+        legacy_header_t sh;
+        memcpy(&sh, blob, sizeof(sh));
+        uint8_t ap_count = sh.ap_count;
+        if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+        if (size < legacy_size(ap_count)) continue;
+        const stored_ap_t *aps = (const stored_ap_t *)(blob + sizeof(sh));
+
+        // Records in a segment must be consecutive: gaps (deleted scans) and
+        // full segments both start a new one.
+        err = seg_load(seg, i);
+        if (err != ESP_OK) break;
+        uint16_t seg_count = s_seg->hdr.count;
+        if (s_seg->hdr.first_index + seg_count != i || !seg_append(aps, ap_count, sh.timestamp)) {
+            if (seg_count > 0) {
+                err = seg_store();
+                if (err != ESP_OK) break;
+                seg++;
+            }
+            s_seg_no = -1;
+            err = seg_load(seg, i);
+            if (err != ESP_OK) break;
+            seg_append(aps, ap_count, sh.timestamp);
+        }
+
+        scan_index_entry_t entry;
+        index_fill_entry(&entry, aps, ap_count, sh.timestamp, seg);
+        scan_location_t loc;
+        size_t loc_size = sizeof(loc);
+        snprintf(key, sizeof(key), "l%05u", i);
+        if (nvs_get_blob(nvs_h, key, &loc, &loc_size) == ESP_OK) {
+            index_set_location(&entry, loc.lat, loc.lng, loc.accuracy);
+        }
+        err = index_put(i, &entry);
+        if (err != ESP_OK) break;
+    }
+    free(blob);
+
+    if (err == ESP_OK && s_seg_no == seg) err = seg_store();
+    if (err == ESP_OK) err = nvs_set_u16(nvs_h, "seg_head", 0);
+    if (err == ESP_OK) err = nvs_set_u16(nvs_h, "seg_tail", seg);
+    if (err == ESP_OK) err = nvs_set_u16(nvs_h, "ix_layout", SCAN_INDEX_LAYOUT);
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) return err;
+
+    // Segments are committed; now the old blobs can go
+    for (uint16_t i = head; i < count; i++) {
+        char key[7];
+        snprintf(key, sizeof(key), "s%05u", i);
+        nvs_erase_key(nvs_h, key);
+        snprintf(key, sizeof(key), "l%05u", i);
+        nvs_erase_key(nvs_h, key);
+    }
+    return nvs_commit(nvs_h);
+}
+
+static esp_err_t store_get_range(uint16_t *out_head, uint16_t *out_count)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_get_range(out_head, out_count);
+#endif
+    esp_err_t err;
+    err = get_u16_or_default("scan_head", out_head, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("scan_count", out_count, 0);
+    return err;
+}
+
+static esp_err_t store_delete(uint16_t index)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_delete(index);
+#endif
+    // Only the index entry is cleared; the record's space is reclaimed
+    // when its segment is evicted.
+    scan_index_entry_t entry;
+    esp_err_t err = index_get(index, &entry);
+    if (err != ESP_OK) return err;
+    entry.flags = 0;
+    err = index_put(index, &entry);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+static esp_err_t store_delete_all(void)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_delete_all();
+#endif
+    uint16_t head, count, seg_head, seg_tail;
+    esp_err_t err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_head", &seg_head, 0);
+    if (err != ESP_OK) return err;
+    err = get_u16_or_default("seg_tail", &seg_tail, 0);
+    if (err != ESP_OK) return err;
+
+    for (uint16_t g = seg_head; g <= seg_tail; g++) {
+        seg_erase(g);  // Ignore errors for missing keys
+    }
+    for (uint16_t b = head / SCAN_INDEX_BLOCK; count > 0 && b <= (count - 1) / SCAN_INDEX_BLOCK; b++) {
+        index_erase_block(b);
+    }
+    // Pending records, and one an interrupted save may have left at scan_count
+    for (uint16_t i = s_pend_first; i <= count; i++) {
+        char key[7];
+        make_pend_key(i, key);
+        nvs_erase_key(nvs_h, key);
+    }
+    s_pend_first = 0;
+    s_pend_n = 0;
+    s_pend_seg = 0;
+
+    // Reset counters
+    err = nvs_set_u16(nvs_h, "scan_count", 0);
+    if (err != ESP_OK) return err;
+    err = nvs_set_u16(nvs_h, "scan_head", 0);
+    if (err != ESP_OK) return err;
+    err = nvs_set_u16(nvs_h, "seg_head", 0);
+    if (err != ESP_OK) return err;
+    err = nvs_set_u16(nvs_h, "seg_tail", 0);
+    if (err != ESP_OK) return err;
+    err = nvs_set_u16(nvs_h, "seg_ckpt", 0);
+    if (err != ESP_OK) return err;
+
+    return nvs_commit(nvs_h);
+}
+
+static esp_err_t store_save_location(uint16_t index, double lat, double lng, double accuracy)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) {
+        scan_location_t loc = { .lat = lat, .lng = lng, .accuracy = accuracy };
+        return scan_log_save_location(index, &loc);
+    }
+#endif
+    scan_index_entry_t entry;
+    esp_err_t err = index_get(index, &entry);
+    if (err != ESP_OK) return err;
+    index_set_location(&entry, lat, lng, accuracy);
+    err = index_put(index, &entry);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+static esp_err_t store_get_location(uint16_t index, scan_location_t *out)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_get_location(index, out);
+#endif
+    scan_index_entry_t entry;
+    esp_err_t err = index_get(index, &entry);
+    if (err != ESP_OK) return err;
+    if (!(entry.flags & SCAN_INDEX_F_LOCATED)) return ESP_ERR_NVS_NOT_FOUND;
+    out->lat = entry.lat_e6 / 1e6;
+    out->lng = entry.lng_e6 / 1e6;
+    out->accuracy = entry.accuracy;
+    return ESP_OK;
+}
+
+static bool store_has_location(uint16_t index)
+{
+#ifdef CONFIG_LOCATOR_SCANLOG
+    if (s_use_log) return scan_log_has_location(index);
+#endif
+    scan_index_entry_t entry;
+    return index_get(index, &entry) == ESP_OK && (entry.flags & SCAN_INDEX_F_LOCATED);
+}
+
+// --- RTC scan buffer ---
+//
+// With CONFIG_LOCATOR_RTC_SCAN_BUFFER, scan mode appends scans to a buffer in
+// RTC slow memory that survives deep sleep, and only writes them to flash in
+// batches. Buffered scans get the indices they will have once flushed, so
+// callers see them like any stored scan.
+// The buffer is RTC_NOINIT so it also survives resets, including the button
+// reset that enters web server mode on chips without EXT0 wakeup, where it is
+// flushed. After power loss it holds garbage, which the CRC rejects.
+
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+// Record: int64 timestamp, uint8 ap_count, then ap_count stored_ap_t trimmed
+// after ssid_len bytes of SSID.
+#define RTC_AP_FIXED offsetof(stored_ap_t, ssid)
+
+typedef struct {
+    uint32_t crc;           // over count, used and data[0..used)
+    uint16_t count;
+    uint16_t used;
+    uint8_t  data[CONFIG_LOCATOR_RTC_BUFFER_BYTES];
+} rtc_scan_buf_t;
+
+static RTC_NOINIT_ATTR rtc_scan_buf_t s_rtc;
+
+static uint32_t rtc_crc(void)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&s_rtc.count, sizeof(s_rtc.count) + sizeof(s_rtc.used));
+    return esp_rom_crc32_le(crc, s_rtc.data, s_rtc.used);
+}
+
+static void rtc_seal(void)
+{
+    s_rtc.crc = rtc_crc();
+}
+
+static void rtc_check(void)
+{
+    if (s_rtc.used > sizeof(s_rtc.data) || s_rtc.crc != rtc_crc()) {
+        if (s_rtc.count) ESP_LOGW(TAG, "RTC scan buffer corrupt, dropping %u scans", s_rtc.count);
+        s_rtc.count = 0;
+        s_rtc.used = 0;
+        rtc_seal();
+    }
+}
+
+static size_t rtc_record_size(const stored_ap_t *aps, uint8_t ap_count)
+{
+    size_t size = sizeof(int64_t) + 1;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        size += RTC_AP_FIXED + (aps[i].ssid_len > 32 ? 32 : aps[i].ssid_len);
+    }
+    return size;
+}
+
+// Decode buffered scan k (0 = oldest)
+static esp_err_t rtc_get(uint16_t k, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count,
+                         int64_t *out_timestamp)
+{
+    size_t pos = 0;
+    for (uint16_t r = 0; r < s_rtc.count; r++) {
+        int64_t timestamp;
+        memcpy(&timestamp, &s_rtc.data[pos], sizeof(timestamp));
+        uint8_t ap_count = s_rtc.data[pos + sizeof(timestamp)];
+        pos += sizeof(timestamp) + 1;
+
+        for (uint8_t i = 0; i < ap_count; i++) {
+            uint8_t len = s_rtc.data[pos + RTC_AP_FIXED - 1];
+            if (r == k && aps && i < max_aps) {
+                memset(&aps[i], 0, sizeof(aps[i]));
+                memcpy(&aps[i], &s_rtc.data[pos], RTC_AP_FIXED + len);
+            }
+            pos += RTC_AP_FIXED + len;
+        }
+        if (r == k) {
+            if (out_ap_count) *out_ap_count = (aps && ap_count > max_aps) ? max_aps : ap_count;
+            if (out_timestamp) *out_timestamp = timestamp;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+// Position of a scan index in the RTC buffer, or -1 if it isn't buffered
+static int rtc_slot(uint16_t index)
+{
+    uint16_t head, count;
+    if (s_rtc.count == 0 || store_get_range(&head, &count) != ESP_OK) return -1;
+    uint16_t k = index - count;
+    return k < s_rtc.count ? k : -1;
+}
+#endif
+
+static esp_err_t buf_flush(void)
+{
+    cycle_stats_save();
+    outbox_save();
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    if (s_rtc.count == 0) return ESP_OK;
+    ESP_LOGI(TAG, "Flushing %u buffered scans", s_rtc.count);
+
+    // Drop each scan from the buffer as soon as it is in flash, so a reset
+    // during the flush doesn't store it twice
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    esp_err_t err = ESP_OK;
+    while (s_rtc.count > 0) {
+        uint8_t ap_count;
+        int64_t timestamp;
+        rtc_get(0, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count, &timestamp);
+        err = store_save(aps, ap_count, timestamp, NULL);
+        if (err != ESP_OK) break;  // keep whatever didn't make it to flash
+
+        size_t pos = sizeof(int64_t) + 1;
+        for (uint8_t i = 0; i < s_rtc.data[sizeof(int64_t)]; i++) {
+            pos += RTC_AP_FIXED + s_rtc.data[pos + RTC_AP_FIXED - 1];
+        }
+        memmove(s_rtc.data, &s_rtc.data[pos], s_rtc.used - pos);
+        s_rtc.used -= pos;
+        s_rtc.count--;
+        rtc_seal();
+    }
+    return err;
+#else
+    return ESP_OK;
+#endif
+}
+
+static esp_err_t buf_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    if (ap_count > CONFIG_LOCATOR_MAX_APS_PER_SCAN) ap_count = CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+    size_t size = rtc_record_size(aps, ap_count);
+    if (s_rtc.used + size > sizeof(s_rtc.data)) {
+        esp_err_t err = buf_flush();
+        if (err != ESP_OK) return err;
+    }
+
+    uint16_t head, count;
+    esp_err_t err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+
+    uint8_t *p = &s_rtc.data[s_rtc.used];
+    memcpy(p, &timestamp, sizeof(timestamp));
+    p += sizeof(timestamp);
+    *p++ = ap_count;
+    for (uint8_t i = 0; i < ap_count; i++) {
+        stored_ap_t ap = aps[i];
+        if (ap.ssid_len > 32) ap.ssid_len = 32;
+        memcpy(p, &ap, RTC_AP_FIXED + ap.ssid_len);
+        p += RTC_AP_FIXED + ap.ssid_len;
+    }
+    s_rtc.used += size;
+    s_rtc.count++;
+    rtc_seal();
+
+    if (out_index) *out_index = count + s_rtc.count - 1;
+    ESP_LOGI(TAG, "Buffered scan %u in RTC memory (%u/%d)", count + s_rtc.count - 1,
+             s_rtc.count, CONFIG_LOCATOR_RTC_FLUSH_SCANS);
+
+    if (s_rtc.count >= CONFIG_LOCATOR_RTC_FLUSH_SCANS) {
+        return buf_flush();
+    }
+    return ESP_OK;
+#else
+    return store_save(aps, ap_count, timestamp, out_index);
+#endif
+}
+
+static esp_err_t buf_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    int k = rtc_slot(index);
+    if (k >= 0) return rtc_get(k, aps, max_aps, out_ap_count, NULL);
+#endif
+    return store_load(index, aps, max_aps, out_ap_count);
+}
+
+static esp_err_t buf_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    int k = rtc_slot(index);
+    if (k >= 0) return rtc_get(k, NULL, 0, out_ap_count, out_timestamp);
+#endif
+    return store_get_scan_info(index, out_ap_count, out_timestamp);
+}
+
+static esp_err_t buf_get_range(uint16_t *out_head, uint16_t *out_count)
+{
+    esp_err_t err = store_get_range(out_head, out_count);
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    if (err == ESP_OK) *out_count += s_rtc.count;
+#endif
+    return err;
+}
+
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+typedef struct {
+    scan_header_cb_t cb;
+    void *ctx;
+    bool stopped;
+} rtc_iter_ctx_t;
+
+static bool rtc_iter_cb(uint16_t index, const scan_index_entry_t *entry, void *arg)
+{
+    rtc_iter_ctx_t *rc = arg;
+    rc->stopped = !rc->cb(index, entry, rc->ctx);
+    return !rc->stopped;
+}
+#endif
+
+static esp_err_t buf_iterate_headers(uint16_t from, scan_header_cb_t cb, void *ctx)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    rtc_iter_ctx_t rc = { .cb = cb, .ctx = ctx, .stopped = false };
+    esp_err_t err = store_iterate_headers(from, rtc_iter_cb, &rc);
+    if (err != ESP_OK || rc.stopped || s_rtc.count == 0) return err;
+
+    uint16_t head, count;
+    err = store_get_range(&head, &count);
+    if (err != ESP_OK) return err;
+
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    for (uint16_t k = from > count ? from - count : 0; k < s_rtc.count; k++) {
+        uint8_t ap_count;
+        int64_t timestamp;
+        rtc_get(k, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count, &timestamp);
+        scan_index_entry_t entry;
+        index_fill_entry(&entry, aps, ap_count, timestamp, 0);
+        if (!cb(count + k, &entry, ctx)) break;
+    }
+    return ESP_OK;
+#else
+    return store_iterate_headers(from, cb, ctx);
+#endif
+}
+
+static esp_err_t buf_delete(uint16_t index)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    // Buffered scans are flushed first so indices stay stable
+    if (rtc_slot(index) >= 0) {
+        esp_err_t err = buf_flush();
+        if (err != ESP_OK) return err;
+    }
+#endif
+    return store_delete(index);
+}
+
+static esp_err_t buf_delete_all(void)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    s_rtc.count = 0;
+    s_rtc.used = 0;
+    rtc_seal();
+#endif
+    return store_delete_all();
+}
+
+static esp_err_t buf_save_location(uint16_t index, double lat, double lng, double accuracy)
+{
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+    if (rtc_slot(index) >= 0) {
+        esp_err_t err = buf_flush();
+        if (err != ESP_OK) return err;
+    }
+#endif
+    return store_save_location(index, lat, lng, accuracy);
+}
+
+// --- Public scan API ---
+//
+// The web server and the continuous scan recorder use the store from
+// different tasks, so every scan data call runs under one recursive lock.
+
+#define STORE_LOCK()   xSemaphoreTakeRecursive(s_lock, portMAX_DELAY)
+#define STORE_UNLOCK() xSemaphoreGiveRecursive(s_lock)
+
+esp_err_t scan_store_flush(void)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_flush();
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_save(aps, ap_count, timestamp, out_index);
+    s_generation++;
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_load(index, aps, max_aps, out_ap_count);
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_get_scan_info(index, out_ap_count, out_timestamp);
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_get_range(uint16_t *out_head, uint16_t *out_count)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_get_range(out_head, out_count);
+    STORE_UNLOCK();
+    return err;
+}
+
+// The callback runs with the lock held
+esp_err_t scan_store_iterate_headers(scan_header_cb_t cb, void *ctx)
+{
+    return scan_store_iterate_headers_from(0, cb, ctx);
+}
+
+esp_err_t scan_store_iterate_headers_from(uint16_t from, scan_header_cb_t cb, void *ctx)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_iterate_headers(from, cb, ctx);
+    STORE_UNLOCK();
+    return err;
+}
+
+uint16_t scan_store_find_time(int64_t t)
+{
+    STORE_LOCK();
+    uint16_t lo = 0, hi = 0;
+    buf_get_range(&lo, &hi);
+    uint16_t end = hi;
+    // Smallest index whose timestamp is >= t. A deleted scan in the way is
+    // judged by the next stored one.
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        uint16_t probe = mid;
+        int64_t ts = 0;
+        while (probe < hi && buf_get_scan_info(probe, NULL, &ts) != ESP_OK) probe++;
+        if (probe == hi || ts >= t) {
+            hi = mid;
+        } else {
+            lo = probe + 1;
+        }
+    }
+    STORE_UNLOCK();
+    return lo < end ? lo : end;
+}
+
+uint32_t scan_store_generation(void)
+{
+    return s_generation;
+}
+
+esp_err_t scan_store_delete(uint16_t index)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_delete(index);
+    s_generation++;
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_delete_all(void)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_delete_all();
+    s_generation++;
+    STORE_UNLOCK();
+    // Indexes restart at 0
+    if (nvs_erase_key(nvs_h, "mqtt_mark") == ESP_OK) nvs_commit(nvs_h);
+    scan_store_outbox_done(MQTT_OUTBOX_MAX, false);
+    return err;
+}
+
+esp_err_t scan_store_save_location(uint16_t index, double lat, double lng, double accuracy)
+{
+    STORE_LOCK();
+    esp_err_t err = buf_save_location(index, lat, lng, accuracy);
+    s_generation++;
+    STORE_UNLOCK();
+    return err;
+}
+
+esp_err_t scan_store_get_location(uint16_t index, scan_location_t *out)
+{
+    STORE_LOCK();
+    esp_err_t err = store_get_location(index, out);
+    STORE_UNLOCK();
+    return err;
+}
+
+bool scan_store_has_location(uint16_t index)
+{
+    STORE_LOCK();
+    bool has = store_has_location(index);
+    STORE_UNLOCK();
+    return has;
+}
+
+esp_err_t scan_store_get_api_key(char *buf, size_t buf_size)
+{
+    return nvs_get_str(nvs_h, "api_key", buf, &buf_size);
+}
+
+esp_err_t scan_store_set_api_key(const char *key)
+{
+    esp_err_t err = nvs_set_str(nvs_h, "api_key", key);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+// --- Cycle stats ---
+//
+// Ring of the last CYCLE_STATS_MAX wake cycles in RTC memory. It is written
+// to NVS every CYCLE_STATS_SAVE_EVERY cycles and on flush, so a reset loses
+// at most a few entries.
+
+#define CYCLE_STATS_MAGIC      0x43594331
+#define CYCLE_STATS_SAVE_EVERY 8
+
+typedef struct {
+    uint32_t magic;
+    uint8_t  head;          // oldest entry
+    uint8_t  count;
+    uint8_t  unsaved;       // entries added since the last NVS write
+    uint8_t  reserved;
+    cycle_stats_t e[CYCLE_STATS_MAX];
+} cycle_ring_t;
+
+static RTC_DATA_ATTR cycle_ring_t s_cyc;
+
+static cycle_ring_t *cycle_ring(void)
+{
+    if (s_cyc.magic == CYCLE_STATS_MAGIC) return &s_cyc;
+
+    size_t len = sizeof(s_cyc);
+    if (nvs_get_blob(nvs_h, "cyc_stats", &s_cyc, &len) != ESP_OK || len != sizeof(s_cyc) ||
+        s_cyc.magic != CYCLE_STATS_MAGIC || s_cyc.head >= CYCLE_STATS_MAX ||
+        s_cyc.count > CYCLE_STATS_MAX) {
+        memset(&s_cyc, 0, sizeof(s_cyc));
+        s_cyc.magic = CYCLE_STATS_MAGIC;
+    }
+    s_cyc.unsaved = 0;
+    return &s_cyc;
+}
+
+static void cycle_stats_save(void)
+{
+    if (s_cyc.magic != CYCLE_STATS_MAGIC || s_cyc.unsaved == 0) return;
+    s_cyc.unsaved = 0;
+    esp_err_t err = nvs_set_blob(nvs_h, "cyc_stats", &s_cyc, sizeof(s_cyc));
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save cycle stats: %s", esp_err_to_name(err));
+    }
+}
+
+void scan_store_add_cycle_stats(const cycle_stats_t *stats)
+{
+    cycle_ring_t *r = cycle_ring();
+    if (r->count < CYCLE_STATS_MAX) {
+        r->e[(r->head + r->count) % CYCLE_STATS_MAX] = *stats;
+        r->count++;
+    } else {
+        r->e[r->head] = *stats;
+        r->head = (r->head + 1) % CYCLE_STATS_MAX;
+    }
+    if (++r->unsaved >= CYCLE_STATS_SAVE_EVERY) {
+        cycle_stats_save();
+    }
+}
+
+int scan_store_get_cycle_stats(cycle_stats_t *out, int max)
+{
+    cycle_ring_t *r = cycle_ring();
+    int n = r->count < max ? r->count : max;
+    // Newest n entries, oldest first
+    for (int i = 0; i < n; i++) {
+        out[i] = r->e[(r->head + r->count - n + i) % CYCLE_STATS_MAX];
+    }
+    return n;
+}
+
+// --- MQTT outbox ---
+//
+// Ring of scan indexes waiting for the last-scan publish, in RTC memory like
+// the cycle stats. Pushes are written to NVS on flush (before every
+// connection attempt) and every OUTBOX_SAVE_EVERY scans; removals right away.
+
+#define OUTBOX_MAGIC      0x4F425831
+#define OUTBOX_SAVE_EVERY 8
+
+typedef struct {
+    uint32_t magic;
+    uint8_t  head;          // oldest entry
+    uint8_t  count;
+    uint8_t  unsaved;       // pushes since the last NVS write
+    uint8_t  reserved;
+    mqtt_outbox_entry_t e[MQTT_OUTBOX_MAX];
+} outbox_ring_t;
+
+static RTC_DATA_ATTR outbox_ring_t s_outbox;
+
+static outbox_ring_t *outbox_ring(void)
+{
+    if (s_outbox.magic == OUTBOX_MAGIC) return &s_outbox;
+
+    size_t len = sizeof(s_outbox);
+    if (nvs_get_blob(nvs_h, "mqtt_outbox", &s_outbox, &len) != ESP_OK || len != sizeof(s_outbox) ||
+        s_outbox.magic != OUTBOX_MAGIC || s_outbox.head >= MQTT_OUTBOX_MAX ||
+        s_outbox.count > MQTT_OUTBOX_MAX) {
+        memset(&s_outbox, 0, sizeof(s_outbox));
+        s_outbox.magic = OUTBOX_MAGIC;
+    }
+    s_outbox.unsaved = 0;
+    return &s_outbox;
+}
+
+static esp_err_t outbox_save(void)
+{
+    if (s_outbox.magic != OUTBOX_MAGIC || s_outbox.unsaved == 0) return ESP_OK;
+    s_outbox.unsaved = 0;
+    esp_err_t err = nvs_set_blob(nvs_h, "mqtt_outbox", &s_outbox, sizeof(s_outbox));
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save MQTT outbox: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t scan_store_outbox_push(uint16_t index)
+{
+    outbox_ring_t *r = outbox_ring();
+    mqtt_outbox_entry_t entry = { .scan_index = index };
+    if (r->count < MQTT_OUTBOX_MAX) {
+        r->e[(r->head + r->count) % MQTT_OUTBOX_MAX] = entry;
+        r->count++;
+    } else {
+        ESP_LOGW(TAG, "MQTT outbox full, dropping scan %u", r->e[r->head].scan_index);
+        r->e[r->head] = entry;
+        r->head = (r->head + 1) % MQTT_OUTBOX_MAX;
+    }
+    if (++r->unsaved >= OUTBOX_SAVE_EVERY) outbox_save();
+    return ESP_OK;
+}
+
+int scan_store_outbox_peek(mqtt_outbox_entry_t *out, int max)
+{
+    outbox_ring_t *r = outbox_ring();
+    int n = r->count < max ? r->count : max;
+    for (int i = 0; i < n; i++) {
+        out[i] = r->e[(r->head + i) % MQTT_OUTBOX_MAX];
+    }
+    return n;
+}
 
-    memcpy(aps, blob + sizeof(scan_header_t), ap_count * sizeof(stored_ap_t));
-    *out_ap_count = ap_count;
+esp_err_t scan_store_outbox_done(int sent, bool failed)
+{
+    outbox_ring_t *r = outbox_ring();
+    if (sent > r->count) sent = r->count;
+    r->head = (r->head + sent) % MQTT_OUTBOX_MAX;
+    r->count -= sent;
+
+    if (failed && r->count > 0) {
+        mqtt_outbox_entry_t *e = &r->e[r->head];
+        if (++e->retries >= MQTT_OUTBOX_RETRIES) {
+            ESP_LOGW(TAG, "Scan %u failed to publish %u times, dropping it",
+                     e->scan_index, e->retries);
+            r->head = (r->head + 1) % MQTT_OUTBOX_MAX;
+            r->count--;
+        }
+    }
+    if (sent == 0 && !failed && r->unsaved == 0) return ESP_OK;
 
-    free(blob);
-    return ESP_OK;
+    r->unsaved = 1;
+    return outbox_save();
 }
 
-esp_err_t scan_store_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp)
-{
-    char key[7];
-    make_scan_key(index, key);
+// --- Config cache ---
+//
+// Settings read on every scan cycle, kept in RTC memory so timer wakeups don't
+// read NVS. The bootloader reloads RTC data on any boot other than a deep
+// sleep wakeup, and every setter of a cached value invalidates the cache.
 
-    size_t blob_size = 0;
-    esp_err_t err = nvs_get_blob(nvs_h, key, NULL, &blob_size);
-    if (err != ESP_OK) return err;
+#define CFG_CACHE_MAGIC 0x43464731
 
-    if (blob_size < sizeof(scan_header_t)) return ESP_ERR_INVALID_SIZE;
+typedef struct {
+    uint32_t magic;
+    uint16_t scan_interval;
+    uint16_t scan_interval_max;
+    uint8_t  open_wifi_mode;
+    bool     has_wifi_creds;
+    bool     skip_duplicates;
+} config_cache_t;
 
-    uint8_t *blob = malloc(blob_size);
-    if (!blob) return ESP_ERR_NO_MEM;
+static RTC_DATA_ATTR config_cache_t s_cfg;
 
-    err = nvs_get_blob(nvs_h, key, blob, &blob_size);
-    if (err == ESP_OK) {
-        scan_header_t hdr;
-        memcpy(&hdr, blob, sizeof(scan_header_t));
-        if (out_ap_count) *out_ap_count = hdr.ap_count;
-        if (out_timestamp) *out_timestamp = hdr.timestamp;
+static const config_cache_t *config_cache(void)
+{
+    if (s_cfg.magic == CFG_CACHE_MAGIC) return &s_cfg;
+
+    if (nvs_get_u16(nvs_h, "scan_ivl", &s_cfg.scan_interval) != ESP_OK) {
+        s_cfg.scan_interval = SCAN_INTERVAL_DEFAULT;
     }
-    free(blob);
-    return err;
+    if (nvs_get_u16(nvs_h, "scan_ivl_max", &s_cfg.scan_interval_max) != ESP_OK) {
+        s_cfg.scan_interval_max = 0;
+    }
+    uint8_t skip_dup = 0;
+    nvs_get_u8(nvs_h, "skip_dup", &skip_dup);
+    s_cfg.skip_duplicates = skip_dup != 0;
+    if (nvs_get_u8(nvs_h, "ow_mode", &s_cfg.open_wifi_mode) != ESP_OK) {
+        s_cfg.open_wifi_mode = OPEN_WIFI_OFF;
+    }
+    size_t len = 0;
+    s_cfg.has_wifi_creds = nvs_get_str(nvs_h, "wifi_ssid", NULL, &len) == ESP_OK && len > 1;
+    s_cfg.magic = CFG_CACHE_MAGIC;
+    return &s_cfg;
 }
 
-esp_err_t scan_store_get_range(uint16_t *out_head, uint16_t *out_count)
+static void config_cache_invalidate(void)
 {
-    esp_err_t err;
-    err = get_u16_or_default("scan_head", out_head, 0);
-    if (err != ESP_OK) return err;
-    err = get_u16_or_default("scan_count", out_count, 0);
-    return err;
+    s_cfg.magic = 0;
 }
 
-esp_err_t scan_store_delete(uint16_t index)
+uint16_t scan_store_get_scan_interval(void)
 {
-    char key[7];
-    make_scan_key(index, key);
-    esp_err_t err = nvs_erase_key(nvs_h, key);
-    if (err != ESP_OK) return err;
-    make_loc_key(index, key);
-    nvs_erase_key(nvs_h, key);  // also delete cached location
-    return nvs_commit(nvs_h);
+    return config_cache()->scan_interval;
 }
 
-esp_err_t scan_store_delete_all(void)
+esp_err_t scan_store_set_scan_interval(uint16_t seconds)
 {
-    uint16_t head, count;
-    esp_err_t err = scan_store_get_range(&head, &count);
-    if (err != ESP_OK) return err;
-
-    for (uint16_t i = head; i < count; i++) {
-        char key[7];
-        make_scan_key(i, key);
-        nvs_erase_key(nvs_h, key);  // Ignore errors for missing keys
-        make_loc_key(i, key);
-        nvs_erase_key(nvs_h, key);  // also delete cached locations
-    }
-
-    // Reset counters
-    err = nvs_set_u16(nvs_h, "scan_count", 0);
-    if (err != ESP_OK) return err;
-    err = nvs_set_u16(nvs_h, "scan_head", 0);
+    config_cache_invalidate();
+    esp_err_t err = nvs_set_u16(nvs_h, "scan_ivl", seconds);
     if (err != ESP_OK) return err;
-
     return nvs_commit(nvs_h);
 }
 
-esp_err_t scan_store_get_api_key(char *buf, size_t buf_size)
+uint16_t scan_store_get_scan_interval_max(void)
 {
-    return nvs_get_str(nvs_h, "api_key", buf, &buf_size);
+    return config_cache()->scan_interval_max;
 }
 
-esp_err_t scan_store_set_api_key(const char *key)
+esp_err_t scan_store_set_scan_interval_max(uint16_t seconds)
 {
-    esp_err_t err = nvs_set_str(nvs_h, "api_key", key);
+    config_cache_invalidate();
+    esp_err_t err = nvs_set_u16(nvs_h, "scan_ivl_max", seconds);
     if (err != ESP_OK) return err;
     return nvs_commit(nvs_h);
 }
 
-uint16_t scan_store_get_scan_interval(void)
+bool scan_store_get_skip_duplicates(void)
 {
-    uint16_t val;
-    esp_err_t err = nvs_get_u16(nvs_h, "scan_ivl", &val);
-    if (err != ESP_OK) return SCAN_INTERVAL_DEFAULT;
-    return val;
+    return config_cache()->skip_duplicates;
 }
 
-esp_err_t scan_store_set_scan_interval(uint16_t seconds)
+esp_err_t scan_store_set_skip_duplicates(bool skip)
 {
-    esp_err_t err = nvs_set_u16(nvs_h, "scan_ivl", seconds);
+    config_cache_invalidate();
+    esp_err_t err = nvs_set_u8(nvs_h, "skip_dup", skip ? 1 : 0);
     if (err != ESP_OK) return err;
     return nvs_commit(nvs_h);
 }
@@ -231,31 +2062,6 @@ esp_err_t scan_store_set_web_password(const char *pass)
     return nvs_commit(nvs_h);
 }
 
-esp_err_t scan_store_save_location(uint16_t index, double lat, double lng, double accuracy)
-{
-    char key[7];
-    make_loc_key(index, key);
-    scan_location_t loc = { .lat = lat, .lng = lng, .accuracy = accuracy };
-    esp_err_t err = nvs_set_blob(nvs_h, key, &loc, sizeof(loc));
-    if (err != ESP_OK) return err;
-    return nvs_commit(nvs_h);
-}
-
-esp_err_t scan_store_get_location(uint16_t index, scan_location_t *out)
-{
-    char key[7];
-    make_loc_key(index, key);
-    size_t size = sizeof(scan_location_t);
-    return nvs_get_blob(nvs_h, key, out, &size);
-}
-
-bool scan_store_has_location(uint16_t index)
-{
-    char key[7];
-    make_loc_key(index, key);
-    size_t size = 0;
-    return nvs_get_blob(nvs_h, key, NULL, &size) == ESP_OK;
-}
 
 esp_err_t scan_store_get_wifi_ssid(char *buf, size_t buf_size)
 {
@@ -264,6 +2070,7 @@ esp_err_t scan_store_get_wifi_ssid(char *buf, size_t buf_size)
 
 esp_err_t scan_store_set_wifi_ssid(const char *ssid)
 {
+    config_cache_invalidate();
     esp_err_t err = nvs_set_str(nvs_h, "wifi_ssid", ssid);
     if (err != ESP_OK) return err;
     return nvs_commit(nvs_h);
@@ -283,13 +2090,12 @@ esp_err_t scan_store_set_wifi_pass(const char *pass)
 
 bool scan_store_has_wifi_creds(void)
 {
-    size_t len = 0;
-    esp_err_t err = nvs_get_str(nvs_h, "wifi_ssid", NULL, &len);
-    return (err == ESP_OK && len > 1);
+    return config_cache()->has_wifi_creds;
 }
 
 esp_err_t scan_store_clear_wifi_creds(void)
 {
+    config_cache_invalidate();
     nvs_erase_key(nvs_h, "wifi_ssid");
     nvs_erase_key(nvs_h, "wifi_pass");
     return nvs_commit(nvs_h);
@@ -327,6 +2133,12 @@ esp_err_t scan_store_get_mqtt_url_all(char *buf, size_t buf_size)
 
 esp_err_t scan_store_set_mqtt_url_all(const char *url)
 {
+    // A different broker or topic hasn't seen any scans yet
+    char old[257] = {0};
+    size_t len = sizeof(old);
+    if (nvs_get_str(nvs_h, "mqtt_url_a", old, &len) != ESP_OK || strcmp(old, url) != 0) {
+        nvs_erase_key(nvs_h, "mqtt_mark");
+    }
     return set_str_or_erase("mqtt_url_a", url);
 }
 
@@ -375,6 +2187,62 @@ esp_err_t scan_store_set_mqtt_password(const char *pass)
     return set_str_or_erase("mqtt_pass", pass);
 }
 
+bool scan_store_get_mqtt_persist(void)
+{
+    uint8_t val;
+    if (nvs_get_u8(nvs_h, "mqtt_persist", &val) != ESP_OK) return false;
+    return val != 0;
+}
+
+esp_err_t scan_store_set_mqtt_persist(bool on)
+{
+    esp_err_t err = nvs_set_u8(nvs_h, "mqtt_persist", on ? 1 : 0);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+bool scan_store_get_mqtt_incremental(void)
+{
+    uint8_t val;
+    if (nvs_get_u8(nvs_h, "mqtt_incr", &val) != ESP_OK) return false;
+    return val != 0;
+}
+
+esp_err_t scan_store_set_mqtt_incremental(bool on)
+{
+    esp_err_t err = nvs_set_u8(nvs_h, "mqtt_incr", on ? 1 : 0);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+uint8_t scan_store_get_mqtt_batch(void)
+{
+    uint8_t val;
+    if (nvs_get_u8(nvs_h, "mqtt_batch", &val) != ESP_OK || val == 0) return MQTT_BATCH_DEFAULT;
+    return val;
+}
+
+esp_err_t scan_store_set_mqtt_batch(uint8_t scans)
+{
+    esp_err_t err = nvs_set_u8(nvs_h, "mqtt_batch", scans);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
+uint16_t scan_store_get_mqtt_mark(void)
+{
+    uint16_t val;
+    if (nvs_get_u16(nvs_h, "mqtt_mark", &val) != ESP_OK) return 0;
+    return val;
+}
+
+esp_err_t scan_store_set_mqtt_mark(uint16_t index)
+{
+    esp_err_t err = nvs_set_u16(nvs_h, "mqtt_mark", index);
+    if (err != ESP_OK) return err;
+    return nvs_commit(nvs_h);
+}
+
 uint16_t scan_store_get_mqtt_cycle_counter(void)
 {
     uint16_t val;
@@ -394,14 +2262,12 @@ esp_err_t scan_store_set_mqtt_cycle_counter(uint16_t count)
 
 uint8_t scan_store_get_open_wifi_mode(void)
 {
-    uint8_t val;
-    esp_err_t err = nvs_get_u8(nvs_h, "ow_mode", &val);
-    if (err != ESP_OK) return OPEN_WIFI_OFF;
-    return val;
+    return config_cache()->open_wifi_mode;
 }
 
 esp_err_t scan_store_set_open_wifi_mode(uint8_t mode)
 {
+    config_cache_invalidate();
     esp_err_t err = nvs_set_u8(nvs_h, "ow_mode", mode);
     if (err != ESP_OK) return err;
     return nvs_commit(nvs_h);
@@ -442,11 +2308,54 @@ esp_err_t scan_store_set_open_wifi_url(const char *url)
     return nvs_commit(nvs_h);
 }
 
-// --- Open WiFi SSID blocklist (FIFO ring buffer) ---
+// --- Open WiFi blocklist ---
+//
+// One blob of fixed-size entries, oldest first. Each call reads it into a
+// heap buffer sized to the stored list (plus room for one more entry) and
+// frees it again, so a full 200-entry list isn't kept in RAM between uses.
+// Changes run under STORE_LOCK so two tasks can't lose each other's update.
+// Lookups compare the SSID hash before the string. When the list is full the
+// oldest entry is dropped; expired entries are pruned on every change.
+//
+// Open WiFi checks every candidate of a cycle against one snapshot: just the
+// hash, BSSID and expiry of each live entry, read once.
+
+typedef struct {
+    blocklist_entry_t *e;
+    uint16_t count;
+} bl_list_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t hash;
+    uint8_t  bssid[6];
+    int64_t  expires;
+} bl_key_t;
+
+struct blocklist_snapshot {
+    uint16_t count;
+    bl_key_t e[];
+};
+
+static uint32_t ssid_hash(const char *ssid)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (const char *p = ssid; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool bl_live(int64_t expires, int64_t now)
+{
+    return expires == 0 || now < expires;
+}
 
-static void make_bl_key(uint8_t slot, char *key)
+static bool bl_any_bssid(const uint8_t *bssid)
 {
-    snprintf(key, 6, "bl%u", slot);
+    static const uint8_t zero[6] = {0};
+    return memcmp(bssid, zero, sizeof(zero)) == 0;
 }
 
 static esp_err_t get_u8_or_default(const char *key, uint8_t *val, uint8_t def)
@@ -459,147 +2368,458 @@ static esp_err_t get_u8_or_default(const char *key, uint8_t *val, uint8_t def)
     return err;
 }
 
-bool scan_store_blocklist_contains(const char *ssid)
+static esp_err_t bl_save(const bl_list_t *bl)
+{
+    esp_err_t err = bl->count > 0 ?
+        nvs_set_blob(nvs_h, "blocklist", bl->e, bl->count * sizeof(blocklist_entry_t)) :
+        nvs_erase_key(nvs_h, "blocklist");
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save blocklist: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Older firmware kept up to 10 SSIDs in string keys bl0..bl9 (FIFO ring)
+static void bl_migrate(bl_list_t *bl)
 {
     uint8_t count, head;
-    if (get_u8_or_default("bl_count", &count, 0) != ESP_OK) return false;
-    if (get_u8_or_default("bl_head", &head, 0) != ESP_OK) return false;
-    if (count == 0) return false;
+    if (get_u8_or_default("bl_count", &count, 0) != ESP_OK || count == 0) return;
+    if (get_u8_or_default("bl_head", &head, 0) != ESP_OK) return;
 
-    uint8_t n = (count < BLOCKLIST_SIZE) ? count : BLOCKLIST_SIZE;
-    for (uint8_t i = 0; i < n; i++) {
-        uint8_t slot = (head + i) % BLOCKLIST_SIZE;
+    for (uint8_t i = 0; i < count && i < 10; i++) {
+        char key[6];
+        snprintf(key, sizeof(key), "bl%u", (head + i) % 10);
+        blocklist_entry_t *e = &bl->e[bl->count];
+        memset(e, 0, sizeof(*e));
+        size_t len = sizeof(e->ssid);
+        if (nvs_get_str(nvs_h, key, e->ssid, &len) != ESP_OK) continue;
+        e->hash = ssid_hash(e->ssid);
+        e->reason = BL_REASON_PORTAL;
+        bl->count++;
+    }
+    if (bl_save(bl) != ESP_OK) return;
+
+    for (uint8_t i = 0; i < 10; i++) {
         char key[6];
-        make_bl_key(slot, key);
-        char buf[33] = {0};
-        size_t buf_size = sizeof(buf);
-        if (nvs_get_str(nvs_h, key, buf, &buf_size) == ESP_OK) {
-            if (strcmp(buf, ssid) == 0) return true;
+        snprintf(key, sizeof(key), "bl%u", i);
+        nvs_erase_key(nvs_h, key);
+    }
+    nvs_erase_key(nvs_h, "bl_count");
+    nvs_erase_key(nvs_h, "bl_head");
+    nvs_commit(nvs_h);
+    ESP_LOGI(TAG, "Migrated %u blocklist entries", bl->count);
+}
+
+// Pair every successful bl_load() with bl_unload(); call under STORE_LOCK
+static esp_err_t bl_load(bl_list_t *bl)
+{
+    size_t len = 0;
+    esp_err_t err = nvs_get_blob(nvs_h, "blocklist", NULL, &len);
+    bool migrate = (err == ESP_ERR_NVS_NOT_FOUND);
+    if (err != ESP_OK && !migrate) {
+        ESP_LOGW(TAG, "Blocklist unreadable (%s), starting empty", esp_err_to_name(err));
+        len = 0;
+    }
+    size_t count = MIN(len / sizeof(blocklist_entry_t), BLOCKLIST_SIZE);
+    size_t cap = MIN(count + (migrate ? 10 : 0) + 1, BLOCKLIST_SIZE);
+
+    bl->count = 0;
+    bl->e = calloc(cap, sizeof(blocklist_entry_t));
+    if (!bl->e) return ESP_ERR_NO_MEM;
+
+    if (migrate) {
+        bl_migrate(bl);
+    } else if (count > 0) {
+        len = count * sizeof(blocklist_entry_t);
+        err = nvs_get_blob(nvs_h, "blocklist", bl->e, &len);
+        if (err == ESP_OK) {
+            bl->count = len / sizeof(blocklist_entry_t);
+        } else {
+            ESP_LOGW(TAG, "Blocklist unreadable (%s), starting empty", esp_err_to_name(err));
         }
     }
-    return false;
+    return ESP_OK;
 }
 
-esp_err_t scan_store_blocklist_add(const char *ssid)
+static void bl_unload(bl_list_t *bl)
 {
-    // Deduplicate
-    if (scan_store_blocklist_contains(ssid)) return ESP_OK;
+    free(bl->e);
+    bl->e = NULL;
+    bl->count = 0;
+}
 
-    uint8_t count, head;
-    esp_err_t err;
-    err = get_u8_or_default("bl_count", &count, 0);
-    if (err != ESP_OK) return err;
-    err = get_u8_or_default("bl_head", &head, 0);
-    if (err != ESP_OK) return err;
+static void bl_remove(bl_list_t *bl, uint16_t i)
+{
+    bl->count--;
+    memmove(&bl->e[i], &bl->e[i + 1], (bl->count - i) * sizeof(blocklist_entry_t));
+}
 
-    uint8_t slot;
-    if (count < BLOCKLIST_SIZE) {
-        slot = (head + count) % BLOCKLIST_SIZE;
-        count++;
-    } else {
-        // Evict oldest (head), write to that slot, advance head
-        slot = head;
-        head = (head + 1) % BLOCKLIST_SIZE;
-        err = nvs_set_u8(nvs_h, "bl_head", head);
-        if (err != ESP_OK) return err;
+static void bl_prune(bl_list_t *bl, int64_t now)
+{
+    for (uint16_t i = bl->count; i-- > 0;) {
+        if (!bl_live(bl->e[i].expires, now)) bl_remove(bl, i);
     }
+}
 
-    char key[6];
-    make_bl_key(slot, key);
-    err = nvs_set_str(nvs_h, key, ssid);
-    if (err != ESP_OK) return err;
+blocklist_snapshot_t *scan_store_blocklist_snapshot(void)
+{
+    STORE_LOCK();
+    bl_list_t bl;
+    blocklist_snapshot_t *snap = NULL;
+    if (bl_load(&bl) == ESP_OK) {
+        int64_t now = time(NULL);
+        snap = malloc(sizeof(*snap) + bl.count * sizeof(bl_key_t));
+        if (snap) {
+            snap->count = 0;
+            for (uint16_t i = 0; i < bl.count; i++) {
+                if (!bl_live(bl.e[i].expires, now)) continue;
+                bl_key_t *k = &snap->e[snap->count++];
+                k->hash = bl.e[i].hash;
+                memcpy(k->bssid, bl.e[i].bssid, sizeof(k->bssid));
+                k->expires = bl.e[i].expires;
+            }
+        }
+        bl_unload(&bl);
+    }
+    STORE_UNLOCK();
+    if (!snap) ESP_LOGW(TAG, "Blocklist snapshot failed, nothing is blocked");
+    return snap;
+}
 
-    err = nvs_set_u8(nvs_h, "bl_count", count);
-    if (err != ESP_OK) return err;
+bool scan_store_blocklist_snapshot_contains(const blocklist_snapshot_t *snap, const char *ssid,
+                                            const uint8_t *bssid)
+{
+    if (!snap) return false;
+    uint32_t h = ssid_hash(ssid);
+    int64_t now = time(NULL);
+    for (uint16_t i = 0; i < snap->count; i++) {
+        const bl_key_t *k = &snap->e[i];
+        if (k->hash != h || !bl_live(k->expires, now)) continue;
+        if (bl_any_bssid(k->bssid) || (bssid && memcmp(k->bssid, bssid, 6) == 0)) return true;
+    }
+    return false;
+}
 
-    ESP_LOGI(TAG, "Blocklisted SSID '%s' (slot %u)", ssid, slot);
-    return nvs_commit(nvs_h);
+void scan_store_blocklist_snapshot_free(blocklist_snapshot_t *snap)
+{
+    free(snap);
+}
+
+esp_err_t scan_store_blocklist_add(const char *ssid, const uint8_t *bssid, uint8_t reason,
+                                   uint32_t ttl_sec)
+{
+    STORE_LOCK();
+    bl_list_t bl;
+    esp_err_t err = bl_load(&bl);
+    if (err != ESP_OK) {
+        STORE_UNLOCK();
+        return err;
+    }
+
+    int64_t now = time(NULL);
+    bl_prune(&bl, now);
+
+    blocklist_entry_t entry = {0};
+    strncpy(entry.ssid, ssid, sizeof(entry.ssid) - 1);
+    entry.hash = ssid_hash(entry.ssid);
+    if (bssid) memcpy(entry.bssid, bssid, sizeof(entry.bssid));
+    entry.reason = reason;
+    entry.expires = ttl_sec ? now + ttl_sec : 0;
+
+    // Replace an entry for the same SSID and BSSID
+    for (uint16_t i = 0; i < bl.count; i++) {
+        if (bl.e[i].hash == entry.hash && strcmp(bl.e[i].ssid, entry.ssid) == 0 &&
+            memcmp(bl.e[i].bssid, entry.bssid, sizeof(entry.bssid)) == 0) {
+            bl_remove(&bl, i);
+            break;
+        }
+    }
+    if (bl.count == BLOCKLIST_SIZE) bl_remove(&bl, 0);
+    bl.e[bl.count++] = entry;
+
+    ESP_LOGI(TAG, "Blocklisted SSID '%s' (reason %u, %s)", entry.ssid, reason,
+             ttl_sec ? "temporary" : "permanent");
+    err = bl_save(&bl);
+    bl_unload(&bl);
+    STORE_UNLOCK();
+    return err;
 }
 
 esp_err_t scan_store_blocklist_delete(const char *ssid)
 {
-    uint8_t count, head;
-    esp_err_t err;
-    err = get_u8_or_default("bl_count", &count, 0);
-    if (err != ESP_OK) return err;
-    err = get_u8_or_default("bl_head", &head, 0);
-    if (err != ESP_OK) return err;
-    if (count == 0) return ESP_ERR_NOT_FOUND;
+    STORE_LOCK();
+    bl_list_t bl;
+    esp_err_t err = bl_load(&bl);
+    if (err != ESP_OK) {
+        STORE_UNLOCK();
+        return err;
+    }
 
-    uint8_t n = (count < BLOCKLIST_SIZE) ? count : BLOCKLIST_SIZE;
-    char kept[BLOCKLIST_SIZE][33];
-    int kept_count = 0;
+    uint32_t h = ssid_hash(ssid);
     bool found = false;
+    for (uint16_t i = bl.count; i-- > 0;) {
+        if (bl.e[i].hash == h && strcmp(bl.e[i].ssid, ssid) == 0) {
+            bl_remove(&bl, i);
+            found = true;
+        }
+    }
+    if (found) {
+        ESP_LOGI(TAG, "Removed '%s' from blocklist (%u remaining)", ssid, bl.count);
+        err = bl_save(&bl);
+    } else {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    bl_unload(&bl);
+    STORE_UNLOCK();
+    return err;
+}
 
-    for (uint8_t i = 0; i < n; i++) {
-        uint8_t slot = (head + i) % BLOCKLIST_SIZE;
-        char key[6];
-        make_bl_key(slot, key);
-        char buf[33] = {0};
-        size_t buf_size = sizeof(buf);
-        if (nvs_get_str(nvs_h, key, buf, &buf_size) == ESP_OK) {
-            if (strcmp(buf, ssid) == 0) {
-                found = true;
-            } else {
-                strncpy(kept[kept_count], buf, 33);
-                kept[kept_count][32] = '\0';
-                kept_count++;
+esp_err_t scan_store_blocklist_clear(void)
+{
+    STORE_LOCK();
+    bl_list_t bl;
+    esp_err_t err = bl_load(&bl);
+    if (err == ESP_OK) {
+        bl.count = 0;
+        err = bl_save(&bl);
+        bl_unload(&bl);
+    }
+    STORE_UNLOCK();
+    return err;
+}
+
+int scan_store_blocklist_count(void)
+{
+    STORE_LOCK();
+    bl_list_t bl;
+    int n = 0;
+    if (bl_load(&bl) == ESP_OK) {
+        int64_t now = time(NULL);
+        for (uint16_t i = 0; i < bl.count; i++) {
+            if (bl_live(bl.e[i].expires, now)) n++;
+        }
+        bl_unload(&bl);
+    }
+    STORE_UNLOCK();
+    return n;
+}
+
+int scan_store_blocklist_list(blocklist_entry_t *out, int offset, int max_entries)
+{
+    STORE_LOCK();
+    bl_list_t bl;
+    int n = 0;
+    if (bl_load(&bl) == ESP_OK) {
+        int64_t now = time(NULL);
+        for (uint16_t i = 0; i < bl.count && n < max_entries; i++) {
+            if (!bl_live(bl.e[i].expires, now)) continue;
+            if (offset > 0) {
+                offset--;
+                continue;
             }
+            out[n++] = bl.e[i];
         }
+        bl_unload(&bl);
     }
+    STORE_UNLOCK();
+    return n;
+}
 
-    if (!found) return ESP_ERR_NOT_FOUND;
+// --- Network connection cache ---
+
+#define NET_CACHE_MAGIC      0x4E455433
+#define NET_CACHE_SAVE_EVERY 8
+
+// Network that never gave internet access: identified by SSID hash
+typedef struct __attribute__((packed)) {
+    uint32_t hash;
+    uint8_t  fail_count;
+    int8_t   last_rssi;
+    uint8_t  reserved[2];
+} net_fail_t;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t  count;
+    uint8_t  unsaved;       // stats updates since the last NVS write
+    uint8_t  fail_n;
+    uint8_t  reserved;
+    net_cache_entry_t e[NET_CACHE_MAX];
+    net_fail_t fail[NET_FAIL_MAX];
+} net_cache_t;
+
+static RTC_DATA_ATTR net_cache_t s_net;
+
+// RTC data memory is 8 KB on the ESP32, S2, S3 and C3. Leave 1 KB of it for
+// wifi_scan.c, motion.c and ESP-IDF's own RTC data.
+#define RTC_STORE_BUDGET_BYTES 7168
+#ifdef CONFIG_LOCATOR_RTC_SCAN_BUFFER
+#define RTC_SCAN_BUF_SIZE sizeof(rtc_scan_buf_t)
+#else
+#define RTC_SCAN_BUF_SIZE 0
+#endif
+_Static_assert(RTC_SCAN_BUF_SIZE + sizeof(cycle_ring_t) + sizeof(outbox_ring_t) +
+               sizeof(config_cache_t) + sizeof(net_cache_t) <= RTC_STORE_BUDGET_BYTES,
+               "scan_store RTC data doesn't fit in RTC memory");
+
+static net_cache_t *net_cache(void)
+{
+    if (s_net.magic == NET_CACHE_MAGIC) return &s_net;
+
+    // A cache in an older layout is dropped
+    size_t len = sizeof(s_net);
+    if (nvs_get_blob(nvs_h, "net_cache", &s_net, &len) != ESP_OK || len != sizeof(s_net) ||
+        s_net.magic != NET_CACHE_MAGIC || s_net.count > NET_CACHE_MAX ||
+        s_net.fail_n > NET_FAIL_MAX) {
+        memset(&s_net, 0, sizeof(s_net));
+        s_net.magic = NET_CACHE_MAGIC;
+    }
+    s_net.unsaved = 0;
+    return &s_net;
+}
 
-    // Clear all slots and rewrite
-    for (uint8_t i = 0; i < BLOCKLIST_SIZE; i++) {
-        char key[6];
-        make_bl_key(i, key);
-        nvs_erase_key(nvs_h, key);
+static esp_err_t net_cache_save(void)
+{
+    s_net.unsaved = 0;
+    esp_err_t err = nvs_set_blob(nvs_h, "net_cache", &s_net, sizeof(s_net));
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save network cache: %s", esp_err_to_name(err));
     }
-    for (int i = 0; i < kept_count; i++) {
-        char key[6];
-        make_bl_key(i, key);
-        nvs_set_str(nvs_h, key, kept[i]);
+    return err;
+}
+
+static int net_cache_index(const char *ssid)
+{
+    net_cache_t *c = net_cache();
+    for (int i = 0; i < c->count; i++) {
+        if (strcmp(c->e[i].ssid, ssid) == 0) return i;
     }
+    return -1;
+}
 
-    nvs_set_u8(nvs_h, "bl_head", 0);
-    nvs_set_u8(nvs_h, "bl_count", (uint8_t)kept_count);
-    ESP_LOGI(TAG, "Removed '%s' from blocklist (%d remaining)", ssid, kept_count);
-    return nvs_commit(nvs_h);
+static int net_fail_index(uint32_t hash)
+{
+    net_cache_t *c = net_cache();
+    for (int i = 0; i < c->fail_n; i++) {
+        if (c->fail[i].hash == hash) return i;
+    }
+    return -1;
 }
 
-esp_err_t scan_store_blocklist_clear(void)
+static void net_fail_remove(int i)
 {
-    uint8_t count;
-    get_u8_or_default("bl_count", &count, 0);
+    s_net.fail_n--;
+    memmove(&s_net.fail[i], &s_net.fail[i + 1], (s_net.fail_n - i) * sizeof(s_net.fail[0]));
+}
 
-    for (uint8_t i = 0; i < BLOCKLIST_SIZE; i++) {
-        char key[6];
-        make_bl_key(i, key);
-        nvs_erase_key(nvs_h, key);
+uint32_t scan_store_net_median_tti(const net_cache_entry_t *net)
+{
+    uint16_t v[NET_TTI_SAMPLES];
+    int n = 0;
+    for (int i = 0; i < NET_TTI_SAMPLES; i++) {
+        if (net->tti_ms[i] == 0) continue;
+        int j = n++;
+        while (j > 0 && v[j - 1] > net->tti_ms[i]) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = net->tti_ms[i];
     }
-    nvs_erase_key(nvs_h, "bl_count");
-    nvs_erase_key(nvs_h, "bl_head");
-    return nvs_commit(nvs_h);
+    if (n == 0) return 0;
+    return n % 2 ? v[n / 2] : ((uint32_t)v[n / 2 - 1] + v[n / 2]) / 2;
 }
 
-int scan_store_blocklist_list(char ssids[][33], int max_entries)
+// Expected time to internet as open_wifi.c ranks candidates, without the RSSI
+// penalty; no recorded time counts as the slowest
+static uint32_t net_cost(const net_cache_entry_t *net)
 {
-    uint8_t count, head;
-    if (get_u8_or_default("bl_count", &count, 0) != ESP_OK) return 0;
-    if (get_u8_or_default("bl_head", &head, 0) != ESP_OK) return 0;
-    if (count == 0) return 0;
-
-    uint8_t n = (count < BLOCKLIST_SIZE) ? count : BLOCKLIST_SIZE;
-    int result = 0;
-    for (uint8_t i = 0; i < n && result < max_entries; i++) {
-        uint8_t slot = (head + i) % BLOCKLIST_SIZE;
-        char key[6];
-        make_bl_key(slot, key);
-        size_t buf_size = 33;
-        if (nvs_get_str(nvs_h, key, ssids[result], &buf_size) == ESP_OK) {
-            result++;
-        }
+    uint32_t tti = scan_store_net_median_tti(net);
+    if (tti == 0) tti = UINT16_MAX;
+    return tti * (net->ok_count + net->fail_count + 2) / (net->ok_count + 1);
+}
+
+// Entry to drop for a new one: highest expected time, then oldest success
+static int net_cache_victim(void)
+{
+    int victim = 0;
+    for (int i = 1; i < s_net.count; i++) {
+        uint32_t ci = net_cost(&s_net.e[i]), cv = net_cost(&s_net.e[victim]);
+        if (ci > cv || (ci == cv && s_net.e[i].last_ok < s_net.e[victim].last_ok)) victim = i;
+    }
+    return victim;
+}
+
+bool scan_store_net_cache_find(const char *ssid, net_cache_entry_t *out)
+{
+    int i = net_cache_index(ssid);
+    if (i >= 0) {
+        *out = s_net.e[i];
+        return true;
+    }
+    i = net_fail_index(ssid_hash(ssid));
+    if (i < 0) return false;
+    memset(out, 0, sizeof(*out));
+    strncpy(out->ssid, ssid, sizeof(out->ssid) - 1);
+    out->fail_count = s_net.fail[i].fail_count;
+    out->last_rssi = s_net.fail[i].last_rssi;
+    return true;
+}
+
+// Never worked and nothing cached: only the failure table
+static esp_err_t net_fail_put(const net_cache_entry_t *entry)
+{
+    net_cache_t *c = net_cache();
+    net_fail_t f = {
+        .hash = ssid_hash(entry->ssid),
+        .fail_count = entry->fail_count,
+        .last_rssi = entry->last_rssi,
+    };
+    int i = net_fail_index(f.hash);
+    if (i < 0) i = c->fail_n < NET_FAIL_MAX ? c->fail_n++ : NET_FAIL_MAX - 1;
+
+    // Move to the front; the least recently tried drops off the end
+    memmove(&c->fail[1], &c->fail[0], i * sizeof(c->fail[0]));
+    c->fail[0] = f;
+
+    bool changed = false;
+    i = net_cache_index(entry->ssid);
+    if (i >= 0) {
+        c->count--;
+        memmove(&c->e[i], &c->e[i + 1], (c->count - i) * sizeof(c->e[0]));
+        changed = true;
+    }
+    if (changed || ++c->unsaved >= NET_CACHE_SAVE_EVERY) return net_cache_save();
+    return ESP_OK;
+}
+
+esp_err_t scan_store_net_cache_put(const net_cache_entry_t *entry)
+{
+    if (entry->last_ok == 0 && entry->channel == 0) return net_fail_put(entry);
+
+    net_cache_t *c = net_cache();
+    int f = net_fail_index(ssid_hash(entry->ssid));
+    if (f >= 0) net_fail_remove(f);
+    int i = net_cache_index(entry->ssid);
+
+    // Only stats changed: written with the next batch
+    bool changed = true;
+    if (i >= 0) {
+        changed = memcmp(&c->e[i], entry, offsetof(net_cache_entry_t, ok_count)) != 0;
+    } else if (c->count < NET_CACHE_MAX) {
+        i = c->count++;
+    } else {
+        i = net_cache_victim();
+        ESP_LOGI(TAG, "Network cache full, dropping '%s'", c->e[i].ssid);
     }
-    return result;
+
+    // Move to the front
+    memmove(&c->e[1], &c->e[0], i * sizeof(c->e[0]));
+    c->e[0] = *entry;
+    c->e[0].ssid[sizeof(c->e[0].ssid) - 1] = '\0';
+
+    if (changed || ++c->unsaved >= NET_CACHE_SAVE_EVERY) return net_cache_save();
+    return ESP_OK;
 }
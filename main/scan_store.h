@@ -5,35 +5,105 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// Scan blob header (11 bytes)
-typedef struct __attribute__((packed)) {
-    uint16_t scan_index;
-    uint8_t  ap_count;
-    int64_t  timestamp;   // UTC epoch seconds (from RTC)
-} scan_header_t;
-
 // Initialize the locator NVS namespace. Call once at startup.
 esp_err_t scan_store_init(void);
 
 // Save a scan to NVS with timestamp. Returns the assigned scan index.
 esp_err_t scan_store_save(const stored_ap_t *aps, uint8_t ap_count, int64_t timestamp, uint16_t *out_index);
 
+// Write scans buffered in RTC memory to flash (CONFIG_LOCATOR_RTC_SCAN_BUFFER).
+// Call before anything that may not return to scan mode, e.g. WiFi connects.
+esp_err_t scan_store_flush(void);
+
 // Load a scan from NVS by index. Caller provides buffer for aps (max_aps entries).
 // Returns actual AP count in *out_ap_count.
 esp_err_t scan_store_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count);
 
-// Get scan header info (ap_count + timestamp) without loading AP data.
+// Get scan header info (ap_count + timestamp) from the index, without loading AP data.
 esp_err_t scan_store_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp);
 
 // Get the range of stored scan indices [*out_head .. *out_count-1]
 esp_err_t scan_store_get_range(uint16_t *out_head, uint16_t *out_count);
 
+// Scan records are packed into segment blobs ("gNNNNN") of up to SCAN_SEGMENT_SIZE
+// bytes, so one NVS entry holds many scans. Sized to fit an NVS page (126 x 32 B).
+// A save writes only the new record ("pNNNNN"); the open segment and its index
+// block are rewritten every few scans.
+#define SCAN_SEGMENT_SIZE    3936
+
+// Scan index entry. Every stored scan has one, packed into small NVS blocks
+// ("xNNNN", SCAN_INDEX_BLOCK entries each) so listings never touch AP data.
+#define SCAN_INDEX_BLOCK     16
+#define SCAN_INDEX_F_VALID   0x01
+#define SCAN_INDEX_F_LOCATED 0x02
+
+typedef struct __attribute__((packed)) {
+    int64_t  timestamp;
+    uint8_t  ap_count;
+    uint8_t  flags;                                       // SCAN_INDEX_F_*
+    uint16_t bssid_hash[CONFIG_LOCATOR_MAX_APS_PER_SCAN]; // 16-bit digest per BSSID
+    int32_t  lat_e6;                                      // cached location (1e-6 deg)
+    int32_t  lng_e6;
+    uint16_t accuracy;                                    // metres
+    uint16_t segment;                                     // segment holding the AP data
+} scan_index_entry_t;
+
+// Called for each stored scan in index order. Return false to stop iterating.
+typedef bool (*scan_header_cb_t)(uint16_t index, const scan_index_entry_t *entry, void *ctx);
+
+// Walk the index entries of all stored scans, oldest first (one NVS read per block).
+esp_err_t scan_store_iterate_headers(scan_header_cb_t cb, void *ctx);
+// Same, starting at index `from`; the blocks before it aren't read
+esp_err_t scan_store_iterate_headers_from(uint16_t from, scan_header_cb_t cb, void *ctx);
+
+// First index whose scan has timestamp >= t, or the scan count if none has.
+// Binary search: timestamps grow with the index.
+uint16_t scan_store_find_time(int64_t t);
+
+// Changes with every scan saved or deleted and every location cached, and
+// starts from a random value at boot (for HTTP ETags)
+uint32_t scan_store_generation(void);
+
+// Symmetric difference of the BSSID sets of two index entries (from the digests).
+int scan_store_digest_diff(const scan_index_entry_t *a, const scan_index_entry_t *b);
+
 // Delete a single scan by index
 esp_err_t scan_store_delete(uint16_t index);
 
 // Delete all scans
 esp_err_t scan_store_delete_all(void);
 
+// Timing of one scan-mode wake cycle, in ms. Phases that didn't run are 0.
+#define CYCLE_STATS_MAX      32
+#define CYCLE_F_HOME         0x01   // home WiFi connected
+#define CYCLE_F_OPEN         0x02   // open WiFi connected
+#define CYCLE_F_PORTAL       0x04   // captive portal handled
+#define CYCLE_F_SAVE_FAILED  0x08
+#define CYCLE_F_MOVED        0x10   // BSSIDs changed significantly since the last scan
+#define CYCLE_F_DUPLICATE    0x20   // same BSSIDs as the last scan, not stored
+
+typedef struct __attribute__((packed)) {
+    int64_t  timestamp;     // scan time (epoch seconds)
+    uint16_t scan_index;    // 0xFFFF if nothing was saved
+    uint8_t  ap_count;
+    uint8_t  flags;         // CYCLE_F_*
+    uint16_t boot_ms;       // esp_timer start to scan start
+    uint16_t scan_ms;
+    uint16_t save_ms;
+    uint16_t connect_ms;    // WiFi association + DHCP, all candidates
+    uint16_t portal_ms;
+    uint16_t sntp_ms;
+    uint16_t mqtt_ms;
+    uint16_t total_ms;      // esp_timer start to deep sleep
+    uint16_t sleep_s;       // interval chosen for the following sleep
+} cycle_stats_t;
+
+// Append a finished cycle to the stats ring (RTC memory, saved to NVS on flush)
+void scan_store_add_cycle_stats(const cycle_stats_t *stats);
+
+// Copy up to max recorded cycles, oldest first. Returns the number copied.
+int scan_store_get_cycle_stats(cycle_stats_t *out, int max);
+
 // Get/set API key (up to 128 chars)
 esp_err_t scan_store_get_api_key(char *buf, size_t buf_size);
 esp_err_t scan_store_set_api_key(const char *key);
@@ -43,7 +113,16 @@ esp_err_t scan_store_set_api_key(const char *key);
 uint16_t scan_store_get_scan_interval(void);
 esp_err_t scan_store_set_scan_interval(uint16_t seconds);
 
-// Location cache per scan (stored as separate NVS blob)
+// Adaptive interval: while stationary the interval doubles each cycle up to
+// this maximum (seconds); 0 = fixed interval
+uint16_t  scan_store_get_scan_interval_max(void);
+esp_err_t scan_store_set_scan_interval_max(uint16_t seconds);
+
+// Don't store scans whose BSSIDs are identical to the previous scan
+bool      scan_store_get_skip_duplicates(void);
+esp_err_t scan_store_set_skip_duplicates(bool skip);
+
+// Location cache per scan (kept in the scan index entry)
 typedef struct __attribute__((packed)) {
     double lat;
     double lng;
@@ -96,11 +175,107 @@ esp_err_t scan_store_get_mqtt_password(char *buf, size_t buf_size);
 esp_err_t scan_store_set_mqtt_password(const char *pass);
 uint16_t  scan_store_get_mqtt_cycle_counter(void);
 esp_err_t scan_store_set_mqtt_cycle_counter(uint16_t count);
+// Ask the broker to keep the session between wake cycles (clean session off,
+// needs a client ID)
+bool      scan_store_get_mqtt_persist(void);
+esp_err_t scan_store_set_mqtt_persist(bool on);
+
+// Incremental "publish all": every connection sends only the scans from the
+// high-water mark on, in QoS 1 messages of up to mqtt_batch scans
+bool      scan_store_get_mqtt_incremental(void);
+esp_err_t scan_store_set_mqtt_incremental(bool on);
+#define MQTT_BATCH_DEFAULT 20
+uint8_t   scan_store_get_mqtt_batch(void);
+esp_err_t scan_store_set_mqtt_batch(uint8_t scans);
+// Index of the first scan the broker hasn't acknowledged. Reset when the
+// all-scans URL changes or all scans are deleted.
+uint16_t  scan_store_get_mqtt_mark(void);
+esp_err_t scan_store_set_mqtt_mark(uint16_t index);
+
+// Outbox of scans still to be published to the last-scan URL, oldest first.
+// Kept in RTC memory and written to NVS on flush and every few pushes; a full
+// outbox drops its oldest entry. Cleared when all scans are deleted.
+#define MQTT_OUTBOX_MAX     64
+#define MQTT_OUTBOX_RETRIES 5    // failed attempts before an entry is dropped
+
+typedef struct __attribute__((packed)) {
+    uint16_t scan_index;
+    uint8_t  retries;       // failed publish attempts so far
+    uint8_t  reserved;
+} mqtt_outbox_entry_t;
 
-// Open WiFi SSID blocklist (FIFO ring buffer, 10 slots)
-#define BLOCKLIST_SIZE 10
-bool      scan_store_blocklist_contains(const char *ssid);
-esp_err_t scan_store_blocklist_add(const char *ssid);
+esp_err_t scan_store_outbox_push(uint16_t index);
+// Copy up to max entries, oldest first. Returns the number copied.
+int       scan_store_outbox_peek(mqtt_outbox_entry_t *out, int max);
+// Remove the `sent` oldest entries; if failed, count a failed attempt against
+// the next one. Saved to NVS right away.
+esp_err_t scan_store_outbox_done(int sent, bool failed);
+
+// Open WiFi blocklist, oldest entry dropped when full
+#define BLOCKLIST_SIZE 200
+
+#define BL_REASON_PORTAL   0   // captive portal could not be passed
+#define BL_REASON_PASSWORD 1   // portal asks for a password
+
+typedef struct __attribute__((packed)) {
+    uint32_t hash;          // FNV-1a of ssid
+    uint8_t  bssid[6];      // all zero = every BSSID with this SSID
+    uint8_t  reason;        // BL_REASON_*
+    uint8_t  reserved;
+    int64_t  expires;       // epoch seconds, 0 = never
+    char     ssid[33];
+} blocklist_entry_t;
+
+// Live entries read once for many lookups (SSID hash, BSSID and expiry only).
+// NULL if the list can't be read; lookups in a NULL snapshot find nothing.
+typedef struct blocklist_snapshot blocklist_snapshot_t;
+blocklist_snapshot_t *scan_store_blocklist_snapshot(void);
+// bssid may be NULL (matches SSID-wide entries only)
+bool      scan_store_blocklist_snapshot_contains(const blocklist_snapshot_t *snap,
+                                                 const char *ssid, const uint8_t *bssid);
+void      scan_store_blocklist_snapshot_free(blocklist_snapshot_t *snap);
+// ttl_sec 0 = permanent; bssid NULL = block every BSSID with this SSID
+esp_err_t scan_store_blocklist_add(const char *ssid, const uint8_t *bssid, uint8_t reason,
+                                   uint32_t ttl_sec);
+// Removes every entry for ssid
 esp_err_t scan_store_blocklist_delete(const char *ssid);
 esp_err_t scan_store_blocklist_clear(void);
-int       scan_store_blocklist_list(char ssids[][33], int max_entries);
+// Unexpired entries, oldest first
+int       scan_store_blocklist_count(void);
+int       scan_store_blocklist_list(blocklist_entry_t *out, int offset, int max_entries);
+
+// Per-network connection cache and open WiFi candidate stats for scan mode.
+// Networks that gave internet access at least once (last_ok set) keep a full
+// entry; when full, the one with the highest expected time to internet is
+// dropped. Networks that never did only keep their failure count and RSSI in
+// a compact table of NET_FAIL_MAX, most recently used first, so they can't
+// push out networks that work. Kept in RTC memory; written to NVS right away
+// when the cached connection changes, and every few updates for the stats.
+#define NET_CACHE_MAX 12
+#define NET_FAIL_MAX  32
+#define NET_F_PORTAL  0x01   // a captive portal was passed on this network
+#define NET_TTI_SAMPLES 3
+
+typedef struct __attribute__((packed)) {
+    char     ssid[33];
+    uint8_t  bssid[6];
+    uint8_t  channel;       // 0 = no cached connection
+    uint8_t  flags;         // NET_F_*
+    uint32_t ip;            // DHCP lease, network byte order; 0 = none
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+    int64_t  leased;        // when the lease was obtained (epoch seconds)
+    // Stats (not a reason for an immediate NVS write)
+    uint8_t  ok_count;      // connections with internet access
+    uint8_t  fail_count;    // attempts without
+    int8_t   last_rssi;
+    uint8_t  tti_next;      // next slot in tti_ms
+    uint16_t tti_ms[NET_TTI_SAMPLES];  // recent times to internet, 0 = empty
+    int64_t  last_ok;       // last connection with internet access
+} net_cache_entry_t;
+
+bool      scan_store_net_cache_find(const char *ssid, net_cache_entry_t *out);
+esp_err_t scan_store_net_cache_put(const net_cache_entry_t *entry);
+// Median of the recorded times to internet (ms), 0 if none
+uint32_t  scan_store_net_median_tti(const net_cache_entry_t *net);
@@ -2,10 +2,21 @@
 #include "scan_store.h"
 #include "geolocation.h"
 #include "wifi_connect.h"
+#include "wifi_scan.h"
+#include "gz_stream.h"
+#include "scan_json.h"
+#include "index_html_hash.h"
 #include "esp_log.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <time.h>
 #include <sys/param.h>
 #include "mbedtls/base64.h"
 #include "lwip/sockets.h"
@@ -19,29 +30,20 @@ void web_server_set_sleep_callback(sleep_callback_t cb)
     s_sleep_cb = cb;
 }
 
-// Embedded HTML file
+// Embedded HTML file, plain and gzip-compressed at build time
 extern const uint8_t index_html_start[] asm("_binary_index_html_start");
 extern const uint8_t index_html_end[]   asm("_binary_index_html_end");
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[]   asm("_binary_index_html_gz_end");
+
+// Each encoding of the page gets its own ETag
+#define INDEX_ETAG    "\"" INDEX_HTML_HASH "\""
+#define INDEX_GZ_ETAG "\"" INDEX_HTML_HASH "-gz\""
 
 // Embedded favicon
 extern const uint8_t favicon_png_start[] asm("_binary_favicon_png_start");
 extern const uint8_t favicon_png_end[]   asm("_binary_favicon_png_end");
 
-static const char *authmode_str(uint8_t mode)
-{
-    switch (mode) {
-        case 0: return "OPEN";
-        case 1: return "WEP";
-        case 2: return "WPA_PSK";
-        case 3: return "WPA2_PSK";
-        case 4: return "WPA_WPA2_PSK";
-        case 5: return "WPA2_ENTERPRISE";
-        case 6: return "WPA3_PSK";
-        case 7: return "WPA2_WPA3_PSK";
-        default: return "UNKNOWN";
-    }
-}
-
 // Set CORS headers so external clients (e.g. locator.html) can access the API
 static void set_cors_headers(httpd_req_t *req)
 {
@@ -102,13 +104,214 @@ unauthorized:
     return false;
 }
 
-// GET / — serve index.html
+// ---------- Async worker pool ----------
+// Slow handlers (a TLS round trip to Google, a blocking WiFi scan) run on a
+// few worker tasks via httpd's async request API, so the httpd task stays
+// free for the UI. At most ASYNC_SLOTS requests are queued or running; past
+// that the client gets 503. A job that waits in the queue past its route's
+// timeout gets 503 too, and long-running jobs poll async_expired().
+//
+// A job holds a copy of its request, which belongs to the server, so a
+// server stopped while jobs are out is only torn down (httpd_stop) by the
+// worker that finishes the last one. Stopping never blocks the caller.
+#define ASYNC_WORKERS       2
+#define ASYNC_QUEUE_LEN     2
+#define ASYNC_SLOTS         (ASYNC_WORKERS + ASYNC_QUEUE_LEN)  // < max_open_sockets
+#define ASYNC_WORKER_STACK  10240  // TLS handshake for Google API needs extra stack
+
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *req);
+    uint32_t timeout_ms;
+} async_route_t;
+
+// While a job runs, its (copied) request's user_ctx points at it
+typedef struct {
+    httpd_req_t *req;
+    const async_route_t *route;
+    int64_t deadline_us;
+} async_job_t;
+
+static QueueHandle_t s_async_queue = NULL;
+static portMUX_TYPE s_async_lock = portMUX_INITIALIZER_UNLOCKED;
+static int s_async_jobs = 0;                    // queued or running
+static volatile bool s_async_stopping = false;
+static httpd_handle_t s_async_stop_server = NULL;  // httpd_stop() left to the last job
+// Held while a worker runs a deferred httpd_stop(), so a restart can't race it
+static SemaphoreHandle_t s_async_stop_mutex = NULL;
+
+// True once the job's deadline has passed or the server is stopping
+static bool async_expired(httpd_req_t *req)
+{
+    const async_job_t *job = req->user_ctx;
+    return s_async_stopping || esp_timer_get_time() > job->deadline_us;
+}
+
+static void async_run(async_job_t *job)
+{
+    job->req->user_ctx = job;
+    if (async_expired(job->req)) {
+        ESP_LOGW(TAG, "%s expired before a worker was free", job->req->uri);
+        set_cors_headers(job->req);
+        httpd_resp_set_status(job->req, "503 Service Unavailable");
+        httpd_resp_sendstr(job->req, "Timed out waiting for a worker");
+        return;
+    }
+    job->route->handler(job->req);
+}
+
+static void async_worker_task(void *arg)
+{
+    async_job_t job;
+    for (;;) {
+        xQueueReceive(s_async_queue, &job, portMAX_DELAY);
+        async_run(&job);
+        httpd_req_async_handler_complete(job.req);
+
+        xSemaphoreTake(s_async_stop_mutex, portMAX_DELAY);
+        httpd_handle_t stop = NULL;
+        portENTER_CRITICAL(&s_async_lock);
+        if (--s_async_jobs == 0) {
+            stop = s_async_stop_server;
+            s_async_stop_server = NULL;
+        }
+        portEXIT_CRITICAL(&s_async_lock);
+        if (stop) {
+            httpd_stop(stop);
+            ESP_LOGI(TAG, "Web server stopped after its last async job");
+        }
+        xSemaphoreGive(s_async_stop_mutex);
+    }
+}
+
+static void async_workers_start(void)
+{
+    s_async_stopping = false;
+    if (s_async_queue) return;  // workers outlive server restarts
+    s_async_queue = xQueueCreate(ASYNC_QUEUE_LEN, sizeof(async_job_t));
+    s_async_stop_mutex = xSemaphoreCreateMutex();
+    if (!s_async_queue || !s_async_stop_mutex) {
+        ESP_LOGE(TAG, "No memory for async workers, slow handlers run inline");
+        if (s_async_queue) vQueueDelete(s_async_queue);
+        if (s_async_stop_mutex) vSemaphoreDelete(s_async_stop_mutex);
+        s_async_queue = NULL;
+        s_async_stop_mutex = NULL;
+        return;
+    }
+    for (int i = 0; i < ASYNC_WORKERS; i++) {
+#ifdef CONFIG_FREERTOS_UNICORE
+        xTaskCreate(async_worker_task, "httpd_async", ASYNC_WORKER_STACK, NULL, 4, NULL);
+#else
+        // The httpd task is pinned to core 0
+        xTaskCreatePinnedToCore(async_worker_task, "httpd_async", ASYNC_WORKER_STACK,
+                                NULL, 4, NULL, 1);
+#endif
+    }
+}
+
+// Expire all jobs (queued ones get 503, long ones stop at their next
+// async_expired()). Returns true if the server can be stopped now; otherwise
+// the worker that finishes the last job stops it.
+static bool async_workers_stop(httpd_handle_t server)
+{
+    if (!s_async_queue) return true;
+    portENTER_CRITICAL(&s_async_lock);
+    s_async_stopping = true;
+    int jobs = s_async_jobs;
+    if (jobs > 0) s_async_stop_server = server;
+    portEXIT_CRITICAL(&s_async_lock);
+    if (jobs > 0) ESP_LOGI(TAG, "Web server stops after %d async jobs", jobs);
+    return jobs == 0;
+}
+
+// A server whose stop is still waiting for its jobs is kept instead of
+// starting a second one on the same port. Returns NULL if there is none.
+static httpd_handle_t async_workers_resume(void)
+{
+    if (!s_async_queue) return NULL;
+    // Wait out a deferred httpd_stop() already running, so the port is free
+    xSemaphoreTake(s_async_stop_mutex, portMAX_DELAY);
+    portENTER_CRITICAL(&s_async_lock);
+    httpd_handle_t server = s_async_stop_server;
+    s_async_stop_server = NULL;
+    s_async_stopping = false;
+    portEXIT_CRITICAL(&s_async_lock);
+    xSemaphoreGive(s_async_stop_mutex);
+    return server;
+}
+
+// URI handler for routes whose user_ctx is an async_route_t: check auth here,
+// then hand a copy of the request to a worker
+static esp_err_t async_dispatch(httpd_req_t *req)
+{
+    if (!check_auth(req)) return ESP_OK;
+    const async_route_t *route = req->user_ctx;
+    async_job_t job = {
+        .route = route,
+        .deadline_us = esp_timer_get_time() + (int64_t)route->timeout_ms * 1000,
+    };
+
+    if (!s_async_queue) {
+        job.req = req;
+        async_run(&job);
+        return ESP_OK;
+    }
+    portENTER_CRITICAL(&s_async_lock);
+    bool busy = s_async_stopping || s_async_jobs >= ASYNC_SLOTS;
+    if (!busy) s_async_jobs++;
+    portEXIT_CRITICAL(&s_async_lock);
+    if (busy) {
+        set_cors_headers(req);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        httpd_resp_sendstr(req, "Busy, try again later");
+        return ESP_OK;
+    }
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        portENTER_CRITICAL(&s_async_lock);
+        s_async_jobs--;
+        portEXIT_CRITICAL(&s_async_lock);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+    xQueueSend(s_async_queue, &job, portMAX_DELAY);  // a slot guarantees room
+    return ESP_OK;
+}
+
+static bool accepts_gzip(httpd_req_t *req)
+{
+    char enc[64];
+    return httpd_req_get_hdr_value_str(req, "Accept-Encoding", enc, sizeof(enc)) == ESP_OK &&
+           strstr(enc, "gzip") != NULL;
+}
+
+// GET / — serve index.html, compressed when the client accepts it.
+// Browsers revalidate on each load and get a 304 until the firmware changes.
 static esp_err_t index_get_handler(httpd_req_t *req)
 {
     if (!check_auth(req)) return ESP_OK;
+
+    bool gz = accepts_gzip(req);
+    const char *etag = gz ? INDEX_GZ_ETAG : INDEX_ETAG;
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    char inm[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK &&
+        strstr(inm, etag) != NULL) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
     httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, (const char *)index_html_start,
-                    index_html_end - index_html_start);
+    if (gz) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        httpd_resp_send(req, (const char *)index_html_gz_start,
+                        index_html_gz_end - index_html_gz_start);
+    } else {
+        httpd_resp_send(req, (const char *)index_html_start,
+                        index_html_end - index_html_start);
+    }
     return ESP_OK;
 }
 
@@ -123,99 +326,164 @@ static esp_err_t favicon_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// Compute symmetric difference between two BSSID sets
-static int bssid_diff(const uint8_t prev[][6], uint8_t prev_n,
-                      const uint8_t curr[][6], uint8_t curr_n)
+// Chunked response body, gzip-compressed when the client accepts it
+typedef struct {
+    httpd_req_t *req;
+    gz_stream_t *gz;
+} resp_stream_t;
+
+static bool resp_gz_out(const uint8_t *data, size_t len, void *arg)
 {
-    int diffs = 0;
-    // MACs in curr not in prev
-    for (uint8_t i = 0; i < curr_n; i++) {
-        bool found = false;
-        for (uint8_t j = 0; j < prev_n; j++) {
-            if (memcmp(curr[i], prev[j], 6) == 0) { found = true; break; }
-        }
-        if (!found) diffs++;
-    }
-    // MACs in prev not in curr
-    for (uint8_t i = 0; i < prev_n; i++) {
-        bool found = false;
-        for (uint8_t j = 0; j < curr_n; j++) {
-            if (memcmp(prev[i], curr[j], 6) == 0) { found = true; break; }
+    return httpd_resp_send_chunk((httpd_req_t *)arg, (const char *)data, len) == ESP_OK;
+}
+
+// Call after setting the content type, before the first write
+static void resp_stream_begin(resp_stream_t *rs, httpd_req_t *req)
+{
+    rs->req = req;
+    rs->gz = NULL;
+    if (accepts_gzip(req)) {
+        rs->gz = gz_stream_create(resp_gz_out, req);
+        if (rs->gz) {
+            gz_stream_begin(rs->gz);
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
         }
-        if (!found) diffs++;
     }
-    return diffs;
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
 }
 
-// GET /api/scans — list all scans (chunked response, low memory)
-static esp_err_t api_scans_get_handler(httpd_req_t *req)
+static bool resp_stream_write(resp_stream_t *rs, const char *data, size_t len)
 {
-    set_cors_headers(req);
-    if (!check_auth(req)) return ESP_OK;
-    uint16_t head, count;
-    esp_err_t err = scan_store_get_range(&head, &count);
-    if (err != ESP_OK) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "NVS error");
-        return ESP_OK;
+    if (rs->gz) return gz_stream_write(rs->gz, data, len);
+    return httpd_resp_send_chunk(rs->req, data, len) == ESP_OK;
+}
+
+static void resp_stream_end(resp_stream_t *rs)
+{
+    if (rs->gz) {
+        gz_stream_finish(rs->gz);
+        gz_stream_free(rs->gz);
+        rs->gz = NULL;
     }
+    httpd_resp_send_chunk(rs->req, NULL, 0);
+}
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send_chunk(req, "[", 1);
+typedef struct {
+    resp_stream_t *rs;
+    scan_index_entry_t prev;
+    bool has_prev;
+    bool first;
+    uint32_t start;     // first index listed; the one before only seeds diffs
+    int64_t to;         // stop after this timestamp
+    uint32_t skip;      // offset: matching scans not listed yet
+    uint32_t limit;     // scans still to list
+} scan_list_ctx_t;
+
+static bool scan_list_entry_cb(uint16_t index, const scan_index_entry_t *entry, void *arg)
+{
+    scan_list_ctx_t *ctx = (scan_list_ctx_t *)arg;
+    if (index >= ctx->start && entry->timestamp > ctx->to) return false;
+    if (index < ctx->start || ctx->skip) {
+        if (index >= ctx->start) ctx->skip--;
+        ctx->prev = *entry;
+        ctx->has_prev = true;
+        return true;
+    }
+    if (ctx->limit == 0) return false;
+    ctx->limit--;
 
-    uint8_t prev_bssids[CONFIG_LOCATOR_MAX_APS_PER_SCAN][6];
-    uint8_t curr_bssids[CONFIG_LOCATOR_MAX_APS_PER_SCAN][6];
-    uint8_t prev_count = 0;
-    bool has_prev = false;
-    bool first = true;
     char chunk[256];
 
-    for (uint16_t i = head; i < count; i++) {
-        stored_ap_t tmp_aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
-        uint8_t ap_count = 0;
-        err = scan_store_load(i, tmp_aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count);
-        if (err != ESP_OK) continue;
+    int len = snprintf(chunk, sizeof(chunk),
+                       "%s{\"id\":%u,\"aps\":%u,\"timestamp\":%lld",
+                       ctx->first ? "" : ",", index, entry->ap_count, (long long)entry->timestamp);
 
-        // Extract BSSIDs for diff
-        for (uint8_t j = 0; j < ap_count; j++) {
-            memcpy(curr_bssids[j], tmp_aps[j].bssid, 6);
-        }
+    // Symmetric difference of BSSIDs against the previous scan
+    if (ctx->has_prev) {
+        len += snprintf(chunk + len, sizeof(chunk) - len, ",\"diffs\":%d",
+                        scan_store_digest_diff(&ctx->prev, entry));
+    }
 
-        int diffs = -1;  // -1 = no previous scan
-        if (has_prev) {
-            diffs = bssid_diff(prev_bssids, prev_count, curr_bssids, ap_count);
-        }
+    // Include cached location if available
+    if (entry->flags & SCAN_INDEX_F_LOCATED) {
+        len += snprintf(chunk + len, sizeof(chunk) - len,
+                        ",\"lat\":%.6f,\"lng\":%.6f,\"accuracy\":%u",
+                        entry->lat_e6 / 1e6, entry->lng_e6 / 1e6, entry->accuracy);
+    }
 
-        int64_t timestamp = 0;
-        scan_store_get_scan_info(i, NULL, &timestamp);
+    len += snprintf(chunk + len, sizeof(chunk) - len, "}");
+    ctx->first = false;
+    ctx->prev = *entry;
+    ctx->has_prev = true;
+    return resp_stream_write(ctx->rs, chunk, len);
+}
 
-        int len = snprintf(chunk, sizeof(chunk),
-                           "%s{\"id\":%u,\"aps\":%u,\"timestamp\":%lld",
-                           first ? "" : ",", i, ap_count, (long long)timestamp);
+// GET /api/scans — list scans from the scan index (chunked response, low memory)
+//   ?since_id=N      only scans after N
+//   ?from=T&to=T     only scans with timestamps in [from, to] (epoch seconds)
+//   ?offset=N&limit=M  page through what matches
+// The ETag is the store generation, so an unchanged list costs a 304.
+// X-Scan-Range ("head-count") lets a client that fetches only new scans
+// drop the ones evicted or deleted since.
+static esp_err_t api_scans_get_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+    if (!check_auth(req)) return ESP_OK;
 
-        if (diffs >= 0) {
-            len += snprintf(chunk + len, sizeof(chunk) - len, ",\"diffs\":%d", diffs);
-        }
+    char etag[16];
+    snprintf(etag, sizeof(etag), "W/\"%08lx\"", (unsigned long)scan_store_generation());
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    uint16_t head = 0, count = 0;
+    scan_store_get_range(&head, &count);
+    char range[12];
+    snprintf(range, sizeof(range), "%u-%u", head, count);
+    httpd_resp_set_hdr(req, "X-Scan-Range", range);
+    char inm[24];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK &&
+        strcmp(inm, etag) == 0) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
 
-        // Include cached location if available
-        scan_location_t loc;
-        if (scan_store_get_location(i, &loc) == ESP_OK) {
-            len += snprintf(chunk + len, sizeof(chunk) - len,
-                            ",\"lat\":%.6f,\"lng\":%.6f,\"accuracy\":%.0f",
-                            loc.lat, loc.lng, loc.accuracy);
+    scan_list_ctx_t ctx = { .first = true, .to = INT64_MAX, .limit = UINT32_MAX };
+    char query[128];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char val[24];
+        if (httpd_query_key_value(query, "since_id", val, sizeof(val)) == ESP_OK) {
+            ctx.start = MAX(ctx.start, (uint32_t)atoi(val) + 1);
         }
+        if (httpd_query_key_value(query, "from", val, sizeof(val)) == ESP_OK) {
+            ctx.start = MAX(ctx.start, scan_store_find_time(strtoll(val, NULL, 10)));
+        }
+        if (httpd_query_key_value(query, "to", val, sizeof(val)) == ESP_OK) {
+            ctx.to = strtoll(val, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "offset", val, sizeof(val)) == ESP_OK) {
+            ctx.skip = (uint32_t)atoi(val);
+        }
+        if (httpd_query_key_value(query, "limit", val, sizeof(val)) == ESP_OK) {
+            ctx.limit = (uint32_t)atoi(val);
+        }
+    }
 
-        len += snprintf(chunk + len, sizeof(chunk) - len, "}");
-        httpd_resp_send_chunk(req, chunk, len);
-        first = false;
-
-        // Swap current to previous
-        memcpy(prev_bssids, curr_bssids, ap_count * 6);
-        prev_count = ap_count;
-        has_prev = true;
+    httpd_resp_set_type(req, "application/json");
+    resp_stream_t rs;
+    resp_stream_begin(&rs, req);
+    resp_stream_write(&rs, "[", 1);
+
+    // Start one early so the first listed scan still gets its diffs
+    ctx.rs = &rs;
+    uint32_t from = ctx.start ? ctx.start - 1 : 0;
+    esp_err_t err = scan_store_iterate_headers_from((uint16_t)MIN(from, UINT16_MAX),
+                                                    scan_list_entry_cb, &ctx);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Scan index read failed: %s", esp_err_to_name(err));
     }
 
-    httpd_resp_send_chunk(req, "]", 1);
-    httpd_resp_send_chunk(req, NULL, 0);
+    resp_stream_write(&rs, "]", 1);
+    resp_stream_end(&rs);
     return ESP_OK;
 }
 
@@ -234,75 +502,228 @@ static esp_err_t api_scans_delete_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+// Scan ids selected by "ids=1,5,9" and/or "from=A&to=B" (inclusive, either
+// end optional), limited to the stored range. No query = every scan.
+#define SCAN_IDS_QUERY_MAX 2048
+
+// Optional parts of a scan object ("fields=aps,location"); id and timestamp
+// are always there
+#define SCAN_FIELD_APS      0x01
+#define SCAN_FIELD_LOCATION 0x02
+#define SCAN_FIELDS_ALL     (SCAN_FIELD_APS | SCAN_FIELD_LOCATION)
+
+typedef struct {
+    char       *list;       // malloc'd "ids" value, NULL = every id in range
+    const char *pos;
+    uint32_t    cur;
+    uint32_t    from;
+    uint32_t    end;        // exclusive
+    bool        single;     // "id=N": just that scan
+} scan_ids_t;
+
+static void scan_ids_all(scan_ids_t *ids)
+{
+    uint16_t head = 0, count = 0;
+    scan_store_get_range(&head, &count);
+    memset(ids, 0, sizeof(*ids));
+    ids->from = head;
+    ids->cur = head;
+    ids->end = count;
+}
+
+// Also reads "fields" into *fields if not NULL (unchanged when absent)
+static void scan_ids_init(httpd_req_t *req, scan_ids_t *ids, uint8_t *fields)
+{
+    scan_ids_all(ids);
+
+    size_t qlen = httpd_req_get_url_query_len(req);
+    char *query = (qlen && qlen <= SCAN_IDS_QUERY_MAX) ? malloc(qlen + 1) : NULL;
+    if (query && httpd_req_get_url_query_str(req, query, qlen + 1) == ESP_OK) {
+        char val[8];
+        if (httpd_query_key_value(query, "from", val, sizeof(val)) == ESP_OK) {
+            ids->from = MAX(ids->from, (uint32_t)atoi(val));
+        }
+        if (httpd_query_key_value(query, "to", val, sizeof(val)) == ESP_OK) {
+            ids->end = MIN(ids->end, (uint32_t)atoi(val) + 1);
+        }
+        if (httpd_query_key_value(query, "id", val, sizeof(val)) == ESP_OK) {
+            uint32_t id = (uint32_t)atoi(val);
+            ids->single = true;
+            ids->from = MAX(ids->from, id);
+            ids->end = MIN(ids->end, id + 1);
+        }
+        ids->list = malloc(qlen + 1);
+        if (ids->list && httpd_query_key_value(query, "ids", ids->list, qlen + 1) != ESP_OK) {
+            free(ids->list);
+            ids->list = NULL;
+        }
+        ids->pos = ids->list;
+
+        char names[32];
+        if (fields && httpd_query_key_value(query, "fields", names, sizeof(names)) == ESP_OK) {
+            *fields = (strstr(names, "aps") ? SCAN_FIELD_APS : 0) |
+                      (strstr(names, "location") ? SCAN_FIELD_LOCATION : 0);
+        }
+    }
+    free(query);
+    ids->cur = ids->from;
+}
+
+static bool scan_ids_next(scan_ids_t *ids, uint16_t *out)
+{
+    if (!ids->list) {
+        if (ids->cur >= ids->end) return false;
+        *out = (uint16_t)ids->cur++;
+        return true;
+    }
+    while (*ids->pos) {
+        // Separators: ',' or its URL encoding
+        if (strncasecmp(ids->pos, "%2C", 3) == 0) {
+            ids->pos += 3;
+            continue;
+        }
+        char *end;
+        long id = strtol(ids->pos, &end, 10);
+        if (end == ids->pos) {
+            ids->pos++;
+            continue;
+        }
+        ids->pos = end;
+        if (id >= 0 && (uint32_t)id >= ids->from && (uint32_t)id < ids->end) {
+            *out = (uint16_t)id;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void scan_ids_free(scan_ids_t *ids)
+{
+    free(ids->list);
+    ids->list = NULL;
+}
+
+// Stream the selected scans as a JSON array of /api/scan objects. Scans are
+// read in order and serialized into a fixed buffer that goes out whenever it
+// can't take another scan. The buffer holds at least two of the largest scans.
+#define SCAN_STREAM_BUF_BYTES MAX(8192, (2 * (SCAN_JSON_MAX + 2) + 1023) & ~1023)
+
+static void send_scans(httpd_req_t *req, scan_ids_t *ids, uint8_t fields)
+{
+    char *buf = malloc(SCAN_STREAM_BUF_BYTES);
+    if (!buf) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    resp_stream_t rs;
+    resp_stream_begin(&rs, req);
+
+    size_t len = 0;
+    buf[len++] = '[';
+    bool ok = true;
+    uint16_t sent = 0;
+    uint16_t id;
+    while (ok && scan_ids_next(ids, &id)) {
+        stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+        uint8_t ap_count = 0;
+        int64_t timestamp = 0;
+        if (scan_store_get_scan_info(id, NULL, &timestamp) != ESP_OK) continue;
+        if ((fields & SCAN_FIELD_APS) &&
+            scan_store_load(id, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK) {
+            continue;
+        }
+        scan_location_t loc;
+        bool has_loc = (fields & SCAN_FIELD_LOCATION) && scan_store_get_location(id, &loc) == ESP_OK;
+
+        if (SCAN_STREAM_BUF_BYTES - len < SCAN_JSON_MAX + 2) {  // ',' scan ']'
+            ok = resp_stream_write(&rs, buf, len);
+            len = 0;
+        }
+        // The separator goes in only once the scan is actually written
+        size_t sep = sent ? 1 : 0;
+        size_t n = scan_json_write(buf + len + sep, SCAN_STREAM_BUF_BYTES - len - sep, id,
+                                   timestamp, (fields & SCAN_FIELD_APS) ? aps : NULL, ap_count,
+                                   has_loc ? &loc : NULL);
+        if (n == 0) continue;
+        if (sep) buf[len] = ',';
+        len += sep + n;
+        sent++;
+    }
+    buf[len++] = ']';
+    if (ok) resp_stream_write(&rs, buf, len);
+    resp_stream_end(&rs);
+    free(buf);
+    ESP_LOGI(TAG, "Sent %u scans%s", sent, ok ? "" : " (client gone)");
+}
+
+// GET /api/export — the whole history (APs and cached locations) as one JSON
+// array in a single pass over the store
+static esp_err_t api_export_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+    if (!check_auth(req)) return ESP_OK;
+
+    scan_ids_t ids;
+    scan_ids_all(&ids);
+    send_scans(req, &ids, SCAN_FIELDS_ALL);
+    return ESP_OK;
+}
+
 // GET /api/scan?id=N — full scan detail
+// GET /api/scan?ids=1,5,9 / ?from=A&to=B — JSON array of the matching scans
+// Either form takes "fields=aps,location" to send only those parts.
 static esp_err_t api_scan_get_handler(httpd_req_t *req)
 {
     set_cors_headers(req);
     if (!check_auth(req)) return ESP_OK;
-    char buf[16];
-    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK) {
+
+    if (httpd_req_get_url_query_len(req) == 0) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing query");
         return ESP_OK;
     }
-    char id_str[8];
-    if (httpd_query_key_value(buf, "id", id_str, sizeof(id_str)) != ESP_OK) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing id");
+    uint8_t fields = SCAN_FIELDS_ALL;
+    scan_ids_t ids;
+    scan_ids_init(req, &ids, &fields);
+
+    if (!ids.single) {
+        send_scans(req, &ids, fields);
+        scan_ids_free(&ids);
         return ESP_OK;
     }
-    uint16_t id = (uint16_t)atoi(id_str);
-
-    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
-    uint8_t ap_count = 0;
-    esp_err_t err = scan_store_load(id, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count);
-    if (err != ESP_OK) {
+    uint16_t id;
+    bool found = scan_ids_next(&ids, &id);
+    scan_ids_free(&ids);
+    if (!found) {
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Scan not found");
         return ESP_OK;
     }
 
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t ap_count = 0;
     int64_t timestamp = 0;
-    scan_store_get_scan_info(id, NULL, &timestamp);
-
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "id", id);
-    cJSON_AddNumberToObject(root, "timestamp", (double)timestamp);
-    cJSON *arr = cJSON_AddArrayToObject(root, "aps");
-
-    for (uint8_t i = 0; i < ap_count; i++) {
-        cJSON *ap = cJSON_CreateObject();
-        char ssid[33];
-        memcpy(ssid, aps[i].ssid, aps[i].ssid_len);
-        ssid[aps[i].ssid_len] = '\0';
-        cJSON_AddStringToObject(ap, "ssid", ssid);
-
-        char mac[18];
-        snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X",
-                 aps[i].bssid[0], aps[i].bssid[1], aps[i].bssid[2],
-                 aps[i].bssid[3], aps[i].bssid[4], aps[i].bssid[5]);
-        cJSON_AddStringToObject(ap, "bssid", mac);
-        cJSON_AddNumberToObject(ap, "rssi", aps[i].rssi);
-        cJSON_AddNumberToObject(ap, "channel", aps[i].channel);
-        cJSON_AddStringToObject(ap, "auth", authmode_str(aps[i].authmode));
-        cJSON_AddItemToArray(arr, ap);
+    if (scan_store_get_scan_info(id, NULL, &timestamp) != ESP_OK ||
+        ((fields & SCAN_FIELD_APS) &&
+         scan_store_load(id, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Scan not found");
+        return ESP_OK;
     }
-
-    // Include cached location if available
     scan_location_t loc;
-    if (scan_store_get_location(id, &loc) == ESP_OK) {
-        cJSON *location = cJSON_AddObjectToObject(root, "location");
-        cJSON_AddNumberToObject(location, "lat", loc.lat);
-        cJSON_AddNumberToObject(location, "lng", loc.lng);
-        cJSON_AddNumberToObject(location, "accuracy", loc.accuracy);
-    }
-
-    char *json = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    if (!json) {
+    bool has_loc = (fields & SCAN_FIELD_LOCATION) && scan_store_get_location(id, &loc) == ESP_OK;
+
+    char *json = malloc(SCAN_JSON_MAX);
+    size_t len = json ? scan_json_write(json, SCAN_JSON_MAX, id, timestamp,
+                                        (fields & SCAN_FIELD_APS) ? aps : NULL, ap_count,
+                                        has_loc ? &loc : NULL) : 0;
+    if (len == 0) {
+        free(json);
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "JSON error");
         return ESP_OK;
     }
 
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, strlen(json));
+    httpd_resp_send(req, json, len);
     free(json);
     return ESP_OK;
 }
@@ -335,11 +756,11 @@ static esp_err_t api_scan_delete_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// POST /api/locate?id=N — geolocate a scan (cached in NVS after first call)
+// POST /api/locate?id=N — geolocate a scan (cached in NVS after first call).
+// Runs on an async worker.
 static esp_err_t api_locate_handler(httpd_req_t *req)
 {
     set_cors_headers(req);
-    if (!check_auth(req)) return ESP_OK;
     char buf[16];
     if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing query");
@@ -429,6 +850,79 @@ static esp_err_t api_locate_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+// POST /api/locate_batch[?ids=1,5,9][&from=A&to=B] — geolocate many scans over
+// one kept-alive connection to Google. Scans with a cached location are
+// skipped. One JSON line per scan is streamed as soon as it is located:
+//   {"id":N,"lat":..,"lng":..,"accuracy":..}  or  {"id":N,"error":"..."}
+// then {"done":true,"located":N,"failed":N,"cached":N}, with "timed_out":true
+// if the job ran out of time (scans located so far are cached, so run it again).
+// Runs on an async worker.
+static esp_err_t api_locate_batch_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+
+    char api_key[129];
+    if (scan_store_get_api_key(api_key, sizeof(api_key)) != ESP_OK || api_key[0] == '\0') {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No API key configured");
+        return ESP_OK;
+    }
+    geolocation_session_t *geo = geolocation_session_open(api_key);
+    if (!geo) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/x-ndjson");
+    scan_ids_t ids;
+    scan_ids_init(req, &ids, NULL);
+
+    int located = 0, failed = 0, cached = 0;
+    uint16_t id;
+    char line[128];
+    bool timed_out = false;
+    while (scan_ids_next(&ids, &id)) {
+        if (async_expired(req)) {
+            timed_out = true;
+            break;
+        }
+        scan_location_t loc;
+        if (scan_store_get_location(id, &loc) == ESP_OK) {
+            cached++;
+            continue;
+        }
+        stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+        uint8_t ap_count = 0;
+        if (scan_store_load(id, aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &ap_count) != ESP_OK) {
+            continue;
+        }
+
+        geolocation_result_t result;
+        int len;
+        if (geolocation_session_request(geo, aps, ap_count, &result) == ESP_OK) {
+            scan_store_save_location(id, result.lat, result.lng, result.accuracy);
+            located++;
+            len = snprintf(line, sizeof(line),
+                           "{\"id\":%u,\"lat\":%.6f,\"lng\":%.6f,\"accuracy\":%.0f}\n",
+                           id, result.lat, result.lng, result.accuracy);
+        } else {
+            failed++;
+            len = snprintf(line, sizeof(line), "{\"id\":%u,\"error\":\"Geolocation failed\"}\n", id);
+        }
+        if (httpd_resp_send_chunk(req, line, len) != ESP_OK) break;  // client gone
+    }
+    scan_ids_free(&ids);
+    geolocation_session_close(geo);
+    ESP_LOGI(TAG, "Batch locate: %d located, %d failed, %d cached%s",
+             located, failed, cached, timed_out ? " (timed out)" : "");
+
+    int len = snprintf(line, sizeof(line),
+                       "{\"done\":true,\"located\":%d,\"failed\":%d,\"cached\":%d%s}\n",
+                       located, failed, cached, timed_out ? ",\"timed_out\":true" : "");
+    httpd_resp_send_chunk(req, line, len);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
 // GET /api/settings — get scan interval + whether API key / password are configured
 static esp_err_t api_settings_get_handler(httpd_req_t *req)
 {
@@ -444,6 +938,8 @@ static esp_err_t api_settings_get_handler(httpd_req_t *req)
     cJSON_AddBoolToObject(resp, "api_key_set", key_set);
     cJSON_AddBoolToObject(resp, "web_pass_set", pass_set);
     cJSON_AddNumberToObject(resp, "scan_interval", scan_store_get_scan_interval());
+    cJSON_AddNumberToObject(resp, "scan_interval_max", scan_store_get_scan_interval_max());
+    cJSON_AddBoolToObject(resp, "skip_duplicates", scan_store_get_skip_duplicates());
     cJSON_AddNumberToObject(resp, "boot_mode", scan_store_get_boot_mode());
 
 #ifdef CONFIG_LOCATOR_OPEN_WIFI_ENABLED
@@ -461,6 +957,9 @@ static esp_err_t api_settings_get_handler(httpd_req_t *req)
         cJSON_AddStringToObject(resp, "mqtt_url_all", "");
 
     cJSON_AddNumberToObject(resp, "mqtt_wait_cycles", scan_store_get_mqtt_wait_cycles());
+    cJSON_AddBoolToObject(resp, "mqtt_incremental", scan_store_get_mqtt_incremental());
+    cJSON_AddBoolToObject(resp, "mqtt_persist", scan_store_get_mqtt_persist());
+    cJSON_AddNumberToObject(resp, "mqtt_batch", scan_store_get_mqtt_batch());
 
     char mqtt_str[65] = {0};
     if (scan_store_get_mqtt_client_id(mqtt_str, sizeof(mqtt_str)) == ESP_OK)
@@ -528,6 +1027,20 @@ static esp_err_t api_settings_post_handler(httpd_req_t *req)
         }
     }
 
+    // 0 disables the adaptive interval
+    cJSON *interval_max = cJSON_GetObjectItem(json, "scan_interval_max");
+    if (interval_max && cJSON_IsNumber(interval_max)) {
+        int val = interval_max->valueint;
+        if (val == 0 || (val >= 10 && val <= 43200)) {
+            scan_store_set_scan_interval_max((uint16_t)val);
+        }
+    }
+
+    cJSON *skip_dup = cJSON_GetObjectItem(json, "skip_duplicates");
+    if (skip_dup && cJSON_IsBool(skip_dup)) {
+        scan_store_set_skip_duplicates(cJSON_IsTrue(skip_dup));
+    }
+
     cJSON *boot_mode = cJSON_GetObjectItem(json, "boot_mode");
     if (boot_mode && cJSON_IsNumber(boot_mode)) {
         int val = boot_mode->valueint;
@@ -557,6 +1070,22 @@ static esp_err_t api_settings_post_handler(httpd_req_t *req)
     if (mqtt_wait && cJSON_IsNumber(mqtt_wait))
         scan_store_set_mqtt_wait_cycles((uint16_t)mqtt_wait->valueint);
 
+    cJSON *mqtt_incr = cJSON_GetObjectItem(json, "mqtt_incremental");
+    if (mqtt_incr && cJSON_IsBool(mqtt_incr))
+        scan_store_set_mqtt_incremental(cJSON_IsTrue(mqtt_incr));
+
+    cJSON *mqtt_persist = cJSON_GetObjectItem(json, "mqtt_persist");
+    if (mqtt_persist && cJSON_IsBool(mqtt_persist))
+        scan_store_set_mqtt_persist(cJSON_IsTrue(mqtt_persist));
+
+    cJSON *mqtt_batch = cJSON_GetObjectItem(json, "mqtt_batch");
+    if (mqtt_batch && cJSON_IsNumber(mqtt_batch)) {
+        int val = mqtt_batch->valueint;
+        if (val >= 1 && val <= 100) {
+            scan_store_set_mqtt_batch((uint8_t)val);
+        }
+    }
+
     cJSON *mqtt_cid = cJSON_GetObjectItem(json, "mqtt_client_id");
     if (mqtt_cid && cJSON_IsString(mqtt_cid))
         scan_store_set_mqtt_client_id(mqtt_cid->valuestring);
@@ -637,11 +1166,10 @@ static esp_err_t api_wifi_status_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// GET /api/wifi/scan — scan for nearby networks
+// GET /api/wifi/scan — scan for nearby networks. Runs on an async worker.
 static esp_err_t api_wifi_scan_handler(httpd_req_t *req)
 {
     set_cors_headers(req);
-    if (!check_auth(req)) return ESP_OK;
     char *json = wifi_connect_scan_networks();
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json, strlen(json));
@@ -694,22 +1222,57 @@ static esp_err_t api_wifi_connect_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// GET /api/blocklist — list blocklisted SSIDs
+// GET /api/blocklist?offset=N&limit=M — one page of blocklist entries, oldest first
+#define BLOCKLIST_PAGE_DEFAULT 50
+#define BLOCKLIST_PAGE_MAX     100
+
 static esp_err_t api_blocklist_get_handler(httpd_req_t *req)
 {
     set_cors_headers(req);
     if (!check_auth(req)) return ESP_OK;
 
-    char ssids[BLOCKLIST_SIZE][33];
-    int count = scan_store_blocklist_list(ssids, BLOCKLIST_SIZE);
+    int offset = 0;
+    int limit = BLOCKLIST_PAGE_DEFAULT;
+    char buf[64];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK) {
+        char val[8];
+        if (httpd_query_key_value(buf, "offset", val, sizeof(val)) == ESP_OK) offset = atoi(val);
+        if (httpd_query_key_value(buf, "limit", val, sizeof(val)) == ESP_OK) limit = atoi(val);
+    }
+    if (offset < 0) offset = 0;
+    if (limit < 1 || limit > BLOCKLIST_PAGE_MAX) limit = BLOCKLIST_PAGE_MAX;
 
-    cJSON *arr = cJSON_CreateArray();
+    blocklist_entry_t *entries = malloc(limit * sizeof(blocklist_entry_t));
+    if (!entries) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+    int total = scan_store_blocklist_count();
+    int count = scan_store_blocklist_list(entries, offset, limit);
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddNumberToObject(resp, "total", total);
+    cJSON_AddNumberToObject(resp, "offset", offset);
+    cJSON *arr = cJSON_AddArrayToObject(resp, "entries");
     for (int i = 0; i < count; i++) {
-        cJSON_AddItemToArray(arr, cJSON_CreateString(ssids[i]));
+        const blocklist_entry_t *e = &entries[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "ssid", e->ssid);
+        static const uint8_t any[6] = {0};
+        if (memcmp(e->bssid, any, sizeof(any)) != 0) {
+            char bssid[18];
+            snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+                     e->bssid[0], e->bssid[1], e->bssid[2], e->bssid[3], e->bssid[4], e->bssid[5]);
+            cJSON_AddStringToObject(item, "bssid", bssid);
+        }
+        cJSON_AddStringToObject(item, "reason", e->reason == BL_REASON_PASSWORD ? "password" : "portal");
+        cJSON_AddNumberToObject(item, "expires", (double)e->expires);
+        cJSON_AddItemToArray(arr, item);
     }
+    free(entries);
 
-    char *json = cJSON_PrintUnformatted(arr);
-    cJSON_Delete(arr);
+    char *json = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
     if (!json) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "JSON error");
         return ESP_OK;
@@ -721,7 +1284,7 @@ static esp_err_t api_blocklist_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// DELETE /api/blocklist — clear all, or ?ssid=X to delete single entry
+// DELETE /api/blocklist — clear all, or ?ssid=X to delete every entry for that SSID
 static esp_err_t api_blocklist_delete_handler(httpd_req_t *req)
 {
     set_cors_headers(req);
@@ -746,6 +1309,146 @@ static esp_err_t api_blocklist_delete_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+// ---------- Continuous scan recorder ----------
+
+// Scans on a timer while the web server runs, sharing its WiFi session.
+// The task outlives web server restarts and is created on first use.
+static TaskHandle_t s_rec_task = NULL;
+static volatile uint16_t s_rec_interval = 0;   // seconds, 0 = stopped
+static volatile uint32_t s_rec_count = 0;      // scans stored since boot
+
+static void recorder_task(void *arg)
+{
+    while (1) {
+        if (s_rec_interval == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+        uint16_t ap_count = wifi_scan_execute(aps, CONFIG_LOCATOR_MAX_APS_PER_SCAN);
+        if (ap_count > 0) {
+            time_t now;
+            time(&now);
+            uint16_t index;
+            esp_err_t err = scan_store_save(aps, (uint8_t)ap_count, (int64_t)now, &index);
+            if (err == ESP_OK) err = scan_store_flush();
+            if (err == ESP_OK) {
+                s_rec_count++;
+                ESP_LOGI(TAG, "Recorded scan #%u (%u APs)", index, ap_count);
+            } else {
+                ESP_LOGE(TAG, "Failed to save recorded scan: %s", esp_err_to_name(err));
+            }
+        }
+
+        // Wait for the next scan, or until the interval is changed
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((uint32_t)s_rec_interval * 1000));
+    }
+}
+
+// GET /api/record — continuous scan status
+static esp_err_t api_record_get_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+    if (!check_auth(req)) return ESP_OK;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"interval\":%u,\"recorded\":%lu}",
+             s_rec_interval, (unsigned long)s_rec_count);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, buf);
+    return ESP_OK;
+}
+
+// POST /api/record — {"interval":N} starts scanning every N seconds, 0 stops
+static esp_err_t api_record_post_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+    if (!check_auth(req)) return ESP_OK;
+
+    char body[64];
+    int received = httpd_req_recv(req, body, sizeof(body) - 1);
+    if (received <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty body");
+        return ESP_OK;
+    }
+    body[received] = '\0';
+
+    cJSON *json = cJSON_Parse(body);
+    cJSON *interval = json ? cJSON_GetObjectItem(json, "interval") : NULL;
+    int val = (interval && cJSON_IsNumber(interval)) ? interval->valueint : -1;
+    cJSON_Delete(json);
+    if (val != 0 && (val < 10 || val > 3600)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "interval must be 0 or 10-3600");
+        return ESP_OK;
+    }
+
+    if (!s_rec_task && val > 0 &&
+        xTaskCreate(recorder_task, "recorder", 4096, NULL, 4, &s_rec_task) != pdPASS) {
+        s_rec_task = NULL;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Task create failed");
+        return ESP_OK;
+    }
+    s_rec_interval = (uint16_t)val;
+    if (s_rec_task) xTaskNotifyGive(s_rec_task);
+    ESP_LOGI(TAG, "Continuous scan %s (%ds)", val ? "started" : "stopped", val);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, "{\"ok\":true}");
+    return ESP_OK;
+}
+
+// GET /api/stats — timing of the recent scan-mode wake cycles, oldest first
+static esp_err_t api_stats_handler(httpd_req_t *req)
+{
+    set_cors_headers(req);
+    if (!check_auth(req)) return ESP_OK;
+
+    cycle_stats_t *stats = malloc(CYCLE_STATS_MAX * sizeof(cycle_stats_t));
+    if (!stats) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+    int count = scan_store_get_cycle_stats(stats, CYCLE_STATS_MAX);
+
+    cJSON *arr = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        const cycle_stats_t *c = &stats[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "timestamp", (double)c->timestamp);
+        if (c->scan_index != 0xFFFF) cJSON_AddNumberToObject(item, "id", c->scan_index);
+        cJSON_AddNumberToObject(item, "ap_count", c->ap_count);
+        cJSON_AddNumberToObject(item, "boot_ms", c->boot_ms);
+        cJSON_AddNumberToObject(item, "scan_ms", c->scan_ms);
+        cJSON_AddNumberToObject(item, "save_ms", c->save_ms);
+        cJSON_AddNumberToObject(item, "connect_ms", c->connect_ms);
+        cJSON_AddNumberToObject(item, "portal_ms", c->portal_ms);
+        cJSON_AddNumberToObject(item, "sntp_ms", c->sntp_ms);
+        cJSON_AddNumberToObject(item, "mqtt_ms", c->mqtt_ms);
+        cJSON_AddNumberToObject(item, "total_ms", c->total_ms);
+        cJSON_AddNumberToObject(item, "sleep_s", c->sleep_s);
+        cJSON_AddBoolToObject(item, "home_wifi", (c->flags & CYCLE_F_HOME) != 0);
+        cJSON_AddBoolToObject(item, "open_wifi", (c->flags & CYCLE_F_OPEN) != 0);
+        cJSON_AddBoolToObject(item, "portal", (c->flags & CYCLE_F_PORTAL) != 0);
+        cJSON_AddBoolToObject(item, "moved", (c->flags & CYCLE_F_MOVED) != 0);
+        cJSON_AddBoolToObject(item, "duplicate", (c->flags & CYCLE_F_DUPLICATE) != 0);
+        cJSON_AddItemToArray(arr, item);
+    }
+    free(stats);
+
+    char *json = cJSON_PrintUnformatted(arr);
+    cJSON_Delete(arr);
+    if (!json) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "JSON error");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, strlen(json));
+    free(json);
+    return ESP_OK;
+}
+
 // POST /api/wifi/forget — clear credentials and reboot to AP mode
 static esp_err_t api_wifi_forget_handler(httpd_req_t *req)
 {
@@ -773,14 +1476,28 @@ static const httpd_uri_t uri_scans_get = {
 static const httpd_uri_t uri_scans_delete = {
     .uri = "/api/scans", .method = HTTP_DELETE, .handler = api_scans_delete_handler
 };
+static const httpd_uri_t uri_export = {
+    .uri = "/api/export", .method = HTTP_GET, .handler = api_export_handler
+};
 static const httpd_uri_t uri_scan_get = {
     .uri = "/api/scan", .method = HTTP_GET, .handler = api_scan_get_handler
 };
 static const httpd_uri_t uri_scan_delete = {
     .uri = "/api/scan", .method = HTTP_DELETE, .handler = api_scan_delete_handler
 };
+static const async_route_t async_locate = {
+    .handler = api_locate_handler, .timeout_ms = 30000
+};
 static const httpd_uri_t uri_locate = {
-    .uri = "/api/locate", .method = HTTP_POST, .handler = api_locate_handler
+    .uri = "/api/locate", .method = HTTP_POST, .handler = async_dispatch,
+    .user_ctx = (void *)&async_locate
+};
+static const async_route_t async_locate_batch = {
+    .handler = api_locate_batch_handler, .timeout_ms = 300000
+};
+static const httpd_uri_t uri_locate_batch = {
+    .uri = "/api/locate_batch", .method = HTTP_POST, .handler = async_dispatch,
+    .user_ctx = (void *)&async_locate_batch
 };
 static const httpd_uri_t uri_settings_get = {
     .uri = "/api/settings", .method = HTTP_GET, .handler = api_settings_get_handler
@@ -794,8 +1511,12 @@ static const httpd_uri_t uri_sleep = {
 static const httpd_uri_t uri_wifi_status = {
     .uri = "/api/wifi/status", .method = HTTP_GET, .handler = api_wifi_status_handler
 };
+static const async_route_t async_wifi_scan = {
+    .handler = api_wifi_scan_handler, .timeout_ms = 15000
+};
 static const httpd_uri_t uri_wifi_scan = {
-    .uri = "/api/wifi/scan", .method = HTTP_GET, .handler = api_wifi_scan_handler
+    .uri = "/api/wifi/scan", .method = HTTP_GET, .handler = async_dispatch,
+    .user_ctx = (void *)&async_wifi_scan
 };
 static const httpd_uri_t uri_wifi_connect = {
     .uri = "/api/wifi/connect", .method = HTTP_POST, .handler = api_wifi_connect_handler
@@ -809,6 +1530,15 @@ static const httpd_uri_t uri_blocklist_get = {
 static const httpd_uri_t uri_blocklist_delete = {
     .uri = "/api/blocklist", .method = HTTP_DELETE, .handler = api_blocklist_delete_handler
 };
+static const httpd_uri_t uri_stats = {
+    .uri = "/api/stats", .method = HTTP_GET, .handler = api_stats_handler
+};
+static const httpd_uri_t uri_record_get = {
+    .uri = "/api/record", .method = HTTP_GET, .handler = api_record_get_handler
+};
+static const httpd_uri_t uri_record_post = {
+    .uri = "/api/record", .method = HTTP_POST, .handler = api_record_post_handler
+};
 static const httpd_uri_t uri_api_options = {
     .uri = "/api/*", .method = HTTP_OPTIONS, .handler = api_options_handler
 };
@@ -886,25 +1616,35 @@ httpd_handle_t web_server_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.lru_purge_enable = true;
-    config.max_uri_handlers = 19;
-    config.stack_size = 10240;  // TLS handshake for Google API needs extra stack
+    config.max_uri_handlers = 24;
+    config.stack_size = 10240;  // geolocation still runs inline if the workers can't start
     config.uri_match_fn = httpd_uri_match_wildcard;
+#ifndef CONFIG_FREERTOS_UNICORE
+    config.core_id = 0;  // async workers run on core 1
+#endif
 
-    httpd_handle_t server = NULL;
+    httpd_handle_t server = async_workers_resume();
+    if (server) {
+        ESP_LOGI(TAG, "Web server kept, its stop was still waiting for async jobs");
+        return server;
+    }
     ESP_LOGI(TAG, "Starting web server on port %d", config.server_port);
 
     if (httpd_start(&server, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start server");
         return NULL;
     }
+    async_workers_start();
 
     httpd_register_uri_handler(server, &uri_index);
     httpd_register_uri_handler(server, &uri_favicon);
     httpd_register_uri_handler(server, &uri_scans_get);
     httpd_register_uri_handler(server, &uri_scans_delete);
+    httpd_register_uri_handler(server, &uri_export);
     httpd_register_uri_handler(server, &uri_scan_get);
     httpd_register_uri_handler(server, &uri_scan_delete);
     httpd_register_uri_handler(server, &uri_locate);
+    httpd_register_uri_handler(server, &uri_locate_batch);
     httpd_register_uri_handler(server, &uri_settings_get);
     httpd_register_uri_handler(server, &uri_settings_post);
     httpd_register_uri_handler(server, &uri_sleep);
@@ -914,6 +1654,9 @@ httpd_handle_t web_server_start(void)
     httpd_register_uri_handler(server, &uri_wifi_forget);
     httpd_register_uri_handler(server, &uri_blocklist_get);
     httpd_register_uri_handler(server, &uri_blocklist_delete);
+    httpd_register_uri_handler(server, &uri_stats);
+    httpd_register_uri_handler(server, &uri_record_get);
+    httpd_register_uri_handler(server, &uri_record_post);
     httpd_register_uri_handler(server, &uri_api_options);
 
     // Redirect unknown URIs → / (captive portal trigger for AP mode; harmless in STA)
@@ -925,7 +1668,7 @@ httpd_handle_t web_server_start(void)
 
 void web_server_stop(httpd_handle_t server)
 {
-    if (server) {
+    if (server && async_workers_stop(server)) {
         httpd_stop(server);
         ESP_LOGI(TAG, "Web server stopped");
     }
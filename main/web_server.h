@@ -11,7 +11,9 @@ void web_server_set_sleep_callback(sleep_callback_t cb);
 // Start the web server with all locator URI handlers.
 httpd_handle_t web_server_start(void);
 
-// Stop the web server.
+// Stop the web server. Doesn't block: while async jobs are still running
+// the server is stopped by the last of them, unless web_server_start() is
+// called first and takes it back.
 void web_server_stop(httpd_handle_t server);
 
 // Start captive portal DNS server (AP mode only).
@@ -1,5 +1,6 @@
 #include "wifi_connect.h"
 #include "scan_store.h"
+#include "wifi_session.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -69,9 +70,9 @@ static void start_softap(void)
         },
     };
 
+    // The session keeps the driver started; switching mode is enough
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
 
     s_mode = WIFI_CONN_MODE_AP;
     ESP_LOGI(TAG, "SoftAP 'ESP32_Locator' started (open, 192.168.4.1)");
@@ -90,7 +91,6 @@ static bool try_sta_connect(const char *ssid, const char *pass)
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
 
     ESP_LOGI(TAG, "Connecting to '%s'...", ssid);
     esp_wifi_connect();
@@ -103,7 +103,8 @@ static bool try_sta_connect(const char *ssid, const char *pass)
     }
 
     ESP_LOGW(TAG, "STA connection to '%s' failed", ssid);
-    esp_wifi_stop();
+    s_retry_count = MAX_STA_RETRIES;  // no reconnect from the event handler
+    esp_wifi_disconnect();
     return false;
 }
 
@@ -111,12 +112,11 @@ wifi_conn_mode_t wifi_connect_init(void)
 {
     s_connect_sem = xSemaphoreCreateBinary();
 
-    // Create both netifs
-    s_sta_netif = esp_netif_create_default_wifi_sta();
-    s_ap_netif = esp_netif_create_default_wifi_ap();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    // Create both netifs, then hold the WiFi session for the web server's
+    // lifetime; scans (config page, continuous recording) share it
+    s_sta_netif = wifi_session_sta_netif();
+    s_ap_netif = wifi_session_ap_netif();
+    ESP_ERROR_CHECK(wifi_session_acquire());
 
     // Register event handlers
     ESP_ERROR_CHECK(esp_event_handler_instance_register(
@@ -181,14 +181,6 @@ void wifi_connect_get_ip_str(char *buf, size_t len)
 
 char *wifi_connect_scan_networks(void)
 {
-    // If in AP mode, temporarily switch to APSTA for scanning
-    wifi_mode_t orig_mode;
-    esp_wifi_get_mode(&orig_mode);
-
-    if (orig_mode == WIFI_MODE_AP) {
-        esp_wifi_set_mode(WIFI_MODE_APSTA);
-    }
-
     wifi_scan_config_t scan_config = {
         .ssid = NULL,
         .bssid = NULL,
@@ -199,29 +191,18 @@ char *wifi_connect_scan_networks(void)
         .scan_time.active.max = 300,
     };
 
-    esp_err_t err = esp_wifi_scan_start(&scan_config, true);
+    // Switches to AP+STA for the scan if in AP mode
+    uint16_t max_aps = 20;
+    wifi_ap_record_t *records = calloc(max_aps, sizeof(wifi_ap_record_t));
+    if (!records) return strdup("[]");
+
+    esp_err_t err = wifi_session_scan(&scan_config, records, &max_aps, NULL);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "WiFi scan failed: %s", esp_err_to_name(err));
-        if (orig_mode == WIFI_MODE_AP) {
-            esp_wifi_set_mode(WIFI_MODE_AP);
-        }
-        return strdup("[]");
-    }
-
-    uint16_t ap_num = 0;
-    esp_wifi_scan_get_ap_num(&ap_num);
-
-    uint16_t max_aps = (ap_num > 20) ? 20 : ap_num;
-    wifi_ap_record_t *records = calloc(max_aps, sizeof(wifi_ap_record_t));
-    if (!records) {
-        if (orig_mode == WIFI_MODE_AP) {
-            esp_wifi_set_mode(WIFI_MODE_AP);
-        }
+        free(records);
         return strdup("[]");
     }
 
-    esp_wifi_scan_get_ap_records(&max_aps, records);
-
     // Build JSON array
     cJSON *arr = cJSON_CreateArray();
     // Track seen SSIDs to deduplicate
@@ -251,11 +232,6 @@ char *wifi_connect_scan_networks(void)
 
     free(records);
 
-    // Restore mode if changed
-    if (orig_mode == WIFI_MODE_AP) {
-        esp_wifi_set_mode(WIFI_MODE_AP);
-    }
-
     char *json = cJSON_PrintUnformatted(arr);
     cJSON_Delete(arr);
     return json ? json : strdup("[]");
@@ -1,87 +1,123 @@
 #include "wifi_scan.h"
+#include "wifi_session.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
-#include "esp_netif.h"
 #include "esp_event.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
 #include <string.h>
 
 static const char *TAG = "wifi_scan";
 
-uint16_t wifi_scan_execute(stored_ap_t *out_aps, uint16_t max_aps)
-{
-    // Create default STA netif (needed for scan)
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    if (!sta_netif) {
-        ESP_LOGE(TAG, "Failed to create STA netif");
-        return 0;
-    }
+#ifdef CONFIG_LOCATOR_FAST_SCAN
+// Channels that had APs in the previous scan, kept across deep sleep
+#define SCAN_STATE_MAGIC 0x53434831
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_err_t err = esp_wifi_init(&cfg);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "WiFi init failed: %s", esp_err_to_name(err));
-        esp_netif_destroy(sta_netif);
-        return 0;
-    }
+typedef struct {
+    uint32_t magic;
+    uint16_t channels;          // bit n = 2.4 GHz channel n
+    uint16_t since_full;        // scans since the last full sweep
+    uint16_t last_count;        // APs found by the previous scan
+} scan_state_t;
 
-    err = esp_wifi_set_mode(WIFI_MODE_STA);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Set STA mode failed: %s", esp_err_to_name(err));
-        esp_wifi_deinit();
-        esp_netif_destroy(sta_netif);
-        return 0;
-    }
-
-    err = esp_wifi_start();
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "WiFi start failed: %s", esp_err_to_name(err));
-        esp_wifi_deinit();
-        esp_netif_destroy(sta_netif);
-        return 0;
-    }
+static RTC_DATA_ATTR scan_state_t s_state;
+#endif
 
-    // Blocking scan
+// One blocking scan; channels = 0 sweeps all channels. Fetches up to *inout_count
+// records and returns the number of APs found.
+static uint16_t run_scan(uint16_t channels, wifi_ap_record_t *records, uint16_t *inout_count)
+{
     wifi_scan_config_t scan_config = {
         .ssid = NULL,
         .bssid = NULL,
         .channel = 0,
         .show_hidden = true,
+#ifdef CONFIG_LOCATOR_SCAN_PASSIVE
+        .scan_type = WIFI_SCAN_TYPE_PASSIVE,
+        .scan_time.passive = CONFIG_LOCATOR_SCAN_PASSIVE_MS,
+#else
         .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-        .scan_time.active.min = 100,
-        .scan_time.active.max = 300,
+        .scan_time.active.min = CONFIG_LOCATOR_SCAN_ACTIVE_MIN_MS,
+        .scan_time.active.max = CONFIG_LOCATOR_SCAN_ACTIVE_MAX_MS,
+#endif
+        .channel_bitmap.ghz_2_channels = channels,
     };
 
-    err = esp_wifi_scan_start(&scan_config, true);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Scan start failed: %s", esp_err_to_name(err));
-        esp_wifi_stop();
-        esp_wifi_deinit();
-        esp_netif_destroy(sta_netif);
+    int64_t start = esp_timer_get_time();
+    uint16_t ap_num = 0;
+    if (wifi_session_scan(&scan_config, records, inout_count, &ap_num) != ESP_OK) {
         return 0;
     }
+    ESP_LOGI(TAG, "Scan found %u APs on %s channels in %lld ms", ap_num,
+             channels ? "previous" : "all", (long long)(esp_timer_get_time() - start) / 1000);
+    return ap_num;
+}
 
-    uint16_t ap_num = 0;
-    esp_wifi_scan_get_ap_num(&ap_num);
-    ESP_LOGI(TAG, "Scan found %u APs", ap_num);
+#ifdef CONFIG_LOCATOR_FAST_SCAN
+// Fast pass over the previous scan's channels, full sweep if that looks incomplete.
+// Only the channels of the max_aps strongest APs are kept, so the fast pass is
+// judged against at most max_aps APs.
+static uint16_t run_scan_strategy(wifi_ap_record_t *records, uint16_t *inout_count)
+{
+    uint16_t max_aps = *inout_count;
+    uint16_t expected = s_state.last_count < max_aps ? s_state.last_count : max_aps;
+    bool fast = s_state.magic == SCAN_STATE_MAGIC && s_state.channels != 0 &&
+                s_state.since_full + 1 < CONFIG_LOCATOR_FULL_SCAN_EVERY;
+    if (fast) {
+        uint16_t ap_num = run_scan(s_state.channels, records, inout_count);
+        if (ap_num >= CONFIG_LOCATOR_FAST_SCAN_MIN_APS && ap_num * 2 >= expected) {
+            s_state.since_full++;
+            s_state.last_count = ap_num;
+            return ap_num;
+        }
+        ESP_LOGI(TAG, "Fast scan found too few APs, sweeping all channels");
+        *inout_count = max_aps;
+    }
 
-    if (ap_num == 0) {
-        esp_wifi_stop();
-        esp_wifi_deinit();
-        esp_netif_destroy(sta_netif);
-        return 0;
+    uint16_t ap_num = run_scan(0, records, inout_count);
+    s_state.magic = SCAN_STATE_MAGIC;
+    s_state.since_full = 0;
+    s_state.last_count = ap_num;
+    return ap_num;
+}
+
+// Remember the channels of the APs just found for the next fast pass
+static void update_channels(const wifi_ap_record_t *records, uint16_t count)
+{
+    uint16_t channels = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (records[i].primary >= 1 && records[i].primary <= 14) {
+            channels |= 1 << records[i].primary;
+        }
     }
+    s_state.channels = channels;
+}
+#endif
 
-    uint16_t fetch_count = (ap_num < max_aps) ? ap_num : max_aps;
-    wifi_ap_record_t *ap_records = calloc(fetch_count, sizeof(wifi_ap_record_t));
+uint16_t wifi_scan_execute(stored_ap_t *out_aps, uint16_t max_aps)
+{
+    wifi_ap_record_t *ap_records = calloc(max_aps, sizeof(wifi_ap_record_t));
     if (!ap_records) {
         ESP_LOGE(TAG, "Failed to allocate AP records");
-        esp_wifi_stop();
-        esp_wifi_deinit();
-        esp_netif_destroy(sta_netif);
         return 0;
     }
 
-    esp_wifi_scan_get_ap_records(&fetch_count, ap_records);
+    // Scanning needs no netif; if the driver is already up (web server mode,
+    // or held for a connect attempt) this only takes a reference.
+    esp_err_t err = wifi_session_acquire();
+    if (err != ESP_OK) {
+        free(ap_records);
+        return 0;
+    }
+
+    uint16_t fetch_count = max_aps;
+#ifdef CONFIG_LOCATOR_FAST_SCAN
+    run_scan_strategy(ap_records, &fetch_count);
+    update_channels(ap_records, fetch_count);
+#else
+    run_scan(0, ap_records, &fetch_count);
+#endif
+    wifi_session_release();
 
     // Convert to stored format
     for (uint16_t i = 0; i < fetch_count; i++) {
@@ -97,10 +133,6 @@ uint16_t wifi_scan_execute(stored_ap_t *out_aps, uint16_t max_aps)
     }
 
     free(ap_records);
-    esp_wifi_stop();
-    esp_wifi_deinit();
-    esp_netif_destroy(sta_netif);
-
     ESP_LOGI(TAG, "Returning %u APs", fetch_count);
     return fetch_count;
 }
@@ -13,7 +13,8 @@ typedef struct __attribute__((packed)) {
     char     ssid[32];
 } stored_ap_t;
 
-// Initialize WiFi in STA mode (no connect), perform scan, deinit.
+// Scan for APs using the shared WiFi session (started and stopped here unless
+// someone else holds it).
 // Returns number of APs found (up to max_aps). Results written to out_aps.
 // Returns 0 if no APs found or on error.
 uint16_t wifi_scan_execute(stored_ap_t *out_aps, uint16_t max_aps);
@@ -0,0 +1,134 @@
+#include "wifi_session.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "wifi_session";
+
+static SemaphoreHandle_t s_lock = NULL;
+static int s_refs = 0;
+static esp_netif_t *s_sta_netif = NULL;
+static esp_netif_t *s_ap_netif = NULL;
+
+// The first caller is app_main's task, before any other task uses WiFi
+static void lock(void)
+{
+    if (!s_lock) s_lock = xSemaphoreCreateMutex();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+}
+
+static void unlock(void)
+{
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t wifi_session_acquire(void)
+{
+    lock();
+    if (s_refs == 0) {
+        // Callers set their config explicitly; the driver needn't load or
+        // persist it in NVS. PHY calibration data still comes from NVS.
+        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+        cfg.nvs_enable = false;
+        esp_err_t err = esp_wifi_init(&cfg);
+        if (err == ESP_OK) err = esp_wifi_set_mode(WIFI_MODE_STA);
+        if (err == ESP_OK) err = esp_wifi_start();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "WiFi start failed: %s", esp_err_to_name(err));
+            esp_wifi_deinit();
+            unlock();
+            return err;
+        }
+    }
+    s_refs++;
+    unlock();
+    return ESP_OK;
+}
+
+void wifi_session_release(void)
+{
+    lock();
+    if (s_refs > 0 && --s_refs == 0) {
+        esp_wifi_stop();
+        esp_wifi_deinit();
+        if (s_sta_netif) {
+            esp_netif_destroy_default_wifi(s_sta_netif);
+            s_sta_netif = NULL;
+        }
+        if (s_ap_netif) {
+            esp_netif_destroy_default_wifi(s_ap_netif);
+            s_ap_netif = NULL;
+        }
+    }
+    unlock();
+}
+
+// A default netif attaches to the driver on its start event
+static void restart_if_running(void)
+{
+    if (s_refs > 0) {
+        ESP_LOGI(TAG, "Restarting WiFi to attach netif");
+        esp_wifi_stop();
+        esp_wifi_start();
+    }
+}
+
+esp_netif_t *wifi_session_sta_netif(void)
+{
+    lock();
+    if (!s_sta_netif) {
+        s_sta_netif = esp_netif_create_default_wifi_sta();
+        restart_if_running();
+    }
+    esp_netif_t *netif = s_sta_netif;
+    unlock();
+    return netif;
+}
+
+esp_netif_t *wifi_session_ap_netif(void)
+{
+    lock();
+    if (!s_ap_netif) {
+        s_ap_netif = esp_netif_create_default_wifi_ap();
+        restart_if_running();
+    }
+    esp_netif_t *netif = s_ap_netif;
+    unlock();
+    return netif;
+}
+
+esp_err_t wifi_session_scan(const wifi_scan_config_t *config, wifi_ap_record_t *records,
+                            uint16_t *inout_count, uint16_t *out_total)
+{
+    lock();
+    if (s_refs == 0) {
+        unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Scanning needs the STA interface
+    wifi_mode_t mode = WIFI_MODE_STA;
+    esp_wifi_get_mode(&mode);
+    if (mode == WIFI_MODE_AP) esp_wifi_set_mode(WIFI_MODE_APSTA);
+
+    uint16_t total = 0;
+    esp_err_t err = esp_wifi_scan_start(config, true);
+    if (err == ESP_OK) {
+        esp_wifi_scan_get_ap_num(&total);
+        uint16_t count = total < *inout_count ? total : *inout_count;
+        if (count > 0) {
+            err = esp_wifi_scan_get_ap_records(&count, records);
+        } else {
+            esp_wifi_clear_ap_list();
+        }
+        *inout_count = count;
+    } else {
+        ESP_LOGE(TAG, "Scan start failed: %s", esp_err_to_name(err));
+        *inout_count = 0;
+    }
+    if (out_total) *out_total = total;
+
+    if (mode == WIFI_MODE_AP) esp_wifi_set_mode(WIFI_MODE_AP);
+    unlock();
+    return err;
+}
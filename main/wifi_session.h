@@ -0,0 +1,27 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include <stdint.h>
+
+// One WiFi driver lifetime shared by scanning, open WiFi / home connects and
+// the web server's network list. The driver is initialized and started (STA
+// mode) by the first wifi_session_acquire() and stopped and deinitialized by
+// the last wifi_session_release(), so back-to-back users skip the init cost.
+
+esp_err_t wifi_session_acquire(void);
+void      wifi_session_release(void);
+
+// Default STA / AP netifs, created on first use (needs esp_netif_init()).
+// Create them before the first acquire where possible: adding a netif to a
+// running driver restarts it so the netif sees the start event.
+esp_netif_t *wifi_session_sta_netif(void);
+esp_netif_t *wifi_session_ap_netif(void);
+
+// Blocking scan, serialized between tasks. In AP mode the driver switches to
+// AP+STA for the scan. Copies up to *inout_count records (strongest first)
+// and sets *inout_count to the number copied; out_total gets the number of
+// APs found (may be NULL).
+esp_err_t wifi_session_scan(const wifi_scan_config_t *config, wifi_ap_record_t *records,
+                            uint16_t *inout_count, uint16_t *out_total);
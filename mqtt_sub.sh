@@ -1,9 +1,12 @@
 #!/bin/bash
 # Subscribe to ESP32 Locator MQTT topic and save messages as JSON files
-# compatible with locator.html "Import JSON" function.
+# compatible with locator.html "Import JSON" function. Paged "publish all"
+# messages are merged into one file per batch (needs python3). Binary and gzip
+# payloads ("?format=bin" / "?format=gzip" URLs) are converted to JSON by
+# locator_bin.py.
 #
 # Usage: ./mqtt_sub.sh <mqtt-url> <username> <password> [output-dir]
-#   mqtt-url: mqtt://broker:port/topic/path (same format as ESP32 config)
+#   mqtt-url: mqtt://broker:port/topic/path[?format=bin|gzip] (same as ESP32 config)
 #   output-dir: directory for saved JSON files (default: current dir)
 
 set -euo pipefail
@@ -11,7 +14,7 @@ set -euo pipefail
 if [ $# -lt 3 ]; then
     echo "Usage: $0 <mqtt-url> <username> <password> [output-dir]"
     echo
-    echo "  mqtt-url   mqtt://broker:port/topic/path"
+    echo "  mqtt-url   mqtt://broker:port/topic/path[?format=bin|gzip]"
     echo "  output-dir directory for JSON files (default: .)"
     echo
     echo "Example:"
@@ -28,6 +31,12 @@ OUTPUT_DIR="${4:-.}"
 REST="${MQTT_URL#*://}"
 HOST_PORT="${REST%%/*}"
 TOPIC="${REST#*/}"
+FORMAT=json
+case "$TOPIC" in
+    *'?format=bin') FORMAT=bin ;;
+    *'?format=gzip') FORMAT=gzip ;;
+esac
+TOPIC="${TOPIC%%\?*}"
 HOST="${HOST_PORT%%:*}"
 PORT="${HOST_PORT##*:}"
 
@@ -42,19 +51,57 @@ if [ -z "$TOPIC" ]; then
 fi
 
 echo "Broker: $HOST:$PORT"
-echo "Topic:  $TOPIC"
+echo "Topic:  $TOPIC ($FORMAT)"
 echo "Output: $OUTPUT_DIR"
 echo "Waiting for messages... (Ctrl+C to stop)"
 echo "---"
 
 mkdir -p "$OUTPUT_DIR"
 
-mosquitto_sub -h "$HOST" -p "$PORT" -u "$USERNAME" -P "$PASSWORD" -t "$TOPIC" -q 0 -C 1 | \
+PART_FILE="$OUTPUT_DIR/.locator_pages.jsonl"
+
+# One JSON message per line
+subscribe() {
+    if [ "$FORMAT" != json ]; then
+        mosquitto_sub -h "$HOST" -p "$PORT" -u "$USERNAME" -P "$PASSWORD" -t "$TOPIC" -q 0 -F '%x' | \
+            python3 "$(dirname "$0")/locator_bin.py" --hex
+    else
+        mosquitto_sub -h "$HOST" -p "$PORT" -u "$USERNAME" -P "$PASSWORD" -t "$TOPIC" -q 0
+    fi
+}
+
+subscribe | \
 while IFS= read -r line; do
     [ -z "$line" ] && continue
 
+    # Page of a "publish all" batch: collect until the last page, then merge
+    case "$line" in
+        '{"batch":'*)
+            echo "$line" >> "$PART_FILE"
+            case "$line" in *'"last":true}') ;; *) continue ;; esac
+            line=$(python3 - "$PART_FILE" <<'PY'
+import json, sys
+pages = [json.loads(l) for l in open(sys.argv[1]) if l.strip()]
+batch = pages[-1]["batch"]
+pages = sorted((p for p in pages if p["batch"] == batch), key=lambda p: p["part"])
+parts = {p["part"] for p in pages}
+missing = sorted(set(range(1, max(parts) + 1)) - parts)
+if missing:
+    print("WARNING: batch %s is missing page(s) %s" % (batch, missing), file=sys.stderr)
+print(json.dumps([s for p in pages for s in p["scans"]], separators=(",", ":")))
+PY
+)
+            rm -f "$PART_FILE"
+            ;;
+    esac
+
     TS=$(date +%Y%m%d_%H%M%S)
     OUTFILE="$OUTPUT_DIR/LocatorScan_${TS}.json"
+    N=1
+    while [ -e "$OUTFILE" ]; do
+        OUTFILE="$OUTPUT_DIR/LocatorScan_${TS}_${N}.json"
+        N=$((N + 1))
+    done
 
     # Single scan object → wrap in array; array → use as-is
     FIRST=$(echo "$line" | head -c1)
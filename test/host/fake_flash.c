@@ -0,0 +1,105 @@
+#include "fake_flash.h"
+#include "esp_partition.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t *s_mem;
+static esp_partition_t s_part = { .type = ESP_PARTITION_TYPE_DATA, .label = "scanlog" };
+static long s_write_budget = -1;    // bytes until the cut, -1 = none
+static unsigned s_erase_cut;        // erase ops until the cut, 0 = none
+static int s_cut;
+static fake_flash_stats_t s_stats;
+
+void fake_flash_init(size_t size)
+{
+    free(s_mem);
+    s_mem = malloc(size);
+    memset(s_mem, 0xFF, size);
+    s_part.size = size;
+    fake_flash_power_on();
+    fake_flash_reset_stats();
+}
+
+void fake_flash_cut_write(size_t bytes)
+{
+    s_write_budget = (long)bytes;
+}
+
+void fake_flash_cut_erase(unsigned n)
+{
+    s_erase_cut = n;
+}
+
+void fake_flash_power_on(void)
+{
+    s_write_budget = -1;
+    s_erase_cut = 0;
+    s_cut = 0;
+}
+
+int fake_flash_is_cut(void)
+{
+    return s_cut;
+}
+
+void fake_flash_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+fake_flash_stats_t fake_flash_stats(void)
+{
+    return s_stats;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype, const char *label)
+{
+    (void)subtype;
+    if (!s_mem || type != s_part.type || strcmp(label, s_part.label) != 0) return NULL;
+    return &s_part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t size)
+{
+    if (s_cut) return ESP_FAIL;
+    if (offset + size > part->size) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, s_mem + offset, size);
+    s_stats.reads++;
+    s_stats.read_bytes += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t size)
+{
+    if (s_cut) return ESP_FAIL;
+    if (offset + size > part->size) return ESP_ERR_INVALID_SIZE;
+    s_stats.writes++;
+    const uint8_t *p = src;
+    for (size_t i = 0; i < size; i++) {
+        if (s_write_budget == 0) {
+            s_cut = 1;
+            return ESP_FAIL;
+        }
+        if (s_write_budget > 0) s_write_budget--;
+        s_mem[offset + i] &= p[i];   // NOR: bits only go from 1 to 0
+        s_stats.write_bytes++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+    if (s_cut) return ESP_FAIL;
+    if (offset % FAKE_FLASH_SECTOR || size % FAKE_FLASH_SECTOR || offset + size > part->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_stats.erases++;
+    if (s_erase_cut && --s_erase_cut == 0) {
+        memset(s_mem + offset, 0xFF, size / 2);
+        s_cut = 1;
+        return ESP_FAIL;
+    }
+    memset(s_mem + offset, 0xFF, size);
+    return ESP_OK;
+}
@@ -0,0 +1,32 @@
+// In-RAM NOR flash behind the esp_partition API, with power-cut injection.
+// Writes can only clear bits and erases set whole sectors to 0xFF, as on the
+// real chip. A cut stops the operation part-way and fails everything after it
+// until fake_flash_power_on().
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FAKE_FLASH_SECTOR 4096
+
+// (Re)create the "scanlog" partition, fully erased
+void fake_flash_init(size_t size);
+
+// Cut power after `bytes` more bytes have been written; the write in progress
+// is left torn
+void fake_flash_cut_write(size_t bytes);
+// Cut power during the n-th erase from now (1 = next): the first half of the
+// range is erased, the rest keeps its old contents
+void fake_flash_cut_erase(unsigned n);
+void fake_flash_power_on(void);
+int  fake_flash_is_cut(void);
+
+// Operation counters since the last fake_flash_reset_stats()
+typedef struct {
+    size_t reads, read_bytes;
+    size_t writes, write_bytes;
+    size_t erases;
+} fake_flash_stats_t;
+
+void fake_flash_reset_stats(void);
+fake_flash_stats_t fake_flash_stats(void);
@@ -0,0 +1,75 @@
+#include "fake_mqtt.h"
+#include "mqtt_client.h"
+#include <string.h>
+
+// One static client, so the fake adds nothing to the heap being measured
+struct esp_mqtt_client {
+    esp_event_handler_t handler;
+    void *arg;
+    int next_msg_id;
+};
+
+static struct esp_mqtt_client s_client;
+static fake_mqtt_publish_cb_t s_cb;
+
+void fake_mqtt_set_callback(fake_mqtt_publish_cb_t cb)
+{
+    s_cb = cb;
+}
+
+static void fire(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id)
+{
+    esp_mqtt_event_t event = { .msg_id = msg_id };
+    if (client->handler) client->handler(client->arg, "MQTT_EVENTS", id, &event);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    memset(&s_client, 0, sizeof(s_client));
+    return &s_client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, int32_t event,
+                                         esp_event_handler_t handler, void *arg)
+{
+    client->handler = handler;
+    client->arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    fire(client, MQTT_EVENT_CONNECTED, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+    fire(client, MQTT_EVENT_DISCONNECTED, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    client->handler = NULL;
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic,
+                            const char *data, int len, int qos, int retain)
+{
+    int msg_id = ++client->next_msg_id;
+    if (s_cb) s_cb(topic, data, (size_t)len, qos, retain);
+    if (qos > 0) fire(client, MQTT_EVENT_PUBLISHED, msg_id);
+    return msg_id;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    return 0;
+}
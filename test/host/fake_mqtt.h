@@ -0,0 +1,11 @@
+// In-process MQTT broker behind the esp-mqtt client API: connects at once,
+// acknowledges QoS 1 messages before esp_mqtt_client_publish() returns and
+// hands every message to a test callback.
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*fake_mqtt_publish_cb_t)(const char *topic, const char *data, size_t len,
+                                       int qos, int retain);
+
+void fake_mqtt_set_callback(fake_mqtt_publish_cb_t cb);
@@ -0,0 +1,182 @@
+#include "fake_nvs.h"
+#include "nvs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENTRY      32
+#define CHUNK_MAX  4000
+#define MAX_KEYS   1024
+
+typedef enum { T_U8, T_U16, T_STR, T_BLOB } item_type_t;
+
+typedef struct {
+    char key[16];
+    item_type_t type;
+    size_t len;
+    uint8_t *data;
+} item_t;
+
+static item_t s_items[MAX_KEYS];
+static size_t s_n;
+static long s_ops_left = -1;    // -1 = no cut pending
+static fake_nvs_stats_t s_stats;
+
+void fake_nvs_init(void)
+{
+    for (size_t i = 0; i < s_n; i++) free(s_items[i].data);
+    s_n = 0;
+    fake_nvs_power_on();
+    fake_nvs_reset_stats();
+}
+
+void fake_nvs_cut_after(unsigned ops)
+{
+    s_ops_left = ops;
+}
+
+void fake_nvs_power_on(void)
+{
+    s_ops_left = -1;
+}
+
+fake_nvs_stats_t fake_nvs_stats(void)
+{
+    return s_stats;
+}
+
+void fake_nvs_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+size_t fake_nvs_key_count(void)
+{
+    return s_n;
+}
+
+static item_t *find(const char *key)
+{
+    for (size_t i = 0; i < s_n; i++) {
+        if (strcmp(s_items[i].key, key) == 0) return &s_items[i];
+    }
+    return NULL;
+}
+
+// Consume one operation; false once power is cut
+static bool powered(void)
+{
+    if (s_ops_left == 0) return false;
+    if (s_ops_left > 0) s_ops_left--;
+    return true;
+}
+
+static size_t cost(item_type_t type, size_t len)
+{
+    if (type == T_U8 || type == T_U16) return ENTRY;
+    size_t data = (len + ENTRY - 1) / ENTRY * ENTRY;
+    if (type == T_STR) return ENTRY + data;
+    size_t chunks = len ? (len + CHUNK_MAX - 1) / CHUNK_MAX : 1;
+    return chunks * ENTRY + data + ENTRY;
+}
+
+static esp_err_t set(const char *key, item_type_t type, const void *data, size_t len)
+{
+    item_t *it = find(key);
+    if (it && it->type == type && it->len == len && memcmp(it->data, data, len) == 0) {
+        return ESP_OK;
+    }
+    if (!powered()) return ESP_FAIL;
+    if (!it) {
+        if (s_n == MAX_KEYS) return ESP_ERR_NO_MEM;
+        it = &s_items[s_n++];
+        memset(it, 0, sizeof(*it));
+        strncpy(it->key, key, sizeof(it->key) - 1);
+    }
+    free(it->data);
+    it->data = malloc(len ? len : 1);
+    memcpy(it->data, data, len);
+    it->type = type;
+    it->len = len;
+    s_stats.writes++;
+    s_stats.write_bytes += cost(type, len);
+    return ESP_OK;
+}
+
+static esp_err_t get(const char *key, item_type_t type, void *out, size_t *len)
+{
+    item_t *it = find(key);
+    if (!it || it->type != type) return ESP_ERR_NVS_NOT_FOUND;
+    if (!out) {
+        *len = it->len;
+        return ESP_OK;
+    }
+    if (*len < it->len) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out, it->data, it->len);
+    *len = it->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out)
+{
+    *out = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t h)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+    item_t *it = find(key);
+    if (!it) return ESP_ERR_NVS_NOT_FOUND;
+    if (!powered()) return ESP_FAIL;
+    free(it->data);
+    *it = s_items[--s_n];
+    s_stats.erases++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out)
+{
+    size_t len = 1;
+    return get(key, T_U8, out, &len);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t h, const char *key, uint8_t value)
+{
+    return set(key, T_U8, &value, 1);
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t h, const char *key, uint16_t *out)
+{
+    size_t len = 2;
+    return get(key, T_U16, out, &len);
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t h, const char *key, uint16_t value)
+{
+    return set(key, T_U16, &value, 2);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t h, const char *key, char *out, size_t *length)
+{
+    return get(key, T_STR, out, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t h, const char *key, const char *value)
+{
+    return set(key, T_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *length)
+{
+    return get(key, T_BLOB, out, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *value, size_t length)
+{
+    return set(key, T_BLOB, value, length);
+}
@@ -0,0 +1,30 @@
+// In-RAM NVS (one namespace) that counts the flash bytes each write would
+// cost on the real NVS, and can cut power between two operations.
+//
+// Cost model: NVS stores 32-byte entries. A u8/u16 is one entry; a string or
+// blob is a header entry plus its data rounded up to entries, blobs split in
+// chunks of up to 4000 bytes with a header each, plus one blob index entry.
+// Writing the value already stored is skipped, as NVS does. Erasing a key
+// only flips state bits and is counted separately.
+#pragma once
+
+#include <stddef.h>
+
+void fake_nvs_init(void);
+
+// After `ops` more successful writes or erases, every write fails and
+// changes nothing, until fake_nvs_power_on()
+void fake_nvs_cut_after(unsigned ops);
+void fake_nvs_power_on(void);
+
+typedef struct {
+    size_t writes;          // set operations that changed something
+    size_t write_bytes;     // flash bytes they cost
+    size_t erases;
+} fake_nvs_stats_t;
+
+fake_nvs_stats_t fake_nvs_stats(void);
+void fake_nvs_reset_stats(void);
+
+// Keys stored, to check that nothing is leaked
+size_t fake_nvs_key_count(void);
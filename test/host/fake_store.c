@@ -0,0 +1,107 @@
+#include "fake_store.h"
+#include "scan_store.h"
+#include <stdio.h>
+#include <string.h>
+
+static uint16_t s_head, s_count, s_mark, s_cycle_counter;
+static const char *s_url_last = "", *s_url_all = "";
+static bool s_incremental;
+static uint8_t s_batch = MQTT_BATCH_DEFAULT;
+
+void fake_store_reset(uint16_t head, uint16_t count)
+{
+    s_head = head;
+    s_count = count;
+    s_mark = head;
+    s_cycle_counter = 0;
+}
+
+void fake_store_set_urls(const char *url_last, const char *url_all)
+{
+    s_url_last = url_last;
+    s_url_all = url_all;
+}
+
+void fake_store_set_incremental(bool on, uint8_t batch)
+{
+    s_incremental = on;
+    s_batch = batch;
+}
+
+uint16_t fake_store_mark(void)
+{
+    return s_mark;
+}
+
+static uint8_t scan_aps(uint16_t index)
+{
+    return 1 + index % CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+}
+
+esp_err_t scan_store_load(uint16_t index, stored_ap_t *aps, uint8_t max_aps, uint8_t *out_ap_count)
+{
+    if (index < s_head || index >= s_count) return ESP_ERR_NOT_FOUND;
+    uint8_t n = scan_aps(index);
+    if (n > max_aps) n = max_aps;
+    for (uint8_t i = 0; i < n; i++) {
+        memset(&aps[i], 0, sizeof(aps[i]));
+        for (int b = 0; b < 6; b++) aps[i].bssid[b] = (uint8_t)(index + i * 17 + b);
+        aps[i].rssi = (int8_t)(-30 - (index + i) % 60);
+        aps[i].channel = 1 + (index + i) % 13;
+        aps[i].authmode = (index + i) % 8;
+        // Full-length SSIDs with characters JSON has to escape
+        aps[i].ssid_len = 32;
+        for (int c = 0; c < 32; c++) aps[i].ssid[c] = (c % 7 == 0) ? '"' : 'a' + (index + c) % 26;
+    }
+    *out_ap_count = n;
+    return ESP_OK;
+}
+
+esp_err_t scan_store_get_scan_info(uint16_t index, uint8_t *out_ap_count, int64_t *out_timestamp)
+{
+    if (index < s_head || index >= s_count) return ESP_ERR_NOT_FOUND;
+    if (out_ap_count) *out_ap_count = scan_aps(index);
+    if (out_timestamp) *out_timestamp = 1700000000 + (int64_t)index * 300;
+    return ESP_OK;
+}
+
+esp_err_t scan_store_get_range(uint16_t *out_head, uint16_t *out_count)
+{
+    *out_head = s_head;
+    *out_count = s_count;
+    return ESP_OK;
+}
+
+esp_err_t scan_store_get_location(uint16_t index, scan_location_t *out)
+{
+    if (index % 3) return ESP_ERR_NOT_FOUND;
+    *out = (scan_location_t){ .lat = 48.0 + index / 1000.0, .lng = 11.0, .accuracy = 30 };
+    return ESP_OK;
+}
+
+int scan_store_get_cycle_stats(cycle_stats_t *out, int max)
+{
+    return 0;
+}
+
+static esp_err_t get_str(const char *value, char *buf, size_t buf_size)
+{
+    snprintf(buf, buf_size, "%s", value);
+    return ESP_OK;
+}
+
+esp_err_t scan_store_get_mqtt_url_last(char *buf, size_t buf_size) { return get_str(s_url_last, buf, buf_size); }
+esp_err_t scan_store_get_mqtt_url_all(char *buf, size_t buf_size) { return get_str(s_url_all, buf, buf_size); }
+esp_err_t scan_store_get_mqtt_client_id(char *buf, size_t buf_size) { return get_str("", buf, buf_size); }
+esp_err_t scan_store_get_mqtt_username(char *buf, size_t buf_size) { return get_str("", buf, buf_size); }
+esp_err_t scan_store_get_mqtt_password(char *buf, size_t buf_size) { return get_str("", buf, buf_size); }
+uint16_t scan_store_get_mqtt_wait_cycles(void) { return 0; }
+uint16_t scan_store_get_mqtt_cycle_counter(void) { return s_cycle_counter; }
+esp_err_t scan_store_set_mqtt_cycle_counter(uint16_t count) { s_cycle_counter = count; return ESP_OK; }
+bool scan_store_get_mqtt_persist(void) { return false; }
+bool scan_store_get_mqtt_incremental(void) { return s_incremental; }
+uint8_t scan_store_get_mqtt_batch(void) { return s_batch; }
+uint16_t scan_store_get_mqtt_mark(void) { return s_mark; }
+esp_err_t scan_store_set_mqtt_mark(uint16_t index) { s_mark = index; return ESP_OK; }
+int scan_store_outbox_peek(mqtt_outbox_entry_t *out, int max) { return 0; }
+esp_err_t scan_store_outbox_done(int sent, bool failed) { return ESP_OK; }
@@ -0,0 +1,11 @@
+// scan_store API over generated scans: scan i always has the same content,
+// so any history size costs no memory
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void fake_store_reset(uint16_t head, uint16_t count);
+void fake_store_set_urls(const char *url_last, const char *url_all);
+void fake_store_set_incremental(bool on, uint8_t batch);
+uint16_t fake_store_mark(void);
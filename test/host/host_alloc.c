@@ -0,0 +1,76 @@
+#include "host_alloc.h"
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// Each block is preceded by its size
+#define HDR alignof(max_align_t)
+
+static size_t s_live, s_peak;
+
+size_t host_alloc_live(void)
+{
+    return s_live;
+}
+
+size_t host_alloc_peak(void)
+{
+    return s_peak;
+}
+
+void host_alloc_reset_peak(void)
+{
+    s_peak = s_live;
+}
+
+static void *track(char *block, size_t size)
+{
+    if (!block) return NULL;
+    memcpy(block, &size, sizeof(size));
+    s_live += size;
+    if (s_live > s_peak) s_peak = s_live;
+    return block + HDR;
+}
+
+static size_t untrack(void *ptr)
+{
+    size_t size;
+    memcpy(&size, (char *)ptr - HDR, sizeof(size));
+    s_live -= size;
+    return size;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return track(__real_malloc(HDR + size), size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *p = __wrap_malloc(n * size);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (!ptr) return __wrap_malloc(size);
+    size_t old = untrack(ptr);
+    char *block = __real_realloc((char *)ptr - HDR, HDR + size);
+    if (!block) {
+        s_live += old;
+        return NULL;
+    }
+    return track(block, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (!ptr) return;
+    untrack(ptr);
+    __real_free((char *)ptr - HDR);
+}
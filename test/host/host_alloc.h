@@ -0,0 +1,11 @@
+// Heap accounting for the code under test. The test executable links with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free so every
+// allocation made from its own objects goes through host_alloc.c.
+#pragma once
+
+#include <stddef.h>
+
+// Bytes currently allocated and the most at any time since the last reset
+size_t host_alloc_live(void);
+size_t host_alloc_peak(void);
+void host_alloc_reset_peak(void);
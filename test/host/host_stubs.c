@@ -0,0 +1,86 @@
+// Host versions of the ESP-IDF helpers the tested sources call
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "cJSON.h"
+#include "esp_random.h"
+#include <stdlib.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+uint32_t esp_random(void)
+{
+    return (uint32_t)rand();
+}
+
+// FreeRTOS: see stubs/freertos/FreeRTOS.h
+struct host_sem {
+    int count;
+};
+
+TickType_t xTaskGetTickCount(void)
+{
+    static TickType_t ticks;
+    return ++ticks;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return calloc(1, sizeof(struct host_sem));
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    if (sem->count) return pdFALSE;
+    sem->count = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+    if (!sem->count) return pdFALSE;
+    sem->count = 0;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    free(sem);
+}
+
+// Nothing runs concurrently, so a recursive mutex never has to wait
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return calloc(1, sizeof(struct host_sem));
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t wait)
+{
+    sem->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    sem->count--;
+    return pdTRUE;
+}
+
+// cJSON: see stubs/cJSON.h
+
+cJSON *cJSON_CreateObject(void) { return NULL; }
+cJSON *cJSON_AddNumberToObject(cJSON *o, const char *n, double v) { return NULL; }
+cJSON *cJSON_AddStringToObject(cJSON *o, const char *n, const char *s) { return NULL; }
+cJSON *cJSON_AddArrayToObject(cJSON *o, const char *n) { return NULL; }
+cJSON *cJSON_AddObjectToObject(cJSON *o, const char *n) { return NULL; }
+int cJSON_AddItemToArray(cJSON *a, cJSON *i) { return 0; }
+char *cJSON_PrintUnformatted(const cJSON *item) { return NULL; }
+void cJSON_Delete(cJSON *item) { }
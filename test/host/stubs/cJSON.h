@@ -0,0 +1,14 @@
+// Host stub: the cJSON calls in the tested sources. Every constructor
+// returns NULL, so code paths that need a real tree are not covered.
+#pragma once
+
+typedef struct cJSON cJSON;
+
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number);
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string);
+cJSON *cJSON_AddArrayToObject(cJSON *object, const char *name);
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name);
+int cJSON_AddItemToArray(cJSON *array, cJSON *item);
+char *cJSON_PrintUnformatted(const cJSON *item);
+void cJSON_Delete(cJSON *item);
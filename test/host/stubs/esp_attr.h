@@ -0,0 +1,5 @@
+// Host stub: RTC memory is ordinary memory
+#pragma once
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
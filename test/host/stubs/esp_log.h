@@ -0,0 +1,10 @@
+// Host stub: logging is compiled in (format checks) but silent
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_HOST_LOG(tag, fmt, ...) do { if (0) printf("%s: " fmt, tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGE(tag, fmt, ...) ESP_HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ESP_HOST_LOG(tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,6 @@
+// Host stub
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
@@ -0,0 +1,7 @@
+// Host stub: zlib-compatible CRC32, chainable like the ROM version
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,2 @@
+// Host stub: wifi_scan.h only needs the include to resolve
+#pragma once
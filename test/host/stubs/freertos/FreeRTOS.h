@@ -0,0 +1,15 @@
+// Host stub: single-threaded FreeRTOS subset. Ticks are milliseconds and
+// advance by one on every xTaskGetTickCount(), so deadlines always pass.
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+TickType_t xTaskGetTickCount(void);
@@ -0,0 +1,56 @@
+// Host stub: the esp-mqtt client API used by mqtt_publish.c. The fake
+// behind it (fake_mqtt.c) connects at once and acknowledges QoS 1
+// publishes before returning.
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *handler_args, esp_event_base_t base,
+                                    int32_t event_id, void *event_data);
+#define ESP_EVENT_ANY_ID -1
+
+typedef enum {
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+} esp_mqtt_event_id_t;
+
+typedef struct {
+    int error_type;
+} esp_mqtt_error_codes_t;
+
+typedef struct {
+    int msg_id;
+    esp_mqtt_error_codes_t *error_handle;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct {
+    struct { struct { const char *uri; } address; } broker;
+    struct {
+        const char *username;
+        const char *client_id;
+        struct { const char *password; } authentication;
+    } credentials;
+    struct { bool disable_clean_session; } session;
+} esp_mqtt_client_config_t;
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, int32_t event,
+                                         esp_event_handler_t handler, void *arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic,
+                            const char *data, int len, int qos, int retain);
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client);
@@ -0,0 +1,21 @@
+// Host stub: the NVS calls used by scan_store.c, served by fake_nvs.c
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out);
+esp_err_t nvs_commit(nvs_handle_t h);
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key);
+esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out);
+esp_err_t nvs_set_u8(nvs_handle_t h, const char *key, uint8_t value);
+esp_err_t nvs_get_u16(nvs_handle_t h, const char *key, uint16_t *out);
+esp_err_t nvs_set_u16(nvs_handle_t h, const char *key, uint16_t value);
+esp_err_t nvs_get_str(nvs_handle_t h, const char *key, char *out, size_t *length);
+esp_err_t nvs_set_str(nvs_handle_t h, const char *key, const char *value);
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *value, size_t length);
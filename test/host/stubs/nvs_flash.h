@@ -0,0 +1,4 @@
+// Host stub
+#pragma once
+
+#include "nvs.h"
@@ -0,0 +1,141 @@
+// Host tests for the streaming gzip encoder in gz_stream.c: every output is
+// inflated with the system zlib and must give back the input, for empty and
+// 1-byte members, input longer than the window fed in uneven pieces, and
+// several members from one stream.
+#include "gz_stream.h"
+#include "test_util.h"
+#include <string.h>
+#include <zlib.h>
+
+#define IN_MAX  (5 * GZ_WINDOW)
+#define OUT_MAX (2 * IN_MAX + 1024)
+
+static uint8_t s_in[IN_MAX];
+static uint8_t s_out[OUT_MAX];
+static size_t s_out_len;
+static uint8_t s_back[IN_MAX + 1];
+
+static bool collect(const uint8_t *data, size_t len, void *arg)
+{
+    CHECK(s_out_len + len <= OUT_MAX);
+    memcpy(s_out + s_out_len, data, len);
+    s_out_len += len;
+    return true;
+}
+
+// Inflate `members` concatenated gzip members from out; returns the total size
+static size_t inflate_members(const uint8_t *out, size_t len, int members)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    CHECK_EQ(inflateInit2(&zs, 16 + MAX_WBITS), Z_OK);
+    zs.next_in = (Bytef *)out;
+    zs.avail_in = (uInt)len;
+    zs.next_out = s_back;
+    zs.avail_out = sizeof(s_back);
+    for (int m = 0; m < members; m++) {
+        if (m > 0) CHECK_EQ(inflateReset(&zs), Z_OK);
+        CHECK_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+    }
+    CHECK_EQ(zs.avail_in, 0);
+    size_t total = sizeof(s_back) - zs.avail_out;
+    inflateEnd(&zs);
+    return total;
+}
+
+// Compress in[0..len) as one member, in pieces of `chunk` bytes
+static void round_trip(const uint8_t *in, size_t len, size_t chunk)
+{
+    s_out_len = 0;
+    gz_stream_t *z = gz_stream_create(collect, NULL);
+    CHECK(z != NULL);
+    CHECK(gz_stream_begin(z));
+    size_t bound = gz_stream_bound(z, len);
+    for (size_t off = 0; off < len; off += chunk) {
+        size_t n = len - off < chunk ? len - off : chunk;
+        CHECK(gz_stream_write(z, in + off, n));
+    }
+    CHECK(gz_stream_finish(z));
+    CHECK_EQ(gz_stream_out_total(z), s_out_len);
+    CHECK(s_out_len <= bound);
+    gz_stream_free(z);
+
+    CHECK_EQ(inflate_members(s_out, s_out_len, 1), len);
+    CHECK(memcmp(s_back, in, len) == 0);
+}
+
+// JSON-like text with repeats near and far, and some noise
+static void fill_input(void)
+{
+    uint32_t seed = 1;
+    size_t i = 0;
+    while (i < IN_MAX) {
+        seed = seed * 1103515245u + 12345u;
+        int n = snprintf((char *)s_in + i, IN_MAX - i, "{\"id\":%u,\"bssid\":\"24:0a:%02x:%02x\",\"rssi\":-%u},",
+                         (unsigned)(i / 97), (seed >> 8) & 0xFF, (seed >> 16) & 0x0F, 40 + (seed >> 24) % 50);
+        if (n <= 0 || (size_t)n >= IN_MAX - i) break;
+        i += n;
+    }
+    for (; i < IN_MAX; i++) {
+        seed = seed * 1103515245u + 12345u;
+        s_in[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static void test_empty(void)
+{
+    round_trip(s_in, 0, 1);
+}
+
+static void test_one_byte(void)
+{
+    const uint8_t c = '{';
+    round_trip(&c, 1, 1);
+}
+
+// Matches reach back across the window as it slides
+static void test_longer_than_window(void)
+{
+    round_trip(s_in, IN_MAX, IN_MAX);
+    round_trip(s_in, IN_MAX, 1);
+    round_trip(s_in, IN_MAX, 777);
+    round_trip(s_in, GZ_WINDOW + 1, GZ_WINDOW);
+
+    // A run far longer than the window: matches overlapping their own output
+    static uint8_t run[IN_MAX];
+    memset(run, 'a', sizeof(run));
+    round_trip(run, sizeof(run), 1000);
+}
+
+// One stream reused for several members, as the MQTT pages do
+static void test_members(void)
+{
+    static const size_t lens[] = { 3000, 0, 1, 2 * GZ_WINDOW + 5, 100 };
+    const int members = sizeof(lens) / sizeof(lens[0]);
+    s_out_len = 0;
+    gz_stream_t *z = gz_stream_create(collect, NULL);
+    CHECK(z != NULL);
+    size_t off = 0;
+    for (int m = 0; m < members; m++) {
+        size_t before = s_out_len;
+        CHECK(gz_stream_begin(z));
+        CHECK(gz_stream_write(z, s_in + off, lens[m]));
+        CHECK(gz_stream_finish(z));
+        CHECK_EQ(gz_stream_out_total(z), s_out_len - before);
+        off += lens[m];
+    }
+    gz_stream_free(z);
+
+    CHECK_EQ(inflate_members(s_out, s_out_len, members), off);
+    CHECK(memcmp(s_back, s_in, off) == 0);
+}
+
+int main(void)
+{
+    fill_input();
+    RUN(test_empty);
+    RUN(test_one_byte);
+    RUN(test_longer_than_window);
+    RUN(test_members);
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Host test for the paged "publish all" in mqtt_publish.c: the whole history
+// goes out in pages of bounded size, and peak heap use is the same for 20
+// scans as for 1000. gzip pages are inflated with the system zlib and must
+// carry the same scans as the JSON pages.
+#include "mqtt_publish.h"
+#include "fake_mqtt.h"
+#include "fake_store.h"
+#include "host_alloc.h"
+#include "scan_json.h"
+#include "test_util.h"
+#include <string.h>
+#include <zlib.h>
+
+// MQTT_PAGE_BYTES in mqtt_publish.c
+#define PAGE_BYTES 16384
+
+#define URL_ALL "mqtt://broker:1883/locator/all"
+
+// The "scans" arrays of all JSON pages, joined. Static: the heap is measured.
+#define SCANS_MAX (4 * 1024 * 1024)
+
+static struct {
+    int pages;
+    int scans;
+    int last_pages;
+    size_t max_len;
+    char json[SCANS_MAX];
+    size_t json_len;
+} s_seen;
+
+static char s_json_pages[SCANS_MAX];
+static size_t s_json_pages_len;
+static char s_page[16 * PAGE_BYTES];
+
+static uint32_t varint(const uint8_t **p)
+{
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+static int count_json_scans(const char *data, size_t len)
+{
+    int n = 0;
+    for (size_t i = 0; i + 6 <= len; i++) n += memcmp(data + i, "{\"id\":", 6) == 0;
+    return n;
+}
+
+static void check_json_page(const char *data, size_t len)
+{
+    static const char head[] = "\"scans\":[", tail[] = "],\"last\":true}";
+    CHECK(len > 32 && memcmp(data, "{\"batch\":", 9) == 0);
+    s_seen.scans += count_json_scans(data, len);
+
+    // "],\"last\":true}" or "],\"last\":false}"
+    bool last = memcmp(data + len - strlen(tail), tail, strlen(tail)) == 0;
+    const char *end = data + len - strlen(tail) - !last;
+    CHECK(memcmp(end, "],\"last\":", 9) == 0);
+    s_seen.last_pages += last;
+
+    const char *scans = data;
+    while (scans < end && memcmp(scans, head, strlen(head)) != 0) scans++;
+    CHECK(scans < end);
+    scans += strlen(head);
+    size_t n = end - scans;
+    CHECK(s_seen.json_len + n + 1 <= SCANS_MAX);
+    if (s_seen.json_len > 0 && n > 0) s_seen.json[s_seen.json_len++] = ',';
+    memcpy(s_seen.json + s_seen.json_len, scans, n);
+    s_seen.json_len += n;
+}
+
+// One page is one gzip member
+static void check_gzip_page(const char *data, size_t len)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    CHECK_EQ(inflateInit2(&zs, 16 + MAX_WBITS), Z_OK);
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef *)s_page;
+    zs.avail_out = sizeof(s_page);
+    CHECK_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+    CHECK_EQ(zs.avail_in, 0);
+    size_t n = sizeof(s_page) - zs.avail_out;
+    inflateEnd(&zs);
+    check_json_page(s_page, n);
+}
+
+static void on_publish(const char *topic, const char *data, size_t len, int qos, int retain)
+{
+    CHECK(strcmp(topic, "locator/all") == 0);
+    CHECK(len <= PAGE_BYTES);
+    s_seen.pages++;
+    if (len > s_seen.max_len) s_seen.max_len = len;
+
+    const uint8_t *p = (const uint8_t *)data;
+    if (p[0] == 'L' && p[1] == 'B') {
+        // "LB" version flags batch part ssid_count {len bytes}... scan_count
+        uint8_t flags = p[3];
+        p += 4;
+        varint(&p);
+        varint(&p);
+        for (uint32_t n = varint(&p); n; n--) p += varint(&p);
+        s_seen.scans += varint(&p);
+        s_seen.last_pages += (flags & 0x02) != 0;
+    } else if (p[0] == 0x1F && p[1] == 0x8B) {
+        check_gzip_page(data, len);
+    } else {
+        check_json_page(data, len);
+    }
+}
+
+// Publish `count` scans to the all-scans URL. Returns the peak heap use.
+static size_t publish(const char *url, uint16_t count)
+{
+    s_seen.pages = s_seen.scans = s_seen.last_pages = 0;
+    s_seen.max_len = s_seen.json_len = 0;
+    fake_store_reset(0, count);
+    fake_store_set_urls("", url);
+
+    size_t live = host_alloc_live();
+    host_alloc_reset_peak();
+    CHECK_EQ(mqtt_publish_scans(), ESP_OK);
+    CHECK_EQ(host_alloc_live(), live);  // nothing leaked
+    return host_alloc_peak() - live;
+}
+
+// `extra`: heap the format needs besides the page and one serialized scan
+static void check_format(const char *url, size_t extra)
+{
+    size_t peak_small = publish(url, 20);
+    size_t peak = publish(url, 1000);
+    printf("  %-44s peak %zu bytes, %d pages\n", url, peak, s_seen.pages);
+
+    CHECK(s_seen.pages > 1);
+    CHECK_EQ(s_seen.scans, 1000);
+    CHECK_EQ(s_seen.last_pages, 1);
+    CHECK_EQ(peak, peak_small);
+    CHECK(peak <= PAGE_BYTES + SCAN_JSON_MAX + extra);
+}
+
+static void test_publish_all_json(void)
+{
+    check_format(URL_ALL, 1024);
+    memcpy(s_json_pages, s_seen.json, s_seen.json_len);
+    s_json_pages_len = s_seen.json_len;
+}
+
+static void test_publish_all_bin(void)
+{
+    check_format(URL_ALL "?format=bin", 4096);
+}
+
+static void test_publish_all_gzip(void)
+{
+    // The compressor's window and hash tables
+    check_format(URL_ALL "?format=gzip", 24 * 1024);
+    CHECK_EQ(s_seen.json_len, s_json_pages_len);
+    CHECK(memcmp(s_seen.json, s_json_pages, s_json_pages_len) == 0);
+}
+
+// Incremental mode: QoS 1 pages of at most `batch` scans, each PUBACK moves
+// the mark
+static void test_incremental(void)
+{
+    fake_store_set_incremental(true, 20);
+    size_t peak_small = publish(URL_ALL, 20);
+    size_t peak = publish(URL_ALL, 1000);
+    fake_store_set_incremental(false, MQTT_BATCH_DEFAULT);
+
+    CHECK_EQ(fake_store_mark(), 1000);
+    CHECK_EQ(s_seen.scans, 1000);
+    CHECK_EQ(s_seen.pages, 1000 / 20);
+    CHECK_EQ(peak, peak_small);
+}
+
+int main(void)
+{
+    fake_mqtt_set_callback(on_publish);
+    RUN(test_publish_all_json);
+    RUN(test_publish_all_bin);
+    RUN(test_publish_all_gzip);
+    RUN(test_incremental);
+    return 0;
+}
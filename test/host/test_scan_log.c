@@ -0,0 +1,238 @@
+// Host tests for scan_log.c on emulated NOR flash: round trips, ring
+// wrap-around, and recovery from power cuts in the middle of a record write
+// and in the middle of a sector erase.
+#include "scan_log.h"
+#include "fake_flash.h"
+#include "test_util.h"
+#include <string.h>
+
+#define MAX_SCANS 4000
+
+// Content of every scan saved so far, by index
+static int64_t s_ts[MAX_SCANS];
+static uint32_t s_seed[MAX_SCANS];
+
+static uint8_t make_scan(uint32_t seed, stored_ap_t *aps)
+{
+    uint8_t n = 1 + seed % CONFIG_LOCATOR_MAX_APS_PER_SCAN;
+    for (uint8_t i = 0; i < n; i++) {
+        memset(&aps[i], 0, sizeof(aps[i]));
+        for (int b = 0; b < 6; b++) aps[i].bssid[b] = (uint8_t)(seed * 31 + i * 7 + b);
+        aps[i].rssi = (int8_t)(-40 - (seed + i) % 50);
+        aps[i].channel = 1 + (seed + i) % 13;
+        aps[i].authmode = (seed + i) % 8;
+        aps[i].ssid_len = (seed + i) % 33;
+        for (int c = 0; c < aps[i].ssid_len; c++) aps[i].ssid[c] = 'a' + (seed + i + c) % 26;
+    }
+    return n;
+}
+
+static esp_err_t save(uint16_t expect_index, uint32_t seed)
+{
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n = make_scan(seed, aps);
+    uint16_t index;
+    // Recorded up front: a save cut by power loss may still have landed
+    s_ts[expect_index] = 1700000000 + seed;
+    s_seed[expect_index] = seed;
+    esp_err_t err = scan_log_save(aps, n, s_ts[expect_index], &index);
+    if (err == ESP_OK) CHECK_EQ(index, expect_index);
+    return err;
+}
+
+static void check_scan(uint16_t index)
+{
+    stored_ap_t want[CONFIG_LOCATOR_MAX_APS_PER_SCAN], got[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n = make_scan(s_seed[index], want), got_n = 0;
+    int64_t ts = 0;
+    CHECK_EQ(scan_log_load(index, got, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &got_n, &ts), ESP_OK);
+    CHECK_EQ(got_n, n);
+    CHECK_EQ(ts, s_ts[index]);
+    CHECK(memcmp(got, want, n * sizeof(stored_ap_t)) == 0);
+}
+
+// Every scan the log reports must be one that was saved, with its content
+static void check_all(uint16_t expect_count)
+{
+    uint16_t head, count;
+    scan_log_get_range(&head, &count);
+    CHECK_EQ(count, expect_count);
+    CHECK(head <= count);
+    for (uint16_t i = head; i < count; i++) check_scan(i);
+}
+
+// After a power cut the interrupted save may or may not have landed (a cut in
+// the record's 0xFF padding leaves it intact). Returns the new scan count.
+static uint16_t check_after_cut(uint16_t acked)
+{
+    uint16_t head, count;
+    scan_log_get_range(&head, &count);
+    CHECK(count == acked || count == acked + 1);
+    check_all(count);
+    return count;
+}
+
+static void reboot(void)
+{
+    fake_flash_power_on();
+    CHECK_EQ(scan_log_init(), ESP_OK);
+}
+
+static void test_round_trip(void)
+{
+    fake_flash_init(8 * FAKE_FLASH_SECTOR);
+    CHECK_EQ(scan_log_init(), ESP_OK);
+    for (uint16_t i = 0; i < 20; i++) CHECK_EQ(save(i, i), ESP_OK);
+
+    scan_location_t loc = { .lat = 52.5, .lng = 13.4, .accuracy = 25 };
+    CHECK_EQ(scan_log_save_location(3, &loc), ESP_OK);
+    CHECK_EQ(scan_log_delete(7), ESP_OK);
+    CHECK_EQ(scan_log_delete(7), ESP_ERR_NOT_FOUND);
+
+    reboot();
+    uint16_t head, count;
+    scan_log_get_range(&head, &count);
+    CHECK_EQ(head, 0);
+    CHECK_EQ(count, 20);
+    for (uint16_t i = 0; i < 20; i++) {
+        if (i == 7) {
+            CHECK_EQ(scan_log_load(i, NULL, 0, NULL, NULL), ESP_ERR_NOT_FOUND);
+            continue;
+        }
+        check_scan(i);
+    }
+    scan_location_t got;
+    CHECK_EQ(scan_log_get_location(3, &got), ESP_OK);
+    CHECK(got.lat == 52.5 && got.lng == 13.4 && got.accuracy == 25);
+    CHECK(!scan_log_has_location(4));
+}
+
+static void test_wrap(void)
+{
+    fake_flash_init(8 * FAKE_FLASH_SECTOR);
+    CHECK_EQ(scan_log_init(), ESP_OK);
+    for (uint16_t i = 0; i < 1000; i++) CHECK_EQ(save(i, i * 7919), ESP_OK);
+
+    uint16_t head, count;
+    scan_log_get_range(&head, &count);
+    CHECK(head > 0);
+    check_all(1000);
+
+    reboot();
+    uint16_t head2, count2;
+    scan_log_get_range(&head2, &count2);
+    CHECK_EQ(head2, head);
+    CHECK_EQ(count2, count);
+    check_all(1000);
+}
+
+// Cut power at every byte offset of the next record write, reboot, and check
+// that nothing acknowledged is lost and the log stays writable
+static void test_cut_mid_record(void)
+{
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    size_t rec_max = 16 + 9 + make_scan(9, aps) * (10 + 32) + 3;
+
+    for (size_t k = 0; k < rec_max; k++) {
+        fake_flash_init(8 * FAKE_FLASH_SECTOR);
+        CHECK_EQ(scan_log_init(), ESP_OK);
+        for (uint16_t i = 0; i < 10; i++) CHECK_EQ(save(i, i), ESP_OK);
+
+        fake_flash_cut_write(k);
+        uint16_t acked = 10;
+        if (save(10, 9) == ESP_OK) acked++;
+
+        reboot();
+        acked = check_after_cut(acked);
+        for (uint16_t i = acked; i < acked + 10; i++) CHECK_EQ(save(i, 100 + i), ESP_OK);
+        reboot();
+        check_all(acked + 10);
+    }
+}
+
+// Random cut points across sector changes, repeated over one long-lived log
+static void test_cut_random(void)
+{
+    srand(1);
+    fake_flash_init(6 * FAKE_FLASH_SECTOR);
+    CHECK_EQ(scan_log_init(), ESP_OK);
+    uint16_t acked = 0;
+
+    for (int trial = 0; trial < 300; trial++) {
+        fake_flash_cut_write(rand() % 3000);
+        while (acked < MAX_SCANS && save(acked, rand()) == ESP_OK) acked++;
+        CHECK(fake_flash_is_cut());
+        reboot();
+        acked = check_after_cut(acked);
+    }
+    CHECK(acked > 200);
+}
+
+// Cut power while the erase-ahead of the next sector is running
+static void test_cut_mid_erase(void)
+{
+    fake_flash_init(6 * FAKE_FLASH_SECTOR);
+    CHECK_EQ(scan_log_init(), ESP_OK);
+    uint16_t acked = 0;
+
+    for (int trial = 0; trial < 20; trial++) {
+        fake_flash_cut_erase(1);
+        while (save(acked, acked * 13) == ESP_OK) acked++;
+        CHECK(fake_flash_is_cut());
+        reboot();
+        acked = check_after_cut(acked);
+
+        // The interrupted sector was erased at boot: the log keeps working
+        for (int i = 0; i < 5; i++, acked++) CHECK_EQ(save(acked, acked * 13), ESP_OK);
+        reboot();
+        check_all(acked);
+    }
+}
+
+static int s_seen;
+static uint16_t s_first;
+
+static bool count_cb(uint16_t index, const stored_ap_t *aps, uint8_t ap_count,
+                     int64_t timestamp, const scan_location_t *loc, void *ctx)
+{
+    if (s_seen++ == 0) s_first = index;
+    return s_seen < *(int *)ctx;
+}
+
+// Iterating from an index seeks there through the RAM table instead of
+// reading every record before it
+static void test_iterate_from(void)
+{
+    fake_flash_init(32 * FAKE_FLASH_SECTOR);
+    CHECK_EQ(scan_log_init(), ESP_OK);
+    for (uint16_t i = 0; i < 150; i++) CHECK_EQ(save(i, i), ESP_OK);
+
+    int limit = 5;
+    s_seen = 0;
+    fake_flash_reset_stats();
+    CHECK_EQ(scan_log_iterate(140, count_cb, &limit), ESP_OK);
+    CHECK_EQ(s_seen, 5);
+    CHECK_EQ(s_first, 140);
+    CHECK(fake_flash_stats().reads <= 2 * 5);
+
+    limit = 1000;
+    s_seen = 0;
+    CHECK_EQ(scan_log_iterate(150, count_cb, &limit), ESP_OK);
+    CHECK_EQ(s_seen, 0);
+
+    s_seen = 0;
+    CHECK_EQ(scan_log_iterate(0, count_cb, &limit), ESP_OK);
+    CHECK_EQ(s_seen, 150);
+    CHECK_EQ(s_first, 0);
+}
+
+int main(void)
+{
+    RUN(test_round_trip);
+    RUN(test_wrap);
+    RUN(test_cut_mid_record);
+    RUN(test_cut_random);
+    RUN(test_cut_mid_erase);
+    RUN(test_iterate_from);
+    return 0;
+}
@@ -0,0 +1,421 @@
+// Host tests for the NVS scan storage in scan_store.c: round trips through
+// segments, reboots, power cuts between NVS operations, and the flash bytes
+// each save costs; migration from per-scan blobs and index rebuilds; the
+// DIFFS digests; the blocklist snapshot and the network cache eviction.
+//
+// scan_store.c is built into this file so a simulated reboot can drop its
+// RAM caches.
+#include "../../main/scan_store.c"
+#include "fake_nvs.h"
+#include "test_util.h"
+
+#define MAX_SCANS 4000
+
+static int64_t s_ts[MAX_SCANS];
+
+// A device on the move: consecutive scans share most APs, SSIDs repeat.
+// RSSIs are distinct and descending, the order loads return them in.
+static uint8_t make_scan(uint16_t index, stored_ap_t *aps)
+{
+    uint8_t n = 6 + index % 5;
+    for (uint8_t i = 0; i < n; i++) {
+        uint32_t id = index / 3 + i * 7;
+        memset(&aps[i], 0, sizeof(aps[i]));
+        aps[i].bssid[0] = 0x24;
+        aps[i].bssid[3] = (uint8_t)(id >> 16);
+        aps[i].bssid[4] = (uint8_t)(id >> 8);
+        aps[i].bssid[5] = (uint8_t)id;
+        aps[i].rssi = (int8_t)(-35 - i * 6 - (index + i) % 5);
+        aps[i].channel = 1 + id % 13;
+        aps[i].authmode = id % 5;
+        aps[i].ssid_len = (uint8_t)snprintf(aps[i].ssid, sizeof(aps[i].ssid), "net-%u", (unsigned)(id % 40));
+    }
+    return n;
+}
+
+static esp_err_t save(uint16_t expect_index)
+{
+    stored_ap_t aps[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n = make_scan(expect_index, aps);
+    s_ts[expect_index] = 1700000000 + (int64_t)expect_index * 60;
+    uint16_t index;
+    esp_err_t err = scan_store_save(aps, n, s_ts[expect_index], &index);
+    if (err == ESP_OK) CHECK_EQ(index, expect_index);
+    return err;
+}
+
+static void check_scan(uint16_t index)
+{
+    stored_ap_t want[CONFIG_LOCATOR_MAX_APS_PER_SCAN], got[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    uint8_t n = make_scan(index, want), got_n = 0;
+    CHECK_EQ(scan_store_load(index, got, CONFIG_LOCATOR_MAX_APS_PER_SCAN, &got_n), ESP_OK);
+    CHECK_EQ(got_n, n);
+    for (uint8_t i = 0; i < n; i++) {
+        CHECK(memcmp(got[i].bssid, want[i].bssid, 6) == 0);
+        CHECK_EQ(got[i].rssi, want[i].rssi);
+        CHECK_EQ(got[i].channel, want[i].channel);
+        CHECK_EQ(got[i].authmode, want[i].authmode);
+        CHECK_EQ(got[i].ssid_len, want[i].ssid_len);
+        CHECK(memcmp(got[i].ssid, want[i].ssid, want[i].ssid_len) == 0);
+    }
+    int64_t ts = 0;
+    uint8_t info_n = 0;
+    CHECK_EQ(scan_store_get_scan_info(index, &info_n, &ts), ESP_OK);
+    CHECK_EQ(info_n, n);
+    CHECK_EQ(ts, s_ts[index]);
+}
+
+static bool count_cb(uint16_t index, const scan_index_entry_t *entry, void *ctx)
+{
+    (*(int *)ctx)++;
+    return true;
+}
+
+static void check_all(uint16_t expect_count)
+{
+    uint16_t head, count;
+    CHECK_EQ(scan_store_get_range(&head, &count), ESP_OK);
+    CHECK_EQ(count, expect_count);
+    CHECK(count - head <= CONFIG_LOCATOR_MAX_STORED_SCANS);
+    for (uint16_t i = head; i < count; i++) check_scan(i);
+
+    int listed = 0;
+    CHECK_EQ(scan_store_iterate_headers(count_cb, &listed), ESP_OK);
+    CHECK_EQ(listed, count - head);
+}
+
+// Power cycle: everything in RAM is lost
+static void reboot(void)
+{
+    s_seg_no = -1;
+    s_blk_no = -1;
+    s_pend_n = 0;
+    s_pend_seg = -1;
+    fake_nvs_power_on();
+    CHECK_EQ(scan_store_init(), ESP_OK);
+}
+
+static void fresh(void)
+{
+    fake_nvs_init();
+    reboot();
+}
+
+static void test_round_trip(void)
+{
+    fresh();
+    for (uint16_t i = 0; i < 100; i++) CHECK_EQ(save(i), ESP_OK);
+    check_all(100);
+    reboot();
+    check_all(100);
+
+    // Past MAX_STORED_SCANS and across several segments
+    for (uint16_t i = 100; i < 700; i++) {
+        CHECK_EQ(save(i), ESP_OK);
+        if (i % 97 == 0) reboot();
+    }
+    check_all(700);
+    reboot();
+    check_all(700);
+}
+
+// Location and delete on the newest scans, then a reboot
+static void test_update_recent(void)
+{
+    fresh();
+    for (uint16_t i = 0; i < 5; i++) CHECK_EQ(save(i), ESP_OK);
+    CHECK_EQ(scan_store_save_location(4, 52.52, 13.405, 30), ESP_OK);
+    CHECK_EQ(scan_store_delete(3), ESP_OK);
+    CHECK_EQ(save(5), ESP_OK);
+    reboot();
+
+    CHECK_EQ(scan_store_load(3, NULL, 0, NULL), ESP_ERR_NVS_NOT_FOUND);
+    scan_location_t loc;
+    CHECK_EQ(scan_store_get_location(4, &loc), ESP_OK);
+    CHECK(loc.lat == 52.52 && loc.lng == 13.405 && loc.accuracy == 30);
+    CHECK(!scan_store_has_location(5));
+    check_scan(4);
+    check_scan(5);
+
+    CHECK_EQ(scan_store_delete_all(), ESP_OK);
+    reboot();
+    check_all(0);
+    CHECK_EQ(save(0), ESP_OK);
+    reboot();
+    check_all(1);
+}
+
+// A store from before segments: one sNNNNN blob per scan (index 3 deleted)
+// and an lNNNNN location for index 2
+static void test_migrate_legacy(void)
+{
+    fake_nvs_init();
+    CHECK_EQ(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_h), ESP_OK);
+    for (uint16_t i = 0; i < 6; i++) {
+        if (i == 3) continue;
+        uint8_t blob[sizeof(legacy_header_t) + CONFIG_LOCATOR_MAX_APS_PER_SCAN * sizeof(stored_ap_t)];
+        legacy_header_t sh = { .scan_index = i };
+        sh.ap_count = make_scan(i, (stored_ap_t *)(blob + sizeof(sh)));
+        s_ts[i] = sh.timestamp = 1700000000 + (int64_t)i * 60;
+        memcpy(blob, &sh, sizeof(sh));
+        char key[7];
+        snprintf(key, sizeof(key), "s%05u", i);
+        CHECK_EQ(nvs_set_blob(nvs_h, key, blob, legacy_size(sh.ap_count)), ESP_OK);
+    }
+    scan_location_t loc = { .lat = 48.137154, .lng = 11.576124, .accuracy = 25 };
+    CHECK_EQ(nvs_set_blob(nvs_h, "l00002", &loc, sizeof(loc)), ESP_OK);
+    CHECK_EQ(nvs_set_u16(nvs_h, "scan_head", 0), ESP_OK);
+    CHECK_EQ(nvs_set_u16(nvs_h, "scan_count", 6), ESP_OK);
+    CHECK_EQ(nvs_commit(nvs_h), ESP_OK);
+    reboot();
+
+    uint16_t head, count;
+    CHECK_EQ(scan_store_get_range(&head, &count), ESP_OK);
+    CHECK_EQ(head, 0);
+    CHECK_EQ(count, 6);
+    for (uint16_t i = 0; i < 6; i++) {
+        if (i != 3) check_scan(i);
+    }
+    CHECK_EQ(scan_store_load(3, NULL, 0, NULL), ESP_ERR_NVS_NOT_FOUND);
+    scan_location_t got;
+    CHECK_EQ(scan_store_get_location(2, &got), ESP_OK);
+    CHECK(fabs(got.lat - loc.lat) < 1e-6 && fabs(got.lng - loc.lng) < 1e-6 && got.accuracy == 25);
+    CHECK(!scan_store_has_location(4));
+
+    // The old blobs are gone and new scans follow on
+    size_t size = 0;
+    CHECK_EQ(nvs_get_blob(nvs_h, "s00000", NULL, &size), ESP_ERR_NVS_NOT_FOUND);
+    CHECK_EQ(nvs_get_blob(nvs_h, "l00002", NULL, &size), ESP_ERR_NVS_NOT_FOUND);
+    CHECK_EQ(save(6), ESP_OK);
+    reboot();
+    check_scan(6);
+    CHECK_EQ(scan_store_get_location(2, &got), ESP_OK);
+}
+
+// An index layout change keeps cached locations and deletions. The stored
+// blocks are rewritten as `old_size`-byte entries of index layout `version`:
+// same head and tail, digests of a different width in between.
+static void rebuild_from(uint16_t version, size_t old_size)
+{
+    fresh();
+    for (uint16_t i = 0; i < 45; i++) CHECK_EQ(save(i), ESP_OK);
+    CHECK_EQ(scan_store_save_location(5, 52.52, 13.405, 30), ESP_OK);
+    CHECK_EQ(scan_store_save_location(20, -33.8688, 151.2093, 1200), ESP_OK);
+    CHECK_EQ(scan_store_delete(7), ESP_OK);
+    CHECK_EQ(scan_store_delete(33), ESP_OK);
+    CHECK_EQ(save(45), ESP_OK);  // Pending, never in a stored block
+
+    const size_t size = sizeof(scan_index_entry_t);
+    for (uint16_t b = 0; b <= 45 / SCAN_INDEX_BLOCK; b++) {
+        scan_index_entry_t blk[SCAN_INDEX_BLOCK];
+        uint8_t out[SCAN_INDEX_BLOCK * 255];
+        char key[7];
+        make_index_key(b, key);
+        size_t got = sizeof(blk);
+        CHECK_EQ(nvs_get_blob(nvs_h, key, blk, &got), ESP_OK);
+        for (int k = 0; k < SCAN_INDEX_BLOCK; k++) {
+            uint8_t *o = out + k * old_size;
+            memcpy(o, &blk[k], 10);
+            memset(o + 10, 0xEE, old_size - 22);
+            memcpy(o + old_size - 12, (uint8_t *)&blk[k] + size - 12, 12);
+        }
+        CHECK_EQ(nvs_set_blob(nvs_h, key, out, SCAN_INDEX_BLOCK * old_size), ESP_OK);
+    }
+    CHECK_EQ(nvs_set_u16(nvs_h, "ix_layout", (uint16_t)((version << 8) | old_size)), ESP_OK);
+    CHECK_EQ(nvs_commit(nvs_h), ESP_OK);
+    reboot();
+
+    uint16_t layout = 0;
+    CHECK_EQ(nvs_get_u16(nvs_h, "ix_layout", &layout), ESP_OK);
+    CHECK_EQ(layout, SCAN_INDEX_LAYOUT);
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint16_t i = 0; i < 46; i++) {
+            if (i == 7 || i == 33) {
+                CHECK_EQ(scan_store_load(i, NULL, 0, NULL), ESP_ERR_NVS_NOT_FOUND);
+                continue;
+            }
+            check_scan(i);
+            CHECK_EQ(scan_store_has_location(i), i == 5 || i == 20);
+        }
+        scan_location_t loc;
+        CHECK_EQ(scan_store_get_location(5, &loc), ESP_OK);
+        CHECK(loc.lat == 52.52 && loc.lng == 13.405 && loc.accuracy == 30);
+        CHECK_EQ(scan_store_get_location(20, &loc), ESP_OK);
+        CHECK(loc.lat == -33.8688 && loc.lng == 151.2093 && loc.accuracy == 1200);
+        reboot();
+    }
+}
+
+static void test_index_rebuild(void)
+{
+    rebuild_from(2, 22 + CONFIG_LOCATOR_MAX_APS_PER_SCAN);  // 8-bit digests
+    rebuild_from(SCAN_INDEX_VERSION + 1, sizeof(scan_index_entry_t) + 2);
+}
+
+// DIFFS from the index digests agree with the exact BSSID comparison
+static void test_digest_diff(void)
+{
+    stored_ap_t prev[CONFIG_LOCATOR_MAX_APS_PER_SCAN], cur[CONFIG_LOCATOR_MAX_APS_PER_SCAN];
+    scan_index_entry_t pe, ce;
+    uint8_t pn = make_scan(0, prev);
+    index_fill_entry(&pe, prev, pn, 0, 0);
+    for (uint16_t i = 1; i < 3000; i++) {
+        uint8_t cn = make_scan(i * 7, cur);
+        index_fill_entry(&ce, cur, cn, 0, 0);
+        int exact = 0;
+        for (int side = 0; side < 2; side++) {
+            const stored_ap_t *x = side ? prev : cur, *y = side ? cur : prev;
+            uint8_t xn = side ? pn : cn, yn = side ? cn : pn;
+            for (uint8_t k = 0; k < xn; k++) {
+                bool found = false;
+                for (uint8_t j = 0; j < yn; j++) found |= memcmp(x[k].bssid, y[j].bssid, 6) == 0;
+                exact += !found;
+            }
+        }
+        CHECK_EQ(scan_store_digest_diff(&pe, &ce), exact);
+        memcpy(prev, cur, sizeof(cur));
+        pn = cn;
+        pe = ce;
+    }
+}
+
+// Cut power between any two NVS operations of a save. The interrupted save
+// may or may not have landed; everything acknowledged must be intact.
+static void test_power_cut(void)
+{
+    srand(1);
+    fresh();
+    CHECK_EQ(scan_store_delete_all(), ESP_OK);
+    size_t empty_keys = fake_nvs_key_count();
+    uint16_t acked = 0;
+    for (int trial = 0; trial < 400; trial++) {
+        fake_nvs_cut_after(rand() % 24);
+        while (acked < MAX_SCANS && save(acked) == ESP_OK) acked++;
+        reboot();
+
+        uint16_t head, count;
+        CHECK_EQ(scan_store_get_range(&head, &count), ESP_OK);
+        CHECK(count == acked || count == acked + 1);
+        acked = count;
+        check_all(acked);
+    }
+    CHECK(acked > 1000);
+
+    // Nothing left behind by the interrupted saves
+    CHECK_EQ(scan_store_delete_all(), ESP_OK);
+    CHECK_EQ(fake_nvs_key_count(), empty_keys);
+}
+
+// Flash bytes per save in steady state (full store, evicting)
+static void test_bytes_per_save(void)
+{
+    fresh();
+    uint16_t i = 0;
+    for (; i < 400; i++) CHECK_EQ(save(i), ESP_OK);
+    fake_nvs_reset_stats();
+    for (; i < 1400; i++) CHECK_EQ(save(i), ESP_OK);
+
+    fake_nvs_stats_t st = fake_nvs_stats();
+    printf("  %zu bytes and %.1f NVS writes per save\n", st.write_bytes / 1000,
+           st.writes / 1000.0);
+    // Rewriting the segment and its index block on every save cost ~3 KB
+    CHECK(st.write_bytes / 1000 < 1024);
+    check_all(1400);
+}
+
+// Blocklist lookups through a snapshot taken once per open WiFi cycle
+static void test_blocklist_snapshot(void)
+{
+    fresh();
+    const uint8_t ap1[6] = {1, 2, 3, 4, 5, 6}, ap2[6] = {1, 2, 3, 4, 5, 7};
+    CHECK_EQ(scan_store_blocklist_add("portal", NULL, BL_REASON_PASSWORD, 0), ESP_OK);
+    CHECK_EQ(scan_store_blocklist_add("cafe", ap1, BL_REASON_PORTAL, 3600), ESP_OK);
+
+    blocklist_snapshot_t *snap = scan_store_blocklist_snapshot();
+    CHECK(snap != NULL);
+    CHECK(scan_store_blocklist_snapshot_contains(snap, "portal", ap1));
+    CHECK(scan_store_blocklist_snapshot_contains(snap, "portal", NULL));
+    CHECK(scan_store_blocklist_snapshot_contains(snap, "cafe", ap1));
+    CHECK(!scan_store_blocklist_snapshot_contains(snap, "cafe", ap2));
+    CHECK(!scan_store_blocklist_snapshot_contains(snap, "cafe", NULL));
+    CHECK(!scan_store_blocklist_snapshot_contains(snap, "other", ap1));
+    scan_store_blocklist_snapshot_free(snap);
+    CHECK(!scan_store_blocklist_snapshot_contains(NULL, "portal", NULL));
+
+    CHECK_EQ(scan_store_blocklist_delete("portal"), ESP_OK);
+    snap = scan_store_blocklist_snapshot();
+    CHECK(!scan_store_blocklist_snapshot_contains(snap, "portal", NULL));
+    CHECK(scan_store_blocklist_snapshot_contains(snap, "cafe", ap1));
+    scan_store_blocklist_snapshot_free(snap);
+    CHECK_EQ(scan_store_blocklist_count(), 1);
+}
+
+static net_cache_entry_t net_entry(const char *ssid, uint8_t ok, uint8_t fail, uint16_t tti_ms)
+{
+    net_cache_entry_t e = {0};
+    strncpy(e.ssid, ssid, sizeof(e.ssid) - 1);
+    e.ok_count = ok;
+    e.fail_count = fail;
+    e.tti_ms[0] = tti_ms;
+    e.last_ok = ok ? 1700000000 + tti_ms : 0;
+    e.channel = ok ? 6 : 0;
+    return e;
+}
+
+// Networks that never worked must not push out ones that do
+static void test_net_cache_eviction(void)
+{
+    fresh();
+    s_net.magic = 0;
+    char ssid[16];
+    for (int i = 0; i < NET_CACHE_MAX; i++) {
+        snprintf(ssid, sizeof(ssid), "good-%d", i);
+        net_cache_entry_t e = net_entry(ssid, 3, 0, 3000 + i * 100);
+        CHECK_EQ(scan_store_net_cache_put(&e), ESP_OK);
+    }
+    for (int i = 0; i < 3 * NET_CACHE_MAX; i++) {
+        snprintf(ssid, sizeof(ssid), "bad-%d", i);
+        net_cache_entry_t e = net_entry(ssid, 0, 2, 0);
+        CHECK_EQ(scan_store_net_cache_put(&e), ESP_OK);
+    }
+    net_cache_entry_t got;
+    for (int i = 0; i < NET_CACHE_MAX; i++) {
+        snprintf(ssid, sizeof(ssid), "good-%d", i);
+        CHECK(scan_store_net_cache_find(ssid, &got));
+        CHECK_EQ(got.ok_count, 3);
+    }
+    // Failures are remembered for the most recent NET_FAIL_MAX of them
+    CHECK(scan_store_net_cache_find("bad-35", &got));
+    CHECK_EQ(got.fail_count, 2);
+    CHECK_EQ(got.ok_count, 0);
+    CHECK(!scan_store_net_cache_find("bad-0", &got));
+
+    // A new working network replaces the slowest one, and leaves the
+    // failure table once it worked
+    net_cache_entry_t e = net_entry("bad-35", 1, 2, 1000);
+    CHECK_EQ(scan_store_net_cache_put(&e), ESP_OK);
+    CHECK(!scan_store_net_cache_find("good-11", &got));
+    CHECK(scan_store_net_cache_find("good-10", &got));
+    CHECK(scan_store_net_cache_find("bad-35", &got));
+    CHECK_EQ(got.channel, 6);
+    CHECK_EQ(s_net.fail_n, NET_FAIL_MAX - 1);
+
+    // Kept across a reboot (RTC memory lost)
+    s_net.magic = 0;
+    CHECK(scan_store_net_cache_find("good-0", &got));
+    CHECK(scan_store_net_cache_find("bad-34", &got));
+}
+
+int main(void)
+{
+    RUN(test_round_trip);
+    RUN(test_update_recent);
+    RUN(test_power_cut);
+    RUN(test_migrate_legacy);
+    RUN(test_index_rebuild);
+    RUN(test_digest_diff);
+    RUN(test_bytes_per_save);
+    RUN(test_blocklist_snapshot);
+    RUN(test_net_cache_eviction);
+    return 0;
+}
@@ -0,0 +1,23 @@
+// Minimal assertion helpers for the host tests
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) do {                                                        \
+    if (!(cond)) {                                                              \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1);                                                                \
+    }                                                                           \
+} while (0)
+
+#define CHECK_EQ(a, b) do {                                                     \
+    long long _a = (long long)(a), _b = (long long)(b);                        \
+    if (_a != _b) {                                                             \
+        fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld != %lld)\n",    \
+                __FILE__, __LINE__, #a, #b, _a, _b);                            \
+        exit(1);                                                                \
+    }                                                                           \
+} while (0)
+
+#define RUN(test) do { printf("%s\n", #test); test(); } while (0)